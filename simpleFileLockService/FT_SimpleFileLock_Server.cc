@@ -1,33 +1,23 @@
 #include <cassert>
+#include <chrono>
 #include <getopt.h>
 #include <iostream>
 #include <iterator>
+#include <mutex>
 #include <sstream>
+#include <thread>
 #include <string.h>
 #include <arpa/inet.h>
 #include <errno.h>
-#include "FT_defns.h"
+#include "defns.h"
+#include "SimpleFileLock_Engine.h"
+#include "SimpleFileLock_Storage.h"
+#include "SimpleFileLock_Capture.h"
 
 #include <LogCabin/Client.h>
 #include <LogCabin/Debug.h>
 #include <LogCabin/Util.h>
 
-/* Globals */
-static ClientTableNode_t *clientTableList;
-static LockTableNode_t *lockTableList;
-int commFailureCounter;
-
-/* Function Prototypes */
-status_t HandleRequest(LogCabin::Client::Cluster, ServerStruct_t, ClientRequest_t);
-RequestAction_t ValidateClient(ClientRequest_t, ClientTableNode_t **);
-ClientTableNode_t *GetClient(ClientRequest_t);
-status_t DeleteClient(char *, int);
-ClientTableNode_t *AddClient(ClientRequest_t);
-status_t ReleaseLock(char *, char *, int);
-status_t ReleaseClientLocks(char *, int);
-LockTableNode_t *GetLock(char *,char *);
-LockTableNode_t *AddLock(char *,char *, int, LockType_t);
-
 namespace {
 
 using LogCabin::Client::Cluster;
@@ -55,16 +45,38 @@ class OptionParser {
         , cluster("server_1:5254,server_2:5254,server_3:5254,server_4:5254,server_5:5254")
         , port(9001)
   	  	, logPolicy("")
+        , metricsPort(0)
+        , traceSampleRate(0)
+        , dropStale(false)
+        , capturePath("")
+        , captureSize(CAPTURE_DEFAULT_MB)
+        , captureFiles(CAPTURE_DEFAULT_FILES)
+        , io(EVENT_BLOCKING)
+        , advertise("")
+        , localPath("")
+        , clientTtl(0)
+        , clientMemory(0)
     {
         while (true) {
             static struct option longOptions[] = {
                {"cluster",  required_argument, NULL, 'c'},
                {"port",  required_argument, NULL, 'p'},
                {"help",  no_argument, NULL, 'h'},
+               {"io",  required_argument, NULL, 'i'},
                {"verbose",  no_argument, NULL, 'v'},
+               {"metrics-port",  required_argument, NULL, 'm'},
+               {"trace",  required_argument, NULL, 't'},
+               {"drop-stale",  no_argument, NULL, 'd'},
+               {"capture",  required_argument, NULL, 'C'},
+               {"capture-size",  required_argument, NULL, CAPTURE_OPTION_SIZE},
+               {"capture-files",  required_argument, NULL, CAPTURE_OPTION_FILES},
+               {"advertise",  required_argument, NULL, 'a'},
+               {"local",  required_argument, NULL, 'u'},
+               {"client-ttl",  required_argument, NULL, ENGINE_OPTION_CLIENT_TTL},
+               {"client-memory",  required_argument, NULL, ENGINE_OPTION_CLIENT_MEMORY},
                {0, 0, 0, 0}
             };
-            int c = getopt_long(argc, argv, "p:c:hv", longOptions, NULL);
+            int c = getopt_long(argc, argv, "p:c:hi:vm:t:dC:a:u:", longOptions, NULL);
 
             // Detect the end of the options.
             if (c == -1)
@@ -80,9 +92,47 @@ class OptionParser {
                 case 'h':
                     usage();
                     exit(0);
+                case 'i':
+                    if (EventEngineFromName(optarg, &io) != 0) {
+                        usage();
+                        exit(1);
+                    }
+                    break;
                 case 'v':
                     logPolicy = "VERBOSE";
                     break;
+                case 'm':
+                    metricsPort = std::stoul(optarg);
+                    break;
+                case 't':
+                    traceSampleRate = std::stoul(optarg);
+                    break;
+                case 'd':
+                    dropStale = true;
+                    break;
+                case 'C':
+                    capturePath = optarg;
+                    break;
+                case CAPTURE_OPTION_SIZE:
+                    captureSize = std::stoul(optarg);
+                    break;
+                case CAPTURE_OPTION_FILES:
+                    captureFiles = std::stoul(optarg);
+                    break;
+                case 'a':
+                    advertise = optarg;
+                    break;
+                case 'u':
+                    localPath = optarg;
+                    break;
+                case ENGINE_OPTION_CLIENT_TTL:
+                    clientTtl = std::stoul(optarg);
+                    if (clientTtl != 0 && clientTtl < ENGINE_CLIENT_TTL_MIN)
+                        clientTtl = ENGINE_CLIENT_TTL_MIN;
+                    break;
+                case ENGINE_OPTION_CLIENT_MEMORY:
+                    clientMemory = std::stoul(optarg);
+                    break;
                 case '?':
                 default:
                     // getopt_long already printed an error message.
@@ -107,6 +157,16 @@ class OptionParser {
 
         std::cout << "Options:" << std::endl;
         std::cout
+            << "  -a <ip:port>, --advertise=<ip:port>  "
+            << "Serve clients only while this server holds"
+            << std::endl
+            << "                                 "
+            << "the active lease in LogCabin, redirecting them to"
+            << std::endl
+            << "                                 "
+            << "the holder otherwise; clients reach it at <ip:port>"
+            << std::endl
+
             << "  -c <addresses>, --cluster=<addresses>  "
             << "Network addresses of the LogCabin"
             << std::endl
@@ -117,16 +177,74 @@ class OptionParser {
             << "[default: server_1:5254,server_2:5254,server_3:5254,server_4:5254,server_5:5254]"
             << std::endl
 
+            << "  --client-ttl=<s>               "
+            << "Forget clients without locks idle for <s> seconds"
+            << std::endl
+            << "                                 "
+            << "[default: 0, never]"
+            << std::endl
+            << "  --client-memory=<MB>           "
+            << "Forget the least recently active clients without"
+            << std::endl
+            << "                                 "
+            << "locks past <MB> of client table [default: 0, no cap]"
+            << std::endl
+
+            << "  -C <path>, --capture=<path>    "
+            << "Record requests and responses to <path>.NNNNNN"
+            << std::endl
+            << "  --capture-size=<MB>            "
+            << "Start a new capture file after <MB> [default: 64]"
+            << std::endl
+            << "  --capture-files=<N>            "
+            << "Keep the newest <N> capture files, 0 for all [default: 8]"
+            << std::endl
+
             << "  -h, --help                     "
             << "Print this usage information"
             << std::endl
 
+            << "  -i <engine>, --io=<engine>     "
+            << "Network I/O: blocking, epoll or uring"
+            << std::endl
+            << "                                 "
+            << "(falls back to epoll) [default: blocking]"
+            << std::endl
+
+            << "  -m <port>, --metrics-port=<port>  "
+            << "Serve Prometheus metrics on 127.0.0.1:<port>"
+            << std::endl
+
+            << "  -t <N>, --trace=<N>            "
+            << "Trace one in every N requests, SIGUSR1 writes"
+            << std::endl
+            << "                                 "
+            << "sfl-trace-<pid>-<n>.json"
+            << std::endl
+
+            << "  -d, --drop-stale               "
+            << "Drop requests that waited in the receive queue longer"
+            << std::endl
+            << "                                 "
+            << "than the client retransmit timeout"
+            << std::endl
+
             << "  -p <port>, --port=<port>  "
             << "Network port for the FT Simple File Locking Service to listen on"
             << std::endl
 
+            << "  -u <path>, --local=<path>      "
+            << "Also serve clients on this host on a Unix datagram"
+            << std::endl
+            << "                                 "
+            << "socket at <path>, a leading @ for an abstract name"
+            << std::endl
+
             << "  -v, --verbose                  "
-            << "Same as --verbosity=VERBOSE (added in v1.1.0)"
+            << "Same as --verbosity=VERBOSE (added in v1.1.0), also logs"
+            << std::endl
+            << "                                 "
+            << "every request"
             << std::endl;
     }
 
@@ -135,6 +253,17 @@ class OptionParser {
     std::string cluster;
     uint16_t port;
     std::string logPolicy;
+    uint16_t metricsPort;
+    int traceSampleRate;
+    bool dropStale;
+    std::string capturePath;
+    int captureSize;
+    int captureFiles;
+    EventEngine_t io;
+    std::string advertise;
+    std::string localPath;
+    int clientTtl;
+    int clientMemory;
 };
 
 /**
@@ -156,839 +285,307 @@ dumpTree(const Tree& tree, std::string path)
     }
 }
 
-} // anonymous namespace
+/*
+ * LogCabin storage backend.  LogCabin has no open files, so every open file
+ * shares the tree as its handle and keeps its position in byteOffset.  Reads
+ * and writes move the whole file, which is fine for files of a few hundred
+ * bytes.
+ */
+Tree *logCabinTree;
 
-int
-main(int argc, char** argv)
+void *
+LogCabinOpen(ParsedOperation_t *parsed)
 {
-    try {
-        OptionParser options(argc, argv);
-
-        LogCabin::Client::Debug::setLogPolicy(
-            LogCabin::Client::Debug::logPolicyFromString(options.logPolicy));
-
-        Cluster cluster(options.cluster);
-        Tree tree = cluster.getTree();
-    	ServerStruct_t serverStruct;
-    	int recvMsgSize = 0;
-    	ClientRequest_t request;
-
-    	/* Initialize structures */
-    	clientTableList = NULL;
-    	lockTableList = NULL;
-        memset(&serverStruct, 0, sizeof(ServerStruct_t));
-        commFailureCounter = 0;
-
-        printf("Sean Gatenby\nCSE531 Lab2 Server\ns");
-
-		dumpTree(tree, "/");
-
-
-        /* Initialize random number generator */
-        srand(time(NULL));
-
-
-		serverStruct.serverPortNumber = options.port; /* First arg: server port number (decimal number 1024-65535) */
-
-		/* Create socket for sending/receiving datagrams */
-		if ((serverStruct.sockfd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) >= 0)
-		{
-			/* Construct local address structure */
-			memset(&(serverStruct.serverAddr), 0, sizeof(serverStruct.serverAddr));   /* Zero out structure */
-			serverStruct.serverAddr.sin_family = AF_INET;                /* Internet address family */
-			serverStruct.serverAddr.sin_addr.s_addr = htonl(INADDR_ANY); /* Any incoming interface */
-			serverStruct.serverAddr.sin_port = htons(serverStruct.serverPortNumber);      /* Local port */
-
-			/* Bind to the local address */
-			if (bind(serverStruct.sockfd, (struct sockaddr *) &(serverStruct.serverAddr), sizeof(serverStruct.serverAddr)) >= 0)
-			{
-				for (;;) /* Run forever */
-				{
-					/* Set the size of the in-out parameter */
-					socklen_t clientAddrLen = sizeof(serverStruct.clientAddr);
-
-					/* Block until receive message from a client */
-					if ((recvMsgSize = recvfrom(serverStruct.sockfd, &request, sizeof(ClientRequest_t), 0, (struct sockaddr *) &(serverStruct.clientAddr), &clientAddrLen)) == sizeof(ClientRequest_t))
-					{
-#ifdef DEBUG
-						printf("%s:%d.%d_%d - %s", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber, request.operation);
-#endif
-						/* Parse request */
-						if(HandleRequest(cluster, serverStruct, request) == ERROR)
-						{
-							printError("Failed to process request: %s", request.operation);
-						}
-					}
-					else
-					{
-						printErrno("Read %d bytes instead of %d", recvMsgSize, (int)sizeof(ClientRequest_t));
-					}
-				}
-			}
-			else
-			{
-				printErrno("Can't bind to port %d", serverStruct.serverPortNumber);
-			}
-		}
-		else
-		{
-			printErrno("Can't create socket%s", "");
-		}
-
-        return 0;
+    return logCabinTree;
+}
 
-    } catch (const LogCabin::Client::Exception& e) {
-        std::cerr << "Exiting due to LogCabin::Client::Exception: "
-                  << e.what()
-                  << std::endl;
-        exit(1);
-    }
+int
+LogCabinClose(LockTableNode_t *lockNode)
+{
+    return OK;
 }
 
-status_t HandleRequest(LogCabin::Client::Cluster cluster, ServerStruct_t serverStruct, ClientRequest_t request)
+int
+LogCabinRead(LockTableNode_t *lockNode, ParsedOperation_t *parsed, char *buffer)
 {
-	status_t status = ERROR;
-	status_t validArgs = ERROR;
-	status_t gotLock = ERROR;
-	status_t readyToTransmit = ERROR;
-	char *commandString;
-	char *fileNameString;
-	char *modeString;
-	char *numBytesString;
-	char *messageString;
-	char mode[3];
-	int numBytes;
-	RequestAction_t action;
-	ClientTableNode_t *clientNode = NULL;
-	LockTableNode_t *lockNode = NULL;
-	LockType_t lockType = NO_LOCK;
-	int bytesSent = 0;
-	char filePath[200];
-
-    Tree tree = cluster.getTree();
-
-
-	/* Based on client table, determine what action to take as well
-	 * as populating clientNode */
-	action = ValidateClient(request, &clientNode);
-
-	/* Only act on  */
-	if(action == DROP_REQUEST_SEND_NOTHING)
-	{
-	    status = OK;
-	}
-	else if(action == SEND_STORED_RESPONSE)
+    Tree *tree = static_cast<Tree *>(lockNode->fileHandle);
+    std::string contents;
+    int bytesRead = 0;
+
+    // Read whole file from LogCabin, a file that was never written is empty
+    try
     {
-        readyToTransmit = OK;
+        contents = tree->readEx(parsed->filePath);
     }
-    /* PROCESS_REQUEST_SEND_RESPONSE and PROCESS_REQUEST_SEND_NOTHING */
-    else
+    catch (const LogCabin::Client::Exception& e)
     {
-        if((commandString = strtok(request.operation, " \r\n")) != NULL)
-        {
-            if((fileNameString = strtok(NULL, " \r\n")) != NULL)
-            {
-                /* Build file path */
-                strcpy(filePath, request.machineName);
-                strcat(filePath, ":");
-                strcat(filePath, fileNameString);
-
-                if(strcmp(commandString, "open") == 0)
-                {
-                    if((modeString = strtok(NULL, " \r\n")) != NULL)
-                    {
-                        /* Build the mode string and lock type */
-                        if(strcmp(modeString, "read") == 0)
-                        {
-                            lockType = READ_LOCK;
-                            strcpy(mode, "r");
-                            validArgs = OK;
-                        }
-                        else if(strcmp(modeString, "write") == 0)
-                        {
-                            lockType = WRITE_LOCK;
-                            strcpy(mode, "w+");
-                            validArgs = OK;
-                        }
-                        else if(strcmp(modeString, "readwrite") == 0)
-                        {
-                            lockType = (LockType_t)(READ_LOCK | WRITE_LOCK);
-                            strcpy(mode, "r+");
-                            validArgs = OK;
-                        }
-                        else
-                        {
-                            printError("Invalid open 'mode': %s", modeString);
-                        }
-                    }
-                    else
-                    {
-                        printError("Invalid 'open' arguments: %s", request.operation);
-                    }
-                }
-                else if(strcmp(commandString, "close") == 0)
-                {
-                    lockType = (LockType_t)(READ_LOCK | WRITE_LOCK);
-                    validArgs = OK;
-                }
-                else if(strcmp(commandString, "read") == 0)
-                {
-                    if((numBytesString = strtok(NULL, " \r\n")) != NULL)
-                     {
-                         if((numBytes = strtol(numBytesString, NULL, 10)) > 0)
-                         {
-                             lockType = READ_LOCK;
-                             validArgs = OK;
-                         }
-                         else
-                         {
-                             printError("Invalid read 'numBytes': %d", numBytes);
-                         }
-                     }
-                    else
-                    {
-                        printError("Invalid 'read' arguments: %s", request.operation);
-                    }
-                }
-                else if(strcmp(commandString, "write") == 0)
-                {
-                    if((messageString = strtok(NULL, "\"")) != NULL)
-                     {
-                        lockType = WRITE_LOCK;
-                        validArgs = OK;
-                     }
-                    else
-                    {
-                        printError("Invalid 'write' arguments: %s", request.operation);
-                    }
-                }
-                else if(strcmp(commandString, "lseek") == 0)
-                {
-                    if((numBytesString = strtok(NULL, " \r\n")) != NULL)
-                    {
-                        if((numBytes = strtol(numBytesString, NULL, 10)) > 0)
-                        {
-                            lockType = (LockType_t)(READ_LOCK | WRITE_LOCK);
-                            validArgs = OK;
-                        }
-                        else
-                        {
-                            printError("Invalid lseek 'position': %d", numBytes);
-                        }
-                    }
-                    else
-                    {
-                        printError("Invalid 'lseek' arguments: %s", request.operation);
-                    }
-                }
-                else
-                {
-                    printError("Invalid command: %s\n", request.operation);
-                }
-            }
-            else
-            {
-                printError("Invalid argument: %s\n", request.operation);
-            }
-        }
-        else
-        {
-            printError("Invalid argument: %s\n", request.operation);
-        }
-
-        /* If args are OK, create lock and open file */
-        if(validArgs == OK)
-        {
-            /* Check if any locks exist for the client and make sure the lockType supports the request */
-            if((lockNode = GetLock(request.machineName, fileNameString)) != NULL)
-            {
-                if(lockNode->clientNumber == request.clientNumber)
-                {
-                    if((lockNode->lockStatus == lockType) ||
-                       (strcmp(commandString, "close") == 0) ||
-                       (strcmp(commandString, "lseek") == 0))
-                    {
-                        gotLock = OK;
-                    }
-                    else
-                    {
-                        clientNode->storedResponse.returnValue = ERROR;
-                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Invalid lock type for %s operation\n", commandString);
-                        printError("%s", clientNode->storedResponse.returnString);
-                        clientNode->requestNumber = request.requestNumber;
-                        readyToTransmit = OK;
-                    }
-                }
-                else
-                {
-                    clientNode->storedResponse.returnValue = ERROR;
-                    snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't get lock for %s:%s for client %d as %d has it already\n", lockNode->machineName, lockNode->fileName, request.clientNumber, lockNode->clientNumber);
-                    printError("%s", clientNode->storedResponse.returnString);
-                    clientNode->requestNumber = request.requestNumber;
-                    readyToTransmit = OK;
-                }
-            }
-            /* Create new lock for open commands only */
-            else if((strcmp(commandString, "open") == 0))
-            {
-                if((lockNode = AddLock(request.machineName, fileNameString, request.clientNumber, lockType)) != NULL)
-                {
-                    gotLock = OK;
-                }
-                else
-                {
-                    clientNode->storedResponse.returnValue = ERROR;
-                    snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't create lock for %s:%s for client %d\n", lockNode->machineName, lockNode->fileName, request.clientNumber);
-                    printError("%s", clientNode->storedResponse.returnString);
-                    clientNode->requestNumber = request.requestNumber;
-                    readyToTransmit = OK;
-                }
-            }
-            else
-            {
-                clientNode->storedResponse.returnValue = ERROR;
-                snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "No lock found for %s:%s\n", lockNode->machineName, lockNode->fileName);
-                printError("%s", clientNode->storedResponse.returnString);
-                clientNode->requestNumber = request.requestNumber;
-                readyToTransmit = OK;
-            }
-
-            if(gotLock == OK)
-            {
-                if(strcmp(commandString, "open") == 0)
-                {
-					lockNode->isFileOpen = true;
-					lockNode->byteOffset = 0;
-					clientNode->storedResponse.returnValue = OK;
-					snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Opened %s\n", filePath);
-
-                    clientNode->requestNumber = request.requestNumber;
-                    readyToTransmit = OK;
-                }
-                else if(strcmp(commandString, "close") == 0)
-                {
-					lockNode->isFileOpen = false;
-					lockNode->byteOffset = 0;
-					if(ReleaseLock(request.machineName, fileNameString, request.clientNumber) == OK)
-					{
-						clientNode->storedResponse.returnValue = OK;
-						snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Closed %s\n", filePath);
-					}
-					else
-					{
-						clientNode->storedResponse.returnValue = ERROR;
-						snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't release lock for %s for client %d\n", filePath, request.clientNumber);
-						printError("%s", clientNode->storedResponse.returnString);
-					}
-
-                    clientNode->requestNumber = request.requestNumber;
-                    readyToTransmit = OK;
-                }
-                else if(strcmp(commandString, "read") == 0)
-                {
-                    if(lockNode->isFileOpen == true)
-                    {
-                        int bytesRead = 0;
-
-                        // Populate start of return string
-                        strcpy(clientNode->storedResponse.returnString, "Read '");
-
-                        // Read whole file from LogCabin
-                        std::string contents = tree.readEx(filePath);
-
-                        if(lockNode->byteOffset + numBytes > (int)contents.size())
-                        {
-                            bytesRead = contents.size() - lockNode->byteOffset;
-                        }
-                        else
-                        {
-                        	bytesRead = numBytes;
-                        }
-
-                        // populate return string
-                        strcat(clientNode->storedResponse.returnString, contents.substr(lockNode->byteOffset, bytesRead).c_str());
-
-                        // Increment file pointer my bytesRead
-                        lockNode->byteOffset += bytesRead;
-
-                        if(bytesRead == numBytes)
-                        {
-                            clientNode->storedResponse.returnValue = OK;
-                            strcat(clientNode->storedResponse.returnString, "' from ");
-                            strcat(clientNode->storedResponse.returnString, filePath);
-                            strcat(clientNode->storedResponse.returnString, "\n");
-                        }
-                        else
-                        {
-                            clientNode->storedResponse.returnValue = ERROR;
-                            snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Encountered EOF during read: only read %d bytes\n", bytesRead);
-                            printError("%s", clientNode->storedResponse.returnString);
-                        }
-                    }
-                    else
-                    {
-                        clientNode->storedResponse.returnValue = ERROR;
-                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "File handle NULL, is %s open?\n", filePath);
-                        printError("%s", clientNode->storedResponse.returnString);
-                    }
-
-                    clientNode->requestNumber = request.requestNumber;
-                    readyToTransmit = OK;
-                }
-                else if(strcmp(commandString, "write") == 0)
-                {
-                    if(lockNode->isFileOpen == true)
-                    {
-                    	std::string contents = "";
-
-                        // Read whole file from LogCabin
-                    	try
-                    	{
-                            contents = tree.readEx(filePath);
-                    	}catch(...)
-                    	{
-                    		std::cout << "GotException" << std::endl;
-                    		contents = "";
-                    	}
-
-                        std::string replaceString = messageString;
-
-                        contents.replace(lockNode->byteOffset, replaceString.length(), replaceString);
-
-                        tree.writeEx(filePath, contents);
-
-                        lockNode->byteOffset += replaceString.length();
-
-						clientNode->storedResponse.returnValue = OK;
-						snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Wrote '%s' to %s\n", messageString, filePath);
-                    }
-                    else
-                    {
-                        clientNode->storedResponse.returnValue = ERROR;
-                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "File handle NULL, is %s open?\n", filePath);
-                        printError("%s", clientNode->storedResponse.returnString);
-                    }
-
-                    clientNode->requestNumber = request.requestNumber;
-                    readyToTransmit = OK;
-                }
-                else if(strcmp(commandString, "lseek") == 0)
-                {
-                    if(lockNode->isFileOpen == true)
-                    {
-                    	lockNode->byteOffset = numBytes;
-
-						clientNode->storedResponse.returnValue = OK;
-						snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Moved %s file pointer to %d bytes from start\n", filePath, numBytes);
-                    }
-                    else
-                    {
-                        clientNode->storedResponse.returnValue = ERROR;
-                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "File handle NULL, is %s open?\n", filePath);
-                        printError("%s", clientNode->storedResponse.returnString);
-                    }
-
-                    clientNode->requestNumber = request.requestNumber;
-                    readyToTransmit = OK;
-                }
-                else
-                {
-                    clientNode->storedResponse.returnValue = ERROR;
-                    snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "File handle NULL, is %s open?\n", filePath);
-                    printError("%s", clientNode->storedResponse.returnString);
-                    clientNode->requestNumber = request.requestNumber;
-                    readyToTransmit = OK;
-                }
-            }
-        }
-        else
-        {
-            clientNode->storedResponse.returnValue = ERROR;
-            snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Invalid command arguments: %s\n", request.operation);
-            printError("%s", clientNode->storedResponse.returnString);
-            clientNode->requestNumber = request.requestNumber;
-            readyToTransmit = OK;
-        }
-
-        /* Set done flag if we finished processing, but don't want to send anything */
-        if((readyToTransmit == OK) && (action == PROCESS_REQUEST_SEND_NOTHING))
-        {
-            status = OK;
-        }
+        contents = "";
     }
 
-	/* Everything else checks out, but we haven't transmitted yet */
-    if((status != OK) &&
-       (readyToTransmit == OK))
+    if(lockNode->byteOffset < (int)contents.size())
     {
-        /* Transmit response */
-        if ((bytesSent = sendto(serverStruct.sockfd, &clientNode->storedResponse, sizeof(clientNode->storedResponse), 0, (struct sockaddr *) &(serverStruct.clientAddr), sizeof(serverStruct.clientAddr))) == sizeof(clientNode->storedResponse))
-        {
-            status = OK;
-        }
-        else
-        {
-            printErrno("Sent a different number of bytes than expected: %d instead of %d", bytesSent, (int)sizeof(clientNode->storedResponse));
-        }
+        bytesRead = contents.copy(buffer, parsed->numBytes, lockNode->byteOffset);
+        lockNode->byteOffset += bytesRead;
     }
 
-	return status;
+    return bytesRead;
 }
 
-RequestAction_t ValidateClient(ClientRequest_t request, ClientTableNode_t **clientNode)
+int
+LogCabinWrite(LockTableNode_t *lockNode, ParsedOperation_t *parsed)
 {
-    ClientTableNode_t *tempNode = NULL;
-    RequestAction_t action = DROP_REQUEST_SEND_NOTHING;
+    Tree *tree = static_cast<Tree *>(lockNode->fileHandle);
+    std::string contents;
+    std::string replaceString = parsed->messageString;
+    int status = ERROR;
 
-    /* Client with same machine name and client number is already in the list */
-    if((tempNode = GetClient(request)) != NULL)
+    try
     {
-        /* Client crashed! */
-        if(request.clientIncarnation != tempNode->clientIncarnation)
+        // Read whole file from LogCabin
+        try
         {
-#ifdef DEBUG
-            printf("%s:%d.%d_%d - Client Crashed: Deleting Client Entry, Freeing Locks\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
-#endif
-            /* Remove all locks associated with that machine */
-            ReleaseClientLocks(tempNode->machineName, tempNode->clientNumber);
-
-            if(DeleteClient(tempNode->machineName, tempNode->clientNumber) != OK)
-            {
-                printError("Can't remove client entry: %s:%d", tempNode->machineName, tempNode->clientNumber);
-            }
-
-#ifdef DEBUG
-            printf("%s:%d.%d_%d - New Client: Process Request, Send Response\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
-#endif
-            tempNode = AddClient(request);
-            action = PROCESS_REQUEST_SEND_RESPONSE;
+            contents = tree->readEx(parsed->filePath);
         }
-        else
+        catch (const LogCabin::Client::Exception& e)
         {
-            /* Stale request, drop it */
-            if(request.requestNumber < tempNode->requestNumber)
-            {
-#ifdef DEBUG
-                printf("%s:%d.%d_%d - Stale Request: Drop Request, Send Nothing\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
-#endif
-                action = DROP_REQUEST_SEND_NOTHING;
-            }
-
-            /* Client requesting duplicate request, send stored response */
-            else if(request.requestNumber == tempNode->requestNumber)
-            {
-#ifdef DEBUG
-                printf("%s:%d.%d_%d - Duplicate Request: Send Stored Response\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
-#endif
-                action = SEND_STORED_RESPONSE;
-            }
+            contents = "";
+        }
 
-            /* Simulate com failure */
-            else if(request.requestNumber > tempNode->requestNumber)
-            {
-                switch(rand()%3)
-                {
-                    case 0:
-                    {
-#ifdef DEBUG
-                        printf("%s:%d.%d_%d - Comm Failure: Drop Request, Send Nothing\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
-#endif
-                        action = DROP_REQUEST_SEND_NOTHING;
-                        break;
-                    }
-                    case 1:
-                    {
-#ifdef DEBUG
-                        printf("%s:%d.%d_%d - Comm Failure: Process Request, Send Nothing\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
-#endif
-                        action = PROCESS_REQUEST_SEND_NOTHING;
-                        break;
-                    }
-                    case 2:
-                    {
-#ifdef DEBUG
-                        printf("%s:%d.%d_%d - Comm Failure: Process Request, Send Response\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
-#endif
-                        action = PROCESS_REQUEST_SEND_RESPONSE;
-                        break;
-                    }
-                }
+        if(lockNode->append)
+        {
+            lockNode->byteOffset = contents.size();
+        }
 
-                /* Increment counter */
-                commFailureCounter++;
-            }
+        // Writing past the end leaves a hole of zeros, as the file backend does
+        if(lockNode->byteOffset > (int)contents.size())
+        {
+            contents.resize(lockNode->byteOffset, '\0');
         }
+        contents.replace(lockNode->byteOffset, replaceString.length(), replaceString);
+
+        tree->writeEx(parsed->filePath, contents);
+
+        lockNode->byteOffset += replaceString.length();
+        status = OK;
     }
-    /* No client with the requested machine name and client number exists in the list */
-    else
+    catch (const LogCabin::Client::Exception& e)
     {
-#ifdef DEBUG
-            printf("%s:%d.%d_%d - New Client: Process Request, Send Response\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
-#endif
-        tempNode = AddClient(request);
-        action = PROCESS_REQUEST_SEND_RESPONSE;
+        printError("Can't write %s to LogCabin: %s", parsed->filePath, e.what());
+        errno = EIO;
     }
 
-    *clientNode = tempNode;
-
-    return action;
+    return status;
 }
 
-/* NOTE: getClientNode MUST have been called previously and returned NULL */
-ClientTableNode_t *AddClient(ClientRequest_t request)
+int
+LogCabinLseek(LockTableNode_t *lockNode, ParsedOperation_t *parsed)
 {
-    ClientTableNode_t *newNode = NULL;
-
-    if((newNode = (ClientTableNode_t *)malloc(sizeof(ClientTableNode_t))) != NULL)
-    {
-        memset(newNode, 0, sizeof(ClientTableNode_t));
+    lockNode->byteOffset = parsed->numBytes;
 
-        /* Initialize new client node */
-        strcpy(newNode->machineName, request.machineName);
-        newNode->clientNumber = request.clientNumber;
-        newNode->requestNumber = request.requestNumber;
-        newNode->clientIncarnation = request.clientIncarnation;
-
-        /* Append node */
-        if(clientTableList != NULL)
-        {
-            ClientTableNode_t *tempNode = clientTableList;
-
-            while(tempNode->next != NULL)
-            {
-                tempNode = tempNode->next;
-            }
-
-            tempNode->next = newNode;
-        }
-        else
-        {
-            clientTableList = newNode;
-        }
-    }
-    else
-    {
-        printErrno("Malloc failed%s", "");
-    }
+    return OK;
+}
 
-    return newNode;
+long
+LogCabinTell(LockTableNode_t *lockNode)
+{
+    return lockNode->byteOffset;
 }
 
-status_t DeleteClient(char *machineName, int clientNumber)
+StorageBackend_t LogCabinStorage =
 {
-    ClientTableNode_t *prevNode = NULL;
-    ClientTableNode_t *tempNode = clientTableList;
-    status_t status = ERROR;
-    bool isNodeFound = false;
+    "LogCabin",
+    LogCabinOpen,
+    LogCabinClose,
+    LogCabinRead,
+    LogCabinWrite,
+    LogCabinLseek,
+    LogCabinTell,
+    NULL,
+    NULL
+};
 
-    /* Search for node with matching machine name and client number */
-    while(tempNode != NULL)
-    {
-        /* Check machineName and clientNumber */
-        if((strcmp(tempNode->machineName, machineName) == 0) &&
-           (tempNode->clientNumber == clientNumber))
-        {
-            isNodeFound = true;
-
-            /* Deleting root node */
-            if(prevNode == NULL)
-            {
-                clientTableList = tempNode->next;
-                free(tempNode);
-                status = OK;
-                break;
-            }
-            /* Deleting other node */
-            else
-            {
-                prevNode->next = tempNode->next;
-                free(tempNode);
-                status = OK;
-                break;
-            }
-        }
-        else
-        {
-            prevNode = tempNode;
-            tempNode = tempNode->next;
-        }
-    }
+/*
+ * Each FT server keeps its own client and lock tables, so only one serves
+ * clients at a time.  The active server holds ACTIVE_LEASE_FILE as
+ * "<ip:port> <heartbeat>" and bumps the heartbeat every ACTIVE_LEASE_MS.
+ * The others redirect clients to it, and take over once the heartbeat has
+ * stood still for ACTIVE_LEASE_MISSES periods.  Every write is conditional
+ * on the value just read, so only one server can take over.
+ *
+ * An active server whose renews fail stops serving one period before anyone
+ * could take over, ACTIVE_LEASE_MISSES - 1 periods after its last renew
+ * started, and answers with a redirect naming no server until a renew
+ * succeeds.  Clients retry and fail over as if it were down.
+ */
+#define ACTIVE_LEASE_FILE   "/sfl_active"
+#define ACTIVE_LEASE_MS     500
+#define ACTIVE_LEASE_MISSES 3
 
-    if(isNodeFound == false)
+class ActiveLease {
+  public:
+    ActiveLease(const Tree& tree, const std::string& advertise)
+        : tree(tree)
+        , advertise(advertise)
+        , last("")
+        , unchanged(0)
+        , mutex()
+        , active(false)
+        , renewed()
     {
-        printInfo("Client %d on machine %s doesnt exist", clientNumber, machineName);
+        /* A call stuck on a LogCabin without quorum would hold up the next period */
+        this->tree.setTimeout(ACTIVE_LEASE_MS * 1000000UL);
     }
 
-    return status;
-}
+    /* One period: renew, take over or follow the holder */
+    void renew() {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        std::string current;
+        std::string holder;
+        uint64_t heartbeat = 0;
+
+        try {
+            try {
+                current = tree.readEx(ACTIVE_LEASE_FILE);
+            } catch (const LogCabin::Client::LookupException& e) {
+                current = "";
+            }
 
-ClientTableNode_t *GetClient(ClientRequest_t request)
-{
-    ClientTableNode_t *tempNode = clientTableList;
-    ClientTableNode_t *node = NULL;
+            std::istringstream fields(current);
+            fields >> holder >> heartbeat;
 
-    /* Search for node with matching machine name and client number */
-    while(tempNode != NULL)
-    {
-        /* Check machineName and clientNumber */
-        if((strcmp(tempNode->machineName, request.machineName) == 0) &&
-           (tempNode->clientNumber == request.clientNumber))
-        {
-            node = tempNode;
-            break;
-        }
-        tempNode = tempNode->next;
-    }
+            unchanged = (current == last) ? unchanged + 1 : 0;
+            last = current;
 
-    return node;
-}
+            if (holder == advertise || current.empty() ||
+                unchanged >= ACTIVE_LEASE_MISSES) {
+                Tree conditional = tree;
+                std::string next = advertise + " " + std::to_string(heartbeat + 1);
 
-status_t ReleaseLock(char *machineName, char *fileName, int clientNumber)
-{
-    LockTableNode_t *prevNode = NULL;
-    LockTableNode_t *tempNode = lockTableList;
-    status_t status = ERROR;
+                conditional.setConditionEx(ACTIVE_LEASE_FILE, current);
+                conditional.writeEx(ACTIVE_LEASE_FILE, next);
+                last = next;
+                unchanged = 0;
 
-    /* Search for node with matching machine name and client number */
-    while(tempNode != NULL)
-    {
-        /* Check machineName and clientNumber */
-        if((strcmp(tempNode->machineName, machineName) == 0) &&
-           (strcmp(tempNode->fileName, fileName) == 0))
-        {
-            if(tempNode->clientNumber == clientNumber)
-            {
-                /* Deleting root node */
-                if(prevNode == NULL)
-                {
-                    lockTableList = tempNode->next;
-                    free(tempNode);
-                    status = OK;
-                    break;
+                std::lock_guard<std::mutex> guard(mutex);
+                renewed = start;
+                if (!active) {
+                    if (holder == advertise)
+                        printInfo("Active lease renewed, serving again%s", "");
+                    else
+                        printInfo("Active server %s, taking over from %s", advertise.c_str(),
+                                  holder.empty() ? "nobody" : holder.c_str());
+                    EngineSetRedirect(NULL);
+                    active = true;
                 }
-                /* Deleting other node */
-                else
-                {
-                    prevNode->next = tempNode->next;
-                    free(tempNode);
-                    status = OK;
-                    break;
+            } else {
+                std::lock_guard<std::mutex> guard(mutex);
+                if (active) {
+                    printInfo("Active server is now %s, redirecting clients", holder.c_str());
+                    active = false;
                 }
+                EngineSetRedirect(holder.c_str());
             }
-            else
-            {
-                printError("Client %d attempting to delete lock for %s:%s which is owned by client %d", clientNumber, tempNode->machineName, tempNode->fileName, clientNumber);
-            }
+        } catch (const LogCabin::Client::ConditionNotMetException& e) {
+            /* Another server renewed or took over first, the next read shows which */
+        } catch (const LogCabin::Client::Exception& e) {
+            printError("Can't renew the active lease: %s", e.what());
         }
-        prevNode = tempNode;
-        tempNode = tempNode->next;
     }
 
-    return status;
-}
-
-
-status_t ReleaseClientLocks(char *machineName, int clientNumber)
-{
-    LockTableNode_t *prevNode = NULL;
-    LockTableNode_t *tempNode = lockTableList;
-    status_t status = ERROR;
+    void run() {
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ACTIVE_LEASE_MS));
+            renew();
+        }
+    }
 
-    /* Search for node with matching machine name and client number */
-    while(tempNode != NULL)
-    {
-        /* Check machineName and clientNumber */
-        if(strcmp(tempNode->machineName, machineName) == 0)
-        {
-            if(tempNode->clientNumber == clientNumber)
-            {
-                /* Deleting root node */
-                if(prevNode == NULL)
-                {
-                    free(tempNode);
-                    lockTableList = lockTableList->next;
-                    tempNode = lockTableList;
-                    status = OK;
-                }
-                /* Deleting other node */
-                else
-                {
-                    prevNode->next = tempNode->next;
-                    free(tempNode);
-                    tempNode = prevNode->next;
-                    status = OK;
-                }
-            }
-            else
-            {
-                //printError("Client %d attempting to delete lock for %s:%s which is owned by client %d", clientNumber, tempNode->machineName, tempNode->fileName, tempNode->clientNumber);
+    /* On its own thread, so a renew that hangs can't keep the server active */
+    void watch() {
+        while (true) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(ACTIVE_LEASE_MS / 5));
+
+            std::lock_guard<std::mutex> guard(mutex);
+            if (active && std::chrono::steady_clock::now() - renewed >=
+                          std::chrono::milliseconds(ACTIVE_LEASE_MS * (ACTIVE_LEASE_MISSES - 1))) {
+                printError("Active lease not renewed for %d ms, not serving until it is",
+                           ACTIVE_LEASE_MS * (ACTIVE_LEASE_MISSES - 1));
+                EngineSetRedirect("");
+                active = false;
             }
         }
-        prevNode = tempNode;
-        tempNode = tempNode->next;
     }
 
-    return status;
-}
+  private:
+    Tree tree;
+    std::string advertise;
+    std::string last;              /* Value read last period */
+    int unchanged;                 /* Periods it has stood still */
+    std::mutex mutex;              /* active, renewed and the redirect, between renew() and watch() */
+    bool active;
+    std::chrono::steady_clock::time_point renewed; /* Start of the last renew that succeeded */
+};
 
+} // anonymous namespace
 
-/* Check if anyone has a lock on a particular machine:file.
- * The caller must handle differentiating between other client's
- * locks, and it's own locks as well as lockType */
-LockTableNode_t *GetLock(char *machineName,char *fileName)
+int
+main(int argc, char** argv)
 {
-    LockTableNode_t *tempNode = lockTableList;
+    try {
+        OptionParser options(argc, argv);
 
-    /* Search for node with matching machine name and client number */
-    while(tempNode != NULL)
-    {
-        /* Check machineName and clientNumber */
-        if((strcmp(tempNode->machineName, machineName) == 0) &&
-           (strcmp(tempNode->fileName, fileName) == 0))
+        LogCabin::Client::Debug::setLogPolicy(
+            LogCabin::Client::Debug::logPolicyFromString(options.logPolicy));
+
+        /* --verbose also enables the per-request debug log */
+        if (options.logPolicy == "VERBOSE")
         {
-            break;
+            LogSetLevel(LOG_DEBUG);
         }
-        tempNode = tempNode->next;
-    }
 
-    return tempNode;
-}
+        /* Format log messages off the request path */
+        LogStart();
 
-LockTableNode_t *AddLock(char *machineName,char *fileName, int clientNumber, LockType_t lockType)
-{
-    LockTableNode_t *newNode = NULL;
+        Cluster cluster(options.cluster);
+        Tree tree = cluster.getTree();
+        EngineOptions_t engineOptions;
 
-    if((newNode = (LockTableNode_t *)malloc(sizeof(LockTableNode_t))) != NULL)
-    {
-        memset(newNode, 0, sizeof(LockTableNode_t));
+        printf("Sean Gatenby\nCSE531 Lab2 Server\ns");
 
-        /* Initialize new lock node */
-        strcpy(newNode->machineName, machineName);
-        strcpy(newNode->fileName, fileName);
-        newNode->clientNumber = clientNumber;
-        newNode->lockStatus = lockType;
+		dumpTree(tree, "/");
 
-        /* Append node */
-        if(lockTableList != NULL)
-        {
-            LockTableNode_t *tempNode = lockTableList;
+		memset(&engineOptions, 0, sizeof(engineOptions));
+		engineOptions.port = options.port;
+		engineOptions.io = options.io;
+		engineOptions.metricsPort = options.metricsPort;
+		engineOptions.traceRate = options.traceSampleRate;
+		engineOptions.dropStale = options.dropStale;
+		engineOptions.capturePath = options.capturePath.empty() ? NULL : options.capturePath.c_str();
+		engineOptions.captureSize = options.captureSize;
+		engineOptions.captureFiles = options.captureFiles;
+		engineOptions.localPath = options.localPath.empty() ? NULL : options.localPath.c_str();
+		engineOptions.clientTtl = options.clientTtl;
+		engineOptions.clientMemory = options.clientMemory;
+
+		/* Settle who is active before serving anyone, then keep the lease on its own tree */
+		if (!options.advertise.empty())
+		{
+			ActiveLease *lease = new ActiveLease(cluster.getTree(), options.advertise);
 
-            while(tempNode->next != NULL)
-            {
-                tempNode = tempNode->next;
-            }
+			lease->renew();
+			std::thread(&ActiveLease::run, lease).detach();
+			std::thread(&ActiveLease::watch, lease).detach();
+		}
 
-            tempNode->next = newNode;
-        }
-        else
-        {
-            lockTableList = newNode;
-        }
-    }
-    else
-    {
-        printErrno("Malloc failed%s", "");
-    }
+		/* Only returns on error */
+		logCabinTree = &tree;
+		EngineRun(&LogCabinStorage, &engineOptions);
 
-    return newNode;
+        exit(1);
+
+    } catch (const LogCabin::Client::Exception& e) {
+        std::cerr << "Exiting due to LogCabin::Client::Exception: "
+                  << e.what()
+                  << std::endl;
+        exit(1);
+    }
 }
@@ -0,0 +1,579 @@
+/*
+ * Microbenchmarks for the server's hot paths.
+ *
+ * The server engine is compiled into this file so the benchmarks call the
+ * real lock table, client table and parsing code, with the memory storage
+ * backend so nothing touches the disk.  Lock and client tables are swept
+ * from 10 entries up to the maximum size, with 100%, 50% and 0% hit ratios
+ * for the lookups.
+ *
+ * The EventLoop benchmarks run the real receive loop with each network I/O
+ * engine on its own thread and keep BENCH_CLIENTS duplicate requests in
+ * flight over loopback, so every request is answered from the stored
+ * response.  A round trip of the whole window is timed and each request is
+ * recorded as its share of it.
+ *
+ * Every operation is timed on its own, less the measured cost of reading the
+ * clock, and the results are printed as one tab separated row per benchmark:
+ *
+ *   bench  entries  hit  ops  mean_ns  p50_ns  p90_ns  p99_ns  p999_ns  max_ns
+ */
+
+#include "SimpleFileLock_Engine.c"
+
+#define BENCH_MACHINE  "client_1"
+#define BENCH_CLIENTS  64          /* Lock owners in the lock table */
+#define BENCH_RELEASES 16          /* ReleaseClientLocks() calls per size */
+#define BENCH_TIMEOUT_MS 1000      /* Give up on a window's missing responses */
+
+typedef struct BenchLoop_t
+{
+    int sockfd;                    /* Server socket */
+    EventEngine_t engine;
+}BenchLoop_t;
+
+typedef struct BenchResult_t
+{
+    Histogram_t histogram;         /* Per-operation latencies (ns) */
+    uint64_t totalTime;            /* Sum of latencies (ns) */
+    unsigned long ops;             /* Operations timed */
+}BenchResult_t;
+
+static uint64_t timerOverhead;
+static BenchResult_t result;
+
+static uint64_t Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Cheapest back to back clock read, taken off every sample */
+static void CalibrateTimer(void)
+{
+    timerOverhead = UINT64_MAX;
+
+    for(int i = 0; i < 10000; i++)
+    {
+        uint64_t start = Now();
+        uint64_t elapsed = Now() - start;
+
+        if(elapsed < timerOverhead)
+        {
+            timerOverhead = elapsed;
+        }
+    }
+}
+
+static void ResetResult(void)
+{
+    memset(&result, 0, sizeof(BenchResult_t));
+}
+
+static void RecordSample(uint64_t start, uint64_t end)
+{
+    uint64_t elapsed = end - start;
+
+    elapsed = (elapsed > timerOverhead) ? elapsed - timerOverhead : 0;
+    HistogramRecord(&result.histogram, elapsed);
+    result.totalTime += elapsed;
+    result.ops++;
+}
+
+static void PrintResult(const char *bench, int entries, double hitRatio)
+{
+    char entriesString[16] = "-";
+    char hitString[16] = "-";
+
+    if(entries >= 0)
+    {
+        snprintf(entriesString, sizeof(entriesString), "%d", entries);
+    }
+    if(hitRatio >= 0)
+    {
+        snprintf(hitString, sizeof(hitString), "%.2f", hitRatio);
+    }
+
+    printf("%s\t%s\t%s\t%lu\t%.1f\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+           bench, entriesString, hitString, result.ops,
+           (result.ops != 0) ? (double)result.totalTime / result.ops : 0.0,
+           (unsigned long long)HistogramQuantile(&result.histogram, 0.5),
+           (unsigned long long)HistogramQuantile(&result.histogram, 0.9),
+           (unsigned long long)HistogramQuantile(&result.histogram, 0.99),
+           (unsigned long long)HistogramQuantile(&result.histogram, 0.999),
+           (unsigned long long)HistogramQuantile(&result.histogram, 1.0));
+    fflush(stdout);
+}
+
+static void BuildFileName(char *fileName, size_t size, int index, bool hit)
+{
+    snprintf(fileName, size, "%s_%d.txt", hit ? "file" : "missing", index);
+}
+
+static void BuildRequest(ClientRequest_t *request, int clientNumber, int requestNumber, const char *operation)
+{
+    memset(request, 0, sizeof(ClientRequest_t));
+    strcpy(request->machineName, BENCH_MACHINE);
+    request->clientNumber = clientNumber;
+    request->requestNumber = requestNumber;
+    strncpy(request->operation, operation, sizeof(request->operation) - 1);
+}
+
+static void BenchAddLock(int entries)
+{
+    char fileName[64];
+
+    ResetResult();
+
+    for(int i = 0; i < entries; i++)
+    {
+        uint64_t start = 0;
+
+        BuildFileName(fileName, sizeof(fileName), i, true);
+        start = Now();
+        AddLock(BENCH_MACHINE, fileName, i % BENCH_CLIENTS, READ_LOCK);
+        RecordSample(start, Now());
+    }
+
+    PrintResult("AddLock", entries, -1);
+}
+
+static void BenchGetLock(int entries, double hitRatio, int numOps, unsigned int *seed)
+{
+    char fileName[64];
+
+    ResetResult();
+
+    for(int i = 0; i < numOps; i++)
+    {
+        bool hit = (rand_r(seed) < hitRatio * ((double)RAND_MAX + 1));
+        uint64_t start = 0;
+
+        BuildFileName(fileName, sizeof(fileName), rand_r(seed) % entries, hit);
+        EpochEnter();
+        start = Now();
+        GetLock(BENCH_MACHINE, fileName);
+        RecordSample(start, Now());
+        EpochExit();
+    }
+
+    PrintResult("GetLock", entries, hitRatio);
+}
+
+/* Every release scans the whole table, so re-add the locks afterwards */
+static void BenchReleaseClientLocks(int entries)
+{
+    char fileName[64];
+
+    ResetResult();
+
+    for(int client = 0; client < BENCH_RELEASES; client++)
+    {
+        uint64_t start = Now();
+
+        ReleaseClientLocks(BENCH_MACHINE, client);
+        RecordSample(start, Now());
+
+        for(int i = client; i < entries; i += BENCH_CLIENTS)
+        {
+            BuildFileName(fileName, sizeof(fileName), i, true);
+            AddLock(BENCH_MACHINE, fileName, client, READ_LOCK);
+        }
+    }
+
+    PrintResult("ReleaseClientLocks", entries, -1);
+}
+
+static void FillClientTable(int entries)
+{
+    ClientRequest_t request;
+
+    for(int i = 0; i < entries; i++)
+    {
+        BuildRequest(&request, i, 1, "");
+        AddClient(request);
+    }
+}
+
+static void BenchGetClient(int entries, double hitRatio, int numOps, unsigned int *seed)
+{
+    ClientRequest_t request;
+
+    ResetResult();
+    BuildRequest(&request, 0, 1, "");
+
+    for(int i = 0; i < numOps; i++)
+    {
+        bool hit = (rand_r(seed) < hitRatio * ((double)RAND_MAX + 1));
+        uint64_t start = 0;
+
+        /* Client numbers past 'entries' are never in the table */
+        request.clientNumber = (rand_r(seed) % entries) + (hit ? 0 : entries);
+        EpochEnter();
+        start = Now();
+        GetClient(request);
+        RecordSample(start, Now());
+        EpochExit();
+    }
+
+    PrintResult("GetClient", entries, hitRatio);
+}
+
+/* The compact request's lookup, misses are ids of an older generation */
+static void BenchSessionLookup(int entries, double hitRatio, int numOps, unsigned int *seed)
+{
+    uint64_t *sessionIds = NULL;
+    ClientRequest_t request;
+
+    if((sessionIds = malloc(entries * sizeof(uint64_t))) == NULL)
+    {
+        return;
+    }
+
+    BuildRequest(&request, 0, 1, "");
+    EpochEnter();
+    for(int i = 0; i < entries; i++)
+    {
+        request.clientNumber = i;
+        sessionIds[i] = SessionAssign(GetClient(request));
+    }
+    EpochExit();
+
+    ResetResult();
+    for(int i = 0; i < numOps; i++)
+    {
+        bool hit = (rand_r(seed) < hitRatio * ((double)RAND_MAX + 1));
+        uint64_t sessionId = sessionIds[rand_r(seed) % entries] ^ (hit ? 0 : (2ULL << 32));
+        uint64_t start = Now();
+
+        SessionLookup(sessionId);
+        RecordSample(start, Now());
+    }
+
+    PrintResult("SessionLookup", entries, hitRatio);
+
+    /* The table is about to go */
+    free(sessionIds);
+    free(sessionSlab);
+    sessionSlab = NULL;
+    sessionSlabSize = sessionSlabUsed = 0;
+    sessionFree = UINT32_MAX;
+}
+
+/* Hits are duplicates (SEND_STORED_RESPONSE), misses add a new client */
+static void BenchValidateClient(int entries, double hitRatio, int numOps, unsigned int *seed)
+{
+    ClientRequest_t request;
+    ClientTableNode_t *clientNode = NULL;
+
+    ResetResult();
+    BuildRequest(&request, 0, 1, "");
+
+    for(int i = 0; i < numOps; i++)
+    {
+        bool hit = (rand_r(seed) < hitRatio * ((double)RAND_MAX + 1));
+        uint64_t start = 0;
+
+        request.clientNumber = (rand_r(seed) % entries) + (hit ? 0 : entries);
+        clientNode = NULL;
+        EpochEnter();
+        start = Now();
+        ValidateClient(request, &clientNode);
+        RecordSample(start, Now());
+        if(hit == false)
+        {
+            DeleteClient(request.machineName, request.clientNumber);
+        }
+        EpochExit();
+    }
+
+    PrintResult("ValidateClient", entries, hitRatio);
+}
+
+static void BenchParseOperation(int numOps)
+{
+    static const char *operations[] = {
+        "open BestSpaceOpera.txt readwrite",
+        "read BestSpaceOpera.txt 100",
+        "write BestSpaceOpera.txt \"Space: the final frontier.\"",
+        "lseek BestSpaceOpera.txt 10",
+        "close BestSpaceOpera.txt"
+    };
+    ClientRequest_t request;
+    ParsedOperation_t parsed;
+    char bench[64];
+
+    for(size_t op = 0; op < sizeof(operations) / sizeof(operations[0]); op++)
+    {
+        ResetResult();
+
+        for(int i = 0; i < numOps; i++)
+        {
+            uint64_t start = 0;
+
+            /* Parsing tokenizes in place */
+            BuildRequest(&request, 0, 1, operations[op]);
+            start = Now();
+            ParseOperation(&request, &parsed);
+            RecordSample(start, Now());
+        }
+
+        snprintf(bench, sizeof(bench), "ParseOperation/%.*s", (int)strcspn(operations[op], " "), operations[op]);
+        PrintResult(bench, -1, -1);
+    }
+}
+
+/*
+ * Whole HandleRequest() paths: a duplicate answered from the stored response,
+ * a new client whose lseek finds no lock, which parses, misses the lock table
+ * and formats an error response, and a new client opening a file, which adds
+ * a lock and opens the file in memory storage.  Responses go to a local
+ * socket nobody reads.
+ */
+static void BenchHandleRequest(int numOps)
+{
+    ServerStruct_t serverStruct;
+    ClientRequest_t request;
+    socklen_t addrLen = sizeof(serverStruct.clientAddr);
+    int sinkfd = -1;
+
+    memset(&serverStruct, 0, sizeof(ServerStruct_t));
+    memset(&serverStruct.clientAddr, 0, sizeof(serverStruct.clientAddr));
+    serverStruct.clientAddr.sin_family = AF_INET;
+    serverStruct.clientAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if(((serverStruct.sockfd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) ||
+       ((sinkfd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) ||
+       (bind(sinkfd, (struct sockaddr *) &serverStruct.clientAddr, sizeof(serverStruct.clientAddr)) < 0) ||
+       (getsockname(sinkfd, (struct sockaddr *) &serverStruct.clientAddr, &addrLen) < 0))
+    {
+        printErrno("Can't create benchmark sockets%s", "");
+        return;
+    }
+
+    /* Stored response */
+    ResetResult();
+    BuildRequest(&request, 0, 1, "lseek BestSpaceOpera.txt 10");
+    EpochEnter();
+    HandleRequest(serverStruct, request);
+    EpochExit();
+    for(int i = 0; i < numOps; i++)
+    {
+        uint64_t start = 0;
+
+        EpochEnter();
+        start = Now();
+        HandleRequest(serverStruct, request);
+        RecordSample(start, Now());
+        EpochExit();
+    }
+    PrintResult("HandleRequest/stored_response", -1, -1);
+    DeleteClient(request.machineName, request.clientNumber);
+
+    /* Parse, lock miss and error response */
+    ResetResult();
+    for(int i = 0; i < numOps; i++)
+    {
+        uint64_t start = 0;
+
+        BuildRequest(&request, i, 1, "lseek BestSpaceOpera.txt 10");
+        EpochEnter();
+        start = Now();
+        HandleRequest(serverStruct, request);
+        RecordSample(start, Now());
+        DeleteClient(request.machineName, request.clientNumber);
+        EpochExit();
+    }
+    PrintResult("HandleRequest/lock_miss", -1, -1);
+
+    /* Parse, new lock and storage open */
+    ResetResult();
+    for(int i = 0; i < numOps; i++)
+    {
+        char fileName[32];
+        char operation[64];
+        uint64_t start = 0;
+
+        snprintf(fileName, sizeof(fileName), "file_%d", i % BENCH_CLIENTS);
+        snprintf(operation, sizeof(operation), "open %s write", fileName);
+        BuildRequest(&request, i, 1, operation);
+        EpochEnter();
+        start = Now();
+        HandleRequest(serverStruct, request);
+        RecordSample(start, Now());
+        ReleaseLock(request.machineName, fileName, request.clientNumber);
+        DeleteClient(request.machineName, request.clientNumber);
+        EpochExit();
+    }
+    PrintResult("HandleRequest/open", -1, -1);
+
+    close(sinkfd);
+    close(serverStruct.sockfd);
+}
+
+static void *BenchLoopThread(void *arg)
+{
+    BenchLoop_t *benchLoop = arg;
+
+    EventRun(benchLoop->sockfd, benchLoop->engine, sizeof(ClientRequest_t), ReceiveRequest);
+
+    return NULL;
+}
+
+/* Left running when done, the process exits at the end */
+static void BenchEventLoop(EventEngine_t engine, int numOps)
+{
+    static BenchLoop_t benchLoops[EVENT_URING + 1];
+    BenchLoop_t *benchLoop = &benchLoops[engine];
+    ClientRequest_t requests[BENCH_CLIENTS];
+    ServerResponse_t response;
+    struct sockaddr_in serverAddr;
+    socklen_t addrLen = sizeof(serverAddr);
+    struct timeval timeout = {BENCH_TIMEOUT_MS / 1000, (BENCH_TIMEOUT_MS % 1000) * 1000};
+    pthread_t thread;
+    int clientfd = -1;
+    char bench[32];
+
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    benchLoop->engine = engine;
+
+    if(((benchLoop->sockfd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) ||
+       (bind(benchLoop->sockfd, (struct sockaddr *) &serverAddr, sizeof(serverAddr)) < 0) ||
+       (getsockname(benchLoop->sockfd, (struct sockaddr *) &serverAddr, &addrLen) < 0) ||
+       ((clientfd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) ||
+       (setsockopt(clientfd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0) ||
+       (connect(clientfd, (struct sockaddr *) &serverAddr, sizeof(serverAddr)) < 0) ||
+       (pthread_create(&thread, NULL, BenchLoopThread, benchLoop) != 0))
+    {
+        printErrno("Can't start %s event loop", EventEngineNames[engine]);
+        return;
+    }
+
+    /* First request of each client is processed, the rest are duplicates */
+    for(int i = 0; i < BENCH_CLIENTS; i++)
+    {
+        BuildRequest(&requests[i], i, 1, "lseek BestSpaceOpera.txt 10");
+        if((send(clientfd, &requests[i], sizeof(ClientRequest_t), 0) < 0) ||
+           (recv(clientfd, &response, sizeof(response), 0) != sizeof(response)))
+        {
+            printErrno("No response from %s event loop", EventEngineNames[engine]);
+            close(clientfd);
+            return;
+        }
+    }
+
+    ResetResult();
+    for(int round = 0; round < numOps / BENCH_CLIENTS; round++)
+    {
+        uint64_t start = Now();
+        uint64_t elapsed = 0;
+        int received = 0;
+
+        for(int i = 0; i < BENCH_CLIENTS; i++)
+        {
+            send(clientfd, &requests[i], sizeof(ClientRequest_t), 0);
+        }
+        while((received < BENCH_CLIENTS) && (recv(clientfd, &response, sizeof(response), 0) == sizeof(response)))
+        {
+            received++;
+        }
+        elapsed = Now() - start;
+
+        for(int i = 0; i < received; i++)
+        {
+            HistogramRecord(&result.histogram, elapsed / BENCH_CLIENTS);
+        }
+        result.totalTime += elapsed / BENCH_CLIENTS * received;
+        result.ops += received;
+    }
+
+    snprintf(bench, sizeof(bench), "EventLoop/%s", EventEngineNames[engine]);
+    PrintResult(bench, BENCH_CLIENTS, -1);
+
+    for(int i = 0; i < BENCH_CLIENTS; i++)
+    {
+        DeleteClient(requests[i].machineName, requests[i].clientNumber);
+    }
+    close(clientfd);
+}
+
+int main(int argc, char *argv[])
+{
+    static const double hitRatios[] = {1.0, 0.5, 0.0};
+    unsigned int seed = 1;
+    int maxEntries = 1000000;
+    int numOps = 200000;
+
+    if (argc > 3)
+    {
+        printError("Usage: %s [max table entries] [ops per benchmark]", argv[0]);
+        return ERROR;
+    }
+    if (argc > 1)
+    {
+        maxEntries = strtol(argv[1], NULL, 10);
+    }
+    if (argc > 2)
+    {
+        numOps = strtol(argv[2], NULL, 10);
+    }
+
+    /* The miss paths log errors by design, keep them out of the timings */
+    logLevel = LOG_ERROR - 1;
+    storage = &MemoryStorage;
+    CalibrateTimer();
+
+    printf("bench\tentries\thit\tops\tmean_ns\tp50_ns\tp90_ns\tp99_ns\tp999_ns\tmax_ns\n");
+
+    for(int entries = 10; entries <= maxEntries; entries *= 10)
+    {
+        clientTable = MapCreate(CLIENT_TABLE_BUCKETS, free);
+        lockTable = MapCreate(LOCK_TABLE_BUCKETS, free);
+        if((clientTable == NULL) || (lockTable == NULL))
+        {
+            printError("Can't create lock and client tables%s", "");
+            return ERROR;
+        }
+
+        BenchAddLock(entries);
+        for(size_t i = 0; i < sizeof(hitRatios) / sizeof(double); i++)
+        {
+            BenchGetLock(entries, hitRatios[i], numOps, &seed);
+        }
+        BenchReleaseClientLocks(entries);
+
+        FillClientTable(entries);
+        for(size_t i = 0; i < sizeof(hitRatios) / sizeof(double); i++)
+        {
+            BenchGetClient(entries, hitRatios[i], numOps, &seed);
+        }
+        for(size_t i = 0; i < sizeof(hitRatios) / sizeof(double); i++)
+        {
+            BenchValidateClient(entries, hitRatios[i], numOps, &seed);
+        }
+        for(size_t i = 0; i < sizeof(hitRatios) / sizeof(double); i++)
+        {
+            BenchSessionLookup(entries, hitRatios[i], numOps, &seed);
+        }
+
+        MapDestroy(clientTable);
+        MapDestroy(lockTable);
+        clientLruHead = clientLruTail = NULL;
+    }
+
+    clientTable = MapCreate(CLIENT_TABLE_BUCKETS, free);
+    lockTable = MapCreate(LOCK_TABLE_BUCKETS, free);
+    BenchParseOperation(numOps);
+    BenchHandleRequest(numOps);
+    for(int engine = EVENT_BLOCKING; engine <= EVENT_URING; engine++)
+    {
+        BenchEventLoop(engine, numOps);
+    }
+
+    return OK;
+}
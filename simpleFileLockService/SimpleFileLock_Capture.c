@@ -0,0 +1,226 @@
+#include "SimpleFileLock_Capture.h"
+#include "defns.h"
+
+#include <stdlib.h>     /* for malloc() */
+#include <limits.h>     /* for PATH_MAX */
+#include <string.h>     /* for strnlen() */
+#include <unistd.h>     /* for unlink() */
+#include <time.h>       /* for clock_gettime() and nanosleep() */
+#include <pthread.h>    /* for pthread_create() */
+
+#define CAPTURE_BUFFER_BYTES   (1 << 20)
+
+static int captureEnabled;
+static FILE *captureFile;
+static char *capturePath;
+static char *captureBuffer;
+static uint64_t captureMaxFileBytes;
+static uint64_t captureFileBytes;
+static pthread_mutex_t captureMutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t flushThread;
+static int captureMaxFiles;
+static int captureSequence;
+
+static uint64_t RealTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Close the current file (if any) and start the next one */
+/* Caller holds captureMutex */
+static int CaptureRotate(void)
+{
+    char name[PATH_MAX];
+
+    if(captureFile != NULL)
+    {
+        if(fclose(captureFile) != 0)
+        {
+            printErrno("Error writing capture file %d", captureSequence - 1);
+        }
+        captureFile = NULL;
+    }
+
+    if((captureMaxFiles > 0) && (captureSequence >= captureMaxFiles))
+    {
+        snprintf(name, sizeof(name), "%s.%06d", capturePath, captureSequence - captureMaxFiles);
+        unlink(name);
+    }
+
+    snprintf(name, sizeof(name), "%s.%06d", capturePath, captureSequence++);
+    if((captureFile = fopen(name, "w")) == NULL)
+    {
+        printErrno("Can't open %s for writing", name);
+        return -1;
+    }
+    setvbuf(captureFile, captureBuffer, _IOFBF, CAPTURE_BUFFER_BYTES);
+
+    if(fwrite(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC), 1, captureFile) != 1)
+    {
+        printErrno("Error writing to %s", name);
+    }
+    captureFileBytes = sizeof(CAPTURE_MAGIC);
+    printInfo("Capturing requests to %s", name);
+
+    return 0;
+}
+
+/* An idle server still gets its last requests onto disk */
+static void *FlushThread(void *arg)
+{
+    struct timespec idle = {CAPTURE_FLUSH_MS / 1000, (CAPTURE_FLUSH_MS % 1000) * 1000000L};
+
+    (void)arg;
+
+    for(;;) /* Run forever */
+    {
+        nanosleep(&idle, NULL);
+
+        pthread_mutex_lock(&captureMutex);
+        if(captureFile != NULL)
+        {
+            fflush(captureFile);
+        }
+        pthread_mutex_unlock(&captureMutex);
+    }
+
+    return NULL;
+}
+
+int CaptureStart(const char *path, uint64_t maxFileBytes, int maxFiles)
+{
+    if(((capturePath = strdup(path)) == NULL) || ((captureBuffer = malloc(CAPTURE_BUFFER_BYTES)) == NULL))
+    {
+        printErrno("Malloc failed%s", "");
+        return -1;
+    }
+
+    captureMaxFileBytes = maxFileBytes;
+    captureMaxFiles = maxFiles;
+
+    if(CaptureRotate() != 0)
+    {
+        return -1;
+    }
+    if(pthread_create(&flushThread, NULL, FlushThread, NULL) != 0)
+    {
+        printErrno("Can't start capture flush thread%s", "");
+        return -1;
+    }
+    captureEnabled = 1;
+
+    return 0;
+}
+
+int CaptureEnabled(void)
+{
+    return captureEnabled;
+}
+
+static void CaptureWrite(CaptureHeader_t *header, const char *machineName, const char *text)
+{
+    pthread_mutex_lock(&captureMutex);
+    if(captureFile == NULL)
+    {
+        /* A failed rotation stops the capture */
+        pthread_mutex_unlock(&captureMutex);
+        return;
+    }
+
+    if(fwrite(header, sizeof(CaptureHeader_t), 1, captureFile) != 1 ||
+       fwrite(machineName, 1, header->machineNameLength, captureFile) != header->machineNameLength ||
+       fwrite(text, 1, header->textLength, captureFile) != header->textLength)
+    {
+        printErrno("Error writing capture record%s", "");
+    }
+    captureFileBytes += sizeof(CaptureHeader_t) + header->machineNameLength + header->textLength;
+
+    if((captureMaxFileBytes != 0) && (captureFileBytes >= captureMaxFileBytes))
+    {
+        CaptureRotate();
+    }
+    pthread_mutex_unlock(&captureMutex);
+}
+
+static void FillHeader(CaptureHeader_t *header, int type, const ClientRequest_t *request, const struct sockaddr_in *addr)
+{
+    memset(header, 0, sizeof(CaptureHeader_t));
+    header->type = type;
+    header->machineNameLength = strnlen(request->machineName, sizeof(request->machineName));
+    header->address = addr->sin_addr.s_addr;
+    header->port = addr->sin_port;
+    header->clientNumber = request->clientNumber;
+    header->clientIncarnation = request->clientIncarnation;
+    header->requestNumber = request->requestNumber;
+}
+
+void CaptureRequest(const ClientRequest_t *request, const struct sockaddr_in *fromAddr, uint64_t queueDelay)
+{
+    CaptureHeader_t header;
+
+    if(captureEnabled == 0)
+    {
+        return;
+    }
+
+    FillHeader(&header, CAPTURE_REQUEST, request, fromAddr);
+    header.textLength = strnlen(request->operation, sizeof(request->operation));
+    header.timestamp = RealTime() - queueDelay;
+
+    CaptureWrite(&header, request->machineName, request->operation);
+}
+
+void CaptureResponse(const ClientRequest_t *request, const ServerResponse_t *response, const struct sockaddr_in *toAddr)
+{
+    CaptureHeader_t header;
+
+    if(captureEnabled == 0)
+    {
+        return;
+    }
+
+    FillHeader(&header, CAPTURE_RESPONSE, request, toAddr);
+    header.textLength = strnlen(response->returnString, sizeof(response->returnString));
+    header.returnValue = response->returnValue;
+    header.timestamp = RealTime();
+
+    CaptureWrite(&header, request->machineName, response->returnString);
+}
+
+int CaptureOpen(FILE *file)
+{
+    char magic[sizeof(CAPTURE_MAGIC)];
+
+    if((fread(magic, sizeof(magic), 1, file) != 1) || (memcmp(magic, CAPTURE_MAGIC, sizeof(magic)) != 0))
+    {
+        return -1;
+    }
+
+    return 1;
+}
+
+int CaptureRead(FILE *file, CaptureRecord_t *record)
+{
+    CaptureHeader_t *header = &record->header;
+
+    if(fread(header, sizeof(CaptureHeader_t), 1, file) != 1)
+    {
+        return feof(file) ? 0 : -1;
+    }
+
+    if(((header->type != CAPTURE_REQUEST) && (header->type != CAPTURE_RESPONSE)) ||
+       (header->machineNameLength > CAPTURE_MAX_NAME) || (header->textLength > CAPTURE_MAX_TEXT) ||
+       (fread(record->machineName, 1, header->machineNameLength, file) != header->machineNameLength) ||
+       (fread(record->text, 1, header->textLength, file) != header->textLength))
+    {
+        return -1;
+    }
+    record->machineName[header->machineNameLength] = '\0';
+    record->text[header->textLength] = '\0';
+
+    return 1;
+}
@@ -0,0 +1,84 @@
+#ifndef SIMPLEFILELOCK_CAPTURE_H
+#define SIMPLEFILELOCK_CAPTURE_H
+
+#include <stdio.h>      /* for FILE */
+#include <stdint.h>     /* for uint64_t */
+#include <arpa/inet.h>  /* for sockaddr_in */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Request capture.
+ *
+ * With capture on, the server appends every datagram it receives, and every
+ * response it sends, to <path>.NNNNNN.  A file is closed and the next one
+ * started once it passes the size limit, and only the newest 'maxFiles' are
+ * kept.  Writes are buffered and flushed at least every CAPTURE_FLUSH_MS, so
+ * a killed server loses at most that much.
+ *
+ * A capture file is CAPTURE_MAGIC followed by records: a CaptureHeader_t, then
+ * machineNameLength bytes of machine name and textLength bytes of operation
+ * (requests) or returnString (responses), neither NUL terminated.  Integers
+ * are host byte order, addresses network byte order.  A request record is
+ * stamped with its kernel arrival time, a response record with its send time.
+ *
+ * SimpleFileLock_Replay re-sends a capture and compares the responses.
+ */
+
+#define CAPTURE_MAGIC          "SFLCAP1"   /* 8 bytes including the NUL */
+#define CAPTURE_FLUSH_MS       1000
+#define CAPTURE_MAX_NAME       100         /* ClientRequest_t.machineName */
+#define CAPTURE_MAX_TEXT       1024        /* ServerResponse_t.returnString */
+
+#define CAPTURE_DEFAULT_MB     64          /* Per file */
+#define CAPTURE_DEFAULT_FILES  8
+
+/* getopt_long() values for the servers' long-only capture options */
+#define CAPTURE_OPTION_SIZE    256
+#define CAPTURE_OPTION_FILES   257
+
+#define CAPTURE_REQUEST        1
+#define CAPTURE_RESPONSE       2
+
+struct ClientRequest_t;
+struct ServerResponse_t;
+
+typedef struct __attribute__((packed)) CaptureHeader_t
+{
+    uint8_t type;                  /* CAPTURE_REQUEST or CAPTURE_RESPONSE */
+    uint8_t machineNameLength;
+    uint16_t textLength;
+    uint32_t address;              /* Client address */
+    uint16_t port;                 /* Client port */
+    uint16_t reserved;
+    int32_t clientNumber;
+    int32_t clientIncarnation;
+    int32_t requestNumber;
+    int32_t returnValue;           /* Responses only */
+    uint64_t timestamp;            /* CLOCK_REALTIME ns */
+}CaptureHeader_t;
+
+typedef struct CaptureRecord_t
+{
+    CaptureHeader_t header;
+    char machineName[CAPTURE_MAX_NAME + 1];
+    char text[CAPTURE_MAX_TEXT + 1];
+}CaptureRecord_t;
+
+int CaptureStart(const char *path, uint64_t maxFileBytes, int maxFiles);
+int CaptureEnabled(void);
+void CaptureRequest(const struct ClientRequest_t *request, const struct sockaddr_in *fromAddr, uint64_t queueDelay);
+void CaptureResponse(const struct ClientRequest_t *request, const struct ServerResponse_t *response, const struct sockaddr_in *toAddr);
+
+/* Reading: CaptureOpen() checks the magic (1 if good, else -1); CaptureRead()
+ * returns 1 for a record, 0 at end of file and -1 for a corrupt or cut short record */
+int CaptureOpen(FILE *file);
+int CaptureRead(FILE *file, CaptureRecord_t *record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPLEFILELOCK_CAPTURE_H */
@@ -0,0 +1,1912 @@
+#include "SimpleFileLock_Engine.h"
+#include "SimpleFileLock_Map.h"
+#include "SimpleFileLock_Metrics.h"
+#include "SimpleFileLock_Trace.h"
+#include "SimpleFileLock_Socket.h"
+#include "SimpleFileLock_Capture.h"
+#include "SimpleFileLock_Event.h"
+
+#include <stdio.h>      /* for printf() and fprintf() */
+#include <sys/socket.h> /* for socket() and bind() */
+#include <arpa/inet.h>  /* for sockaddr_in and inet_ntoa() */
+#include <stdlib.h>     /* for atoi() and exit() */
+#include <string.h>     /* for memset() and strtok() */
+#include <unistd.h>     /* for close() */
+#include <time.h>       /* for time() */
+#include <pthread.h>    /* for pthread_mutex_lock() */
+#include <stddef.h>     /* for offsetof() */
+#include <sys/uio.h>    /* for struct iovec */
+
+/* A successful read is answered with READ_PREFIX <data> READ_SUFFIX <path> */
+#define READ_PREFIX "Read '"
+#define READ_SUFFIX "' from "
+
+/* Reads longer than this are sent from the backend's buffer rather than copied */
+#define RESPONSE_INLINE_MAX 128
+
+/* Globals */
+static ConcurrentMap_t *clientTable;
+static ConcurrentMap_t *lockTable;
+static StorageBackend_t *storage;
+static int commFailureCounter;
+static uint64_t staleDropCounter;
+static int responseSocket = -1;
+static int localSocket = -1;
+static int dropStale;
+static uint64_t referencedResponses;
+static uint64_t delegations;
+static uint64_t delegationRecalls;
+static uint64_t delegatedWrites;
+
+/* Where requests are sent instead of being served, while redirecting */
+static pthread_mutex_t redirectMutex = PTHREAD_MUTEX_INITIALIZER;
+static char redirectTarget[64];
+static int redirecting;
+static uint64_t redirectCounter;
+
+/* Sessions by id: the low 32 bits index sessionSlab, the high 32 are the
+ * slot's generation, so an id dies with its client entry.  Generations
+ * start at random, so another server or a restart doesn't know the id. */
+#define SESSION_SLAB_MIN 1024
+
+typedef struct SessionSlot_t
+{
+    uint32_t generation;
+    uint32_t nextFree;             /* Free list, when clientNode is NULL */
+    ClientTableNode_t *clientNode;
+}SessionSlot_t;
+
+static SessionSlot_t *sessionSlab;
+static uint32_t sessionSlabSize;
+static uint32_t sessionSlabUsed;   /* Slots ever handed out */
+static uint32_t sessionFree = UINT32_MAX;
+static uint64_t sessionsOpened;
+
+/*
+ * Client entries are kept in a list by last request.  Those without locks
+ * are forgotten once idle for clientTtl or, least recently active first,
+ * while the table is over clientMax entries.  Each request looks at up to
+ * EVICT_BATCH from the idle end, so eviction keeps up with arrivals without
+ * a sweep.  A forgotten client is new to the server: its session id is
+ * unknown and its next request is processed as a first request, so the cap
+ * spares clients active in the last EVICT_MIN_IDLE seconds, whose
+ * retransmits could still arrive, and the table grows past it instead.
+ */
+#define EVICT_BATCH    16
+#define EVICT_MIN_IDLE ENGINE_CLIENT_TTL_MIN
+
+static ClientTableNode_t *clientLruHead;
+static ClientTableNode_t *clientLruTail;
+static time_t clientTtl;
+static size_t clientMax;
+static uint64_t idleEvictions;
+static uint64_t memoryEvictions;
+
+/* Requests from the UDP and local sockets are handled one at a time */
+static pthread_mutex_t requestMutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* Responses held for a group commit, oldest first */
+typedef struct DeferredResponse_t
+{
+    uint64_t commitTicket;         /* Commit that releases the response */
+    ClientRequest_t request;       /* Request answered, for capture */
+    struct sockaddr_in clientAddr; /* Where to send the response */
+    ServerResponse_t response;     /* Copy, the client node may go away first */
+    struct DeferredResponse_t *next;
+}DeferredResponse_t;
+
+static pthread_mutex_t deferredMutex = PTHREAD_MUTEX_INITIALIZER;
+static DeferredResponse_t *deferredHead;
+static DeferredResponse_t *deferredTail;
+static uint64_t committedTicket;
+
+static status_t DeferResponse(int, ClientTableNode_t *, ClientRequest_t *, struct sockaddr_in *);
+static status_t SendResponse(int, ClientTableNode_t *, ClientRequest_t *, struct sockaddr_in *);
+static void MaterializeResponse(ClientTableNode_t *, ServerResponse_t *);
+static void ReceiveRequest(int, void *, ssize_t, struct sockaddr_in *, uint64_t);
+static void ReceiveShared(int, void *, ssize_t, struct sockaddr_in *, uint64_t);
+static void *LocalThread(void *);
+static int SocketFor(struct sockaddr_in *);
+static void RecallDelegation(int, LockTableNode_t *);
+static bool RedirectRequest(int, struct sockaddr_in *);
+static void SendNotice(int, struct sockaddr_in *, int, const char *);
+static void OpenSession(ServerStruct_t *, ClientRequest_t *);
+static uint64_t SessionAssign(ClientTableNode_t *);
+static void SessionRelease(ClientTableNode_t *);
+static ClientTableNode_t *SessionLookup(uint64_t);
+static void ClientTouch(ClientTableNode_t *);
+static void ClientUnlink(ClientTableNode_t *);
+static void EvictClients(void);
+static time_t ClientClock(void);
+static status_t ApplyDelegatedWrites(ServerStruct_t *, LockTableNode_t *, ParsedOperation_t *, ClientTableNode_t *);
+static int StorageSeek(LockTableNode_t *, ParsedOperation_t *, long);
+static status_t SeekToOffset(LockTableNode_t *, ParsedOperation_t *, ClientTableNode_t *, long *);
+static status_t ChangeLock(LockTableNode_t *, ParsedOperation_t *);
+
+status_t EngineRun(StorageBackend_t *backend, EngineOptions_t *options)
+{
+	ServerStruct_t serverStruct;
+	EventReceived_t received = ReceiveRequest;
+	pthread_t localThread;
+
+	/* Initialize structures */
+	storage = backend;
+	dropStale = options->dropStale;
+	clientTtl = options->clientTtl;
+	clientMax = ((size_t)options->clientMemory << 20) / sizeof(ClientTableNode_t);
+	clientTable = MapCreate(CLIENT_TABLE_BUCKETS, free);
+	lockTable = MapCreate(LOCK_TABLE_BUCKETS, free);
+    memset(&serverStruct, 0, sizeof(ServerStruct_t));
+    commFailureCounter = 0;
+
+    /* Initialize random number generator */
+    srand(time(NULL));
+
+	if ((clientTable == NULL) || (lockTable == NULL))
+	{
+		printError("Can't create lock and client tables%s", "");
+		return ERROR;
+	}
+
+    /* Serve metrics on a separate local port */
+    if(options->metricsPort != 0)
+    {
+        MetricsRegisterGauge("sfl_lock_table_entries", "Locks currently held", NULL, LockTableSize);
+        MetricsRegisterGauge("sfl_client_table_entries", "Clients currently known", NULL, ClientTableSize);
+        MetricsRegisterGauge("sfl_client_table_bytes", "Memory held by client entries", NULL, ClientTableBytes);
+        MetricsRegisterCounter("sfl_client_evictions_total", "Clients forgotten", "reason=\"idle\"", &idleEvictions);
+        MetricsRegisterCounter("sfl_client_evictions_total", "Clients forgotten", "reason=\"memory\"", &memoryEvictions);
+        MetricsRegisterIntCounter("sfl_comm_failures_total", "Simulated communication failures", NULL, &commFailureCounter);
+        MetricsRegisterCounter("sfl_referenced_responses_total", "Read responses sent from the storage backend's buffer without a copy", NULL, &referencedResponses);
+        MetricsRegisterCounter("sfl_delegations_total", "Write locks granted with a delegation", NULL, &delegations);
+        MetricsRegisterCounter("sfl_delegation_recalls_total", "Recalls sent to delegation holders", NULL, &delegationRecalls);
+        MetricsRegisterCounter("sfl_delegated_writes_total", "Writes applied from delegation flushes", NULL, &delegatedWrites);
+        MetricsRegisterCounter("sfl_sessions_opened_total", "Session ids handed out", NULL, &sessionsOpened);
+        MetricsRegisterCounter("sfl_redirects_total", "Requests answered with a redirect to the active server", NULL, &redirectCounter);
+        MetricsRegisterCounter("sfl_stale_drops_total", "Requests dropped after waiting longer than the client retransmit timeout", NULL, &staleDropCounter);
+        EventRegisterMetrics();
+
+        if(MetricsStart(options->metricsPort) != 0)
+        {
+            return ERROR;
+        }
+    }
+
+    /* Trace one in every traceRate requests, dump on SIGUSR1 */
+    if((options->traceRate != 0) && (TraceStart(options->traceRate) != 0))
+    {
+        return ERROR;
+    }
+
+    /* Record the request stream for SimpleFileLock_Replay */
+    if((options->capturePath != NULL) && (CaptureStart(options->capturePath, (uint64_t)options->captureSize << 20, options->captureFiles) != 0))
+    {
+        return ERROR;
+    }
+
+    if(options->redirect != NULL)
+    {
+        EngineSetRedirect(options->redirect);
+    }
+
+    printInfo("Serving port %d from %s storage", options->port, storage->name);
+	serverStruct.serverPortNumber = options->port;
+
+	/* Create socket for sending/receiving datagrams */
+	if ((serverStruct.sockfd = socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) >= 0)
+	{
+		/* Construct local address structure */
+		memset(&(serverStruct.serverAddr), 0, sizeof(serverStruct.serverAddr));   /* Zero out structure */
+		serverStruct.serverAddr.sin_family = AF_INET;                /* Internet address family */
+		serverStruct.serverAddr.sin_addr.s_addr = htonl(INADDR_ANY); /* Any incoming interface */
+		serverStruct.serverAddr.sin_port = htons(serverStruct.serverPortNumber);      /* Local port */
+
+		/* Timestamp arrivals to measure queueing delay */
+		SocketEnableTimestamps(serverStruct.sockfd);
+		responseSocket = serverStruct.sockfd;
+
+		/* Bind to the local address */
+		if (bind(serverStruct.sockfd, (struct sockaddr *) &(serverStruct.serverAddr), sizeof(serverStruct.serverAddr)) < 0)
+		{
+			printErrno("Can't bind to port %d", serverStruct.serverPortNumber);
+		}
+		/* Clients on this host skip the UDP stack, on a loop thread of their own */
+		else if ((options->localPath != NULL) && ((localSocket = SocketOpenLocal(options->localPath)) < 0))
+		{
+			printError("Can't serve local clients on %s", options->localPath);
+		}
+		else if ((localSocket >= 0) && (pthread_create(&localThread, NULL, LocalThread, options) != 0))
+		{
+			printErrno("Can't start local socket thread%s", "");
+		}
+		else
+		{
+			if (localSocket >= 0)
+			{
+				printInfo("Serving local clients on %s", options->localPath);
+				received = ReceiveShared;
+			}
+
+			/* Only returns on error */
+			EventRun(serverStruct.sockfd, options->io, sizeof(ClientRequest_t) + DELEGATION_PAYLOAD_MAX, received);
+		}
+
+		close(serverStruct.sockfd);
+	}
+	else
+	{
+		printErrno("Can't create socket%s", "");
+	}
+
+    return ERROR;
+}
+
+static void *LocalThread(void *arg)
+{
+    EngineOptions_t *options = arg;
+
+    SocketEnableTimestamps(localSocket);
+    EventRun(localSocket, options->io, sizeof(ClientRequest_t) + DELEGATION_PAYLOAD_MAX, ReceiveShared);
+    printError("Stopped serving local clients on %s", options->localPath);
+
+    return NULL;
+}
+
+/* EventReceived_t for both sockets when there is a local one */
+static void ReceiveShared(int sockfd, void *datagram, ssize_t length, struct sockaddr_in *fromAddr, uint64_t queueDelay)
+{
+    pthread_mutex_lock(&requestMutex);
+    ReceiveRequest(sockfd, datagram, length, fromAddr, queueDelay);
+    pthread_mutex_unlock(&requestMutex);
+}
+
+/* Socket a client's address is reached on, for sends outside its request */
+static int SocketFor(struct sockaddr_in *clientAddr)
+{
+    return (clientAddr->sin_family == AF_UNIX) ? localSocket : responseSocket;
+}
+
+/* EventReceived_t for the server socket */
+static void ReceiveRequest(int sockfd, void *datagram, ssize_t length, struct sockaddr_in *fromAddr, uint64_t queueDelay)
+{
+	ServerStruct_t serverStruct;
+	ClientRequest_t request;
+	SessionRequest_t *sessionRequest = datagram;
+	ClientTableNode_t *clientNode = NULL;
+	size_t headerLength = sizeof(ClientRequest_t);
+
+	/* Session requests are shorter, and delegated writes may follow either */
+	if ((length >= (ssize_t)sizeof(uint32_t)) && (sessionRequest->magic == SESSION_MAGIC))
+	{
+		headerLength = sizeof(SessionRequest_t);
+	}
+
+	if (length < (ssize_t)headerLength)
+	{
+		printError("Read %d bytes instead of %d", (int)length, (int)headerLength);
+		return;
+	}
+
+	/* Another server is active: the client's locks and stored responses are there */
+	if (RedirectRequest(sockfd, fromAddr) == true)
+	{
+		return;
+	}
+
+	if (headerLength == sizeof(SessionRequest_t))
+	{
+		/* Found by index: its name, number and incarnation were checked when the session opened */
+		if ((clientNode = SessionLookup(sessionRequest->sessionId)) == NULL)
+		{
+			printDebug("Session %llu: Unknown, Send Session Unknown\n", (unsigned long long)sessionRequest->sessionId);
+			SendNotice(sockfd, fromAddr, SESSION_UNKNOWN, "Unknown session\n");
+			return;
+		}
+
+		strcpy(request.machineName, clientNode->machineName);
+		request.clientNumber = clientNode->clientNumber;
+		request.clientIncarnation = clientNode->clientIncarnation;
+		request.requestNumber = sessionRequest->requestNumber;
+		memcpy(request.operation, sessionRequest->operation, sizeof(request.operation));
+	}
+	else
+	{
+		memcpy(&request, datagram, sizeof(ClientRequest_t));
+	}
+
+	memset(&serverStruct, 0, sizeof(ServerStruct_t));
+	serverStruct.sockfd = sockfd;
+	serverStruct.clientAddr = *fromAddr;
+	serverStruct.queueDelay = queueDelay;
+	serverStruct.clientNode = clientNode;
+	if (length > (ssize_t)headerLength)
+	{
+		serverStruct.payload = (char *)datagram + headerLength;
+		serverStruct.payloadLength = length - headerLength;
+	}
+
+	/* Script lines keep their newline, library requests have none */
+	printDebug("%s:%d.%d_%d - %.*s\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber, (int)strcspn(request.operation, "\n"), request.operation);
+	MetricsRecordQueueDelay(serverStruct.queueDelay);
+	CaptureRequest(&request, &(serverStruct.clientAddr), serverStruct.queueDelay);
+
+	/* The handshake isn't a numbered request and is never dropped */
+	if ((clientNode == NULL) && (strcmp(request.operation, SESSION_OPERATION) == 0))
+	{
+		EpochEnter();
+		OpenSession(&serverStruct, &request);
+		EvictClients();
+		EpochExit();
+		return;
+	}
+
+	/* The client has already resent anything that waited longer than its timeout */
+	if ((dropStale == true) && (serverStruct.queueDelay > CLIENT_RETRANSMIT_MS * 1000000ULL))
+	{
+		printDebug("%s:%d.%d_%d - Stale In Queue: Drop Request, Send Nothing\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
+		staleDropCounter++;
+		return;
+	}
+
+	/* Parse request */
+	EpochEnter();
+	if(HandleRequest(serverStruct, request) == ERROR)
+	{
+		printError("Failed to process request: %s", request.operation);
+	}
+	EvictClients();
+	EpochExit();
+}
+
+status_t HandleRequest(ServerStruct_t serverStruct, ClientRequest_t request)
+{
+	status_t status = ERROR;
+	status_t validArgs = ERROR;
+	status_t gotLock = ERROR;
+	status_t positioned = OK;
+	status_t readyToTransmit = ERROR;
+	ParsedOperation_t parsed;
+	RequestAction_t action;
+	ClientTableNode_t *clientNode = NULL;
+	LockTableNode_t *lockNode = NULL;
+	long position = -1;
+	MetricsOp_t op = MetricsOpFromOperation(request.operation);
+	uint64_t startTime = MetricsNow();
+	uint64_t stageStart = startTime;
+
+	TraceBegin(request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber, request.operation, startTime);
+	TraceSpan("queue", startTime - serverStruct.queueDelay, startTime);
+
+	/* Based on client table, determine what action to take as well
+	 * as populating clientNode, unless the session already found it */
+	clientNode = serverStruct.clientNode;
+	action = ValidateClient(request, &clientNode);
+	if(clientNode != NULL)
+	{
+		ClientTouch(clientNode);
+	}
+	MetricsStageEnd(METRIC_STAGE_VALIDATE, &stageStart);
+
+	/* Only act on  */
+	if(action == DROP_REQUEST_SEND_NOTHING)
+	{
+	    status = OK;
+	}
+	else if(action == SEND_STORED_RESPONSE)
+    {
+        /* A write not yet committed is answered by the commit, not by its retransmits */
+        if(clientNode->commitTicket > __atomic_load_n(&committedTicket, __ATOMIC_ACQUIRE))
+        {
+            status = OK;
+        }
+        else
+        {
+            readyToTransmit = OK;
+        }
+    }
+    /* PROCESS_REQUEST_SEND_RESPONSE and PROCESS_REQUEST_SEND_NOTHING */
+    else
+    {
+        clientNode->commitTicket = 0;
+        clientNode->responseData = NULL;
+        validArgs = ParseOperation(&request, &parsed);
+
+        MetricsStageEnd(METRIC_STAGE_PARSE, &stageStart);
+
+        if(validArgs == OK)
+        {
+            /* Check if any locks exist for the client and make sure the lockType supports the request */
+            if((lockNode = GetLock(request.machineName, parsed.fileNameString)) != NULL)
+            {
+                if(lockNode->clientNumber == request.clientNumber)
+                {
+                    if((lockNode->lockStatus == parsed.lockType) ||
+                       (strcmp(parsed.commandString, "close") == 0) ||
+                       (strcmp(parsed.commandString, "lseek") == 0))
+                    {
+                        gotLock = OK;
+                    }
+                    else
+                    {
+                        clientNode->storedResponse.returnValue = ERROR;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Invalid lock type for %s operation\n", parsed.commandString);
+                        printError("%s", clientNode->storedResponse.returnString);
+                        clientNode->requestNumber = request.requestNumber;
+                        readyToTransmit = OK;
+                    }
+                }
+                else
+                {
+                    /* The holder writes back what it has cached; the lock is still its own until it closes */
+                    if(lockNode->delegated == true)
+                    {
+                        RecallDelegation(SocketFor(&lockNode->holderAddr), lockNode);
+                    }
+
+                    clientNode->storedResponse.returnValue = ERROR;
+                    snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't get lock for %s:%s for client %d as %d has it already\n", lockNode->machineName, lockNode->fileName, request.clientNumber, lockNode->clientNumber);
+                    printError("%s", clientNode->storedResponse.returnString);
+                    clientNode->requestNumber = request.requestNumber;
+                    readyToTransmit = OK;
+                }
+            }
+            /* Create new lock for open commands only */
+            else if((strcmp(parsed.commandString, "open") == 0))
+            {
+                if((lockNode = AddLock(request.machineName, parsed.fileNameString, request.clientNumber, parsed.lockType)) != NULL)
+                {
+                    clientNode->locksHeld++;
+                    gotLock = OK;
+                }
+                else
+                {
+                    clientNode->storedResponse.returnValue = ERROR;
+                    snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't create lock for %s for client %d\n", parsed.filePath, request.clientNumber);
+                    printError("%s", clientNode->storedResponse.returnString);
+                    clientNode->requestNumber = request.requestNumber;
+                    readyToTransmit = OK;
+                }
+            }
+            else
+            {
+                clientNode->storedResponse.returnValue = ERROR;
+                snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "No lock found for %s\n", parsed.filePath);
+                printError("%s", clientNode->storedResponse.returnString);
+                clientNode->requestNumber = request.requestNumber;
+                readyToTransmit = OK;
+            }
+            MetricsStageEnd(METRIC_STAGE_LOCK, &stageStart);
+
+            /* readat and writeat run as read and write from their position, then the lock's own is put back */
+            if((gotLock == OK) && (parsed.offset >= 0) && (lockNode->fileHandle != NULL) &&
+               (SeekToOffset(lockNode, &parsed, clientNode, &position) != OK))
+            {
+                printError("%s", clientNode->storedResponse.returnString);
+                clientNode->requestNumber = request.requestNumber;
+                readyToTransmit = OK;
+                positioned = ERROR;
+            }
+
+            if((gotLock == OK) && (positioned == OK))
+            {
+                if(strcmp(parsed.commandString, "open") == 0)
+                {
+                    if(lockNode->fileHandle == NULL)
+                    {
+                        lockNode->append = (parsed.mode[0] == 'a');
+                        if((lockNode->fileHandle = storage->open(&parsed)) == NULL)
+                        {
+                            clientNode->storedResponse.returnValue = ERROR;
+                            snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't open %s: %s\n", parsed.filePath, strerror(errno));
+                            printError("%s", clientNode->storedResponse.returnString);
+                            if(ReleaseLock(request.machineName, parsed.fileNameString, request.clientNumber) == OK)
+                            {
+                                clientNode->locksHeld--;
+                            }
+                        }
+                        /* Only a write lock is delegated: the holder then knows everything it could read back */
+                        else if((parsed.delegate == true) && (lockNode->lockStatus == WRITE_LOCK))
+                        {
+                            lockNode->delegated = true;
+                            lockNode->holderAddr = serverStruct.clientAddr;
+                            delegations++;
+                            clientNode->storedResponse.returnValue = OK;
+                            snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Opened %s " DELEGATED_SUFFIX "\n", parsed.filePath);
+                        }
+                        else
+                        {
+                            clientNode->storedResponse.returnValue = OK;
+                            snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Opened %s\n", parsed.filePath);
+                        }
+                    }
+                    else
+                    {
+                        storage->close(lockNode);
+                        lockNode->fileHandle = NULL;
+                        if(ReleaseLock(request.machineName, parsed.fileNameString, request.clientNumber) == OK)
+                        {
+                            clientNode->locksHeld--;
+                        }
+                        clientNode->storedResponse.returnValue = ERROR;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "File handle not NULL, is %s already open\n", parsed.filePath);
+                        printError("%s", clientNode->storedResponse.returnString);
+                    }
+
+                    clientNode->requestNumber = request.requestNumber;
+                    readyToTransmit = OK;
+                }
+                else if(lockNode->fileHandle == NULL)
+                {
+                    clientNode->storedResponse.returnValue = ERROR;
+                    snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "File handle NULL, is %s open?\n", parsed.filePath);
+                    printError("%s", clientNode->storedResponse.returnString);
+                    clientNode->requestNumber = request.requestNumber;
+                    readyToTransmit = OK;
+                }
+                else if((strcmp(parsed.commandString, "upgrade") == 0) || (strcmp(parsed.commandString, "downgrade") == 0))
+                {
+                    /* The holder's cached writes go back with a flush or close first */
+                    if(lockNode->delegated == true)
+                    {
+                        clientNode->storedResponse.returnValue = ERROR;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't change the lock on %s while it is delegated\n", parsed.filePath);
+                        printError("%s", clientNode->storedResponse.returnString);
+                    }
+                    else if(ChangeLock(lockNode, &parsed) == OK)
+                    {
+                        clientNode->storedResponse.returnValue = OK;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "%s %s to a %s lock\n",
+                                 (lockNode->lockStatus == WRITE_LOCK) ? "Upgraded" : "Downgraded", parsed.filePath, (lockNode->lockStatus == WRITE_LOCK) ? "write" : "read");
+                    }
+                    /* Closed and not reopened, so the lock goes as with a failed open */
+                    else
+                    {
+                        clientNode->storedResponse.returnValue = ERROR;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't reopen %s: %s\n", parsed.filePath, strerror(errno));
+                        printError("%s", clientNode->storedResponse.returnString);
+                        if(ReleaseLock(request.machineName, parsed.fileNameString, request.clientNumber) == OK)
+                        {
+                            clientNode->locksHeld--;
+                        }
+                    }
+
+                    clientNode->requestNumber = request.requestNumber;
+                    readyToTransmit = OK;
+                }
+                else if(strcmp(parsed.commandString, "close") == 0)
+                {
+                    if(ApplyDelegatedWrites(&serverStruct, lockNode, &parsed, clientNode) != OK)
+                    {
+                        printError("%s", clientNode->storedResponse.returnString);
+                    }
+                    else if(storage->close(lockNode) == 0)
+                    {
+                        lockNode->fileHandle = NULL;
+
+                        if(ReleaseLock(request.machineName, parsed.fileNameString, request.clientNumber) == OK)
+                        {
+                            clientNode->locksHeld--;
+                            clientNode->storedResponse.returnValue = OK;
+                            snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Closed %s\n", parsed.filePath);
+                        }
+                        else
+                        {
+                            clientNode->storedResponse.returnValue = ERROR;
+                            snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't release lock for %s for client %d\n", parsed.filePath, request.clientNumber);
+                            printError("%s", clientNode->storedResponse.returnString);
+                        }
+                    }
+                    else
+                    {
+                        clientNode->storedResponse.returnValue = ERROR;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't close %s: %s\n", parsed.filePath, strerror(errno));
+                        printError("%s", clientNode->storedResponse.returnString);
+                    }
+
+                    clientNode->requestNumber = request.requestNumber;
+                    readyToTransmit = OK;
+                }
+                else if((strcmp(parsed.commandString, "read") == 0) || (strcmp(parsed.commandString, "readat") == 0))
+                {
+                    char *data = clientNode->storedResponse.returnString + sizeof(READ_PREFIX) - 1;
+                    int bytesRead = 0;
+
+                    /* The data has to fit in one response along with "Read '' from <path>\n" */
+                    if(parsed.numBytes > (int)(sizeof(clientNode->storedResponse.returnString) - strlen(parsed.filePath) - sizeof(READ_PREFIX READ_SUFFIX "\n")))
+                    {
+                        clientNode->storedResponse.returnValue = ERROR;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't return %d bytes of %s in one response\n", parsed.numBytes, parsed.filePath);
+                        printError("%s", clientNode->storedResponse.returnString);
+                    }
+                    /* Large reads stay where the backend has them and go out with the response */
+                    else if((parsed.numBytes > RESPONSE_INLINE_MAX) &&
+                            (storage->readReference != NULL) &&
+                            ((clientNode->responseData = storage->readReference(lockNode, &parsed, &bytesRead)) != NULL))
+                    {
+                        if(bytesRead == parsed.numBytes)
+                        {
+                            clientNode->storedResponse.returnValue = OK;
+                            clientNode->responseDataLength = bytesRead;
+                            clientNode->responseSplit = sizeof(READ_PREFIX) - 1;
+                            snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), READ_PREFIX READ_SUFFIX "%s\n", parsed.filePath);
+                            referencedResponses++;
+                        }
+                        else
+                        {
+                            clientNode->responseData = NULL;
+                            clientNode->storedResponse.returnValue = ERROR;
+                            snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Encountered EOF during read: only read %d bytes\n", bytesRead);
+                            printError("%s", clientNode->storedResponse.returnString);
+                        }
+                    }
+                    /* The backend copies the data straight into the response, then it is framed */
+                    else if((bytesRead = storage->read(lockNode, &parsed, data)) == parsed.numBytes)
+                    {
+                        clientNode->storedResponse.returnValue = OK;
+                        memcpy(clientNode->storedResponse.returnString, READ_PREFIX, sizeof(READ_PREFIX) - 1);
+                        snprintf(data + bytesRead, sizeof(clientNode->storedResponse.returnString) - (data + bytesRead - clientNode->storedResponse.returnString), READ_SUFFIX "%s\n", parsed.filePath);
+                    }
+                    else if(bytesRead >= 0)
+                    {
+                        clientNode->storedResponse.returnValue = ERROR;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Encountered EOF during read: only read %d bytes\n", bytesRead);
+                        printError("%s", clientNode->storedResponse.returnString);
+                    }
+                    else
+                    {
+                        clientNode->storedResponse.returnValue = ERROR;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't read from %s: %s\n", parsed.filePath, strerror(errno));
+                        printError("%s", clientNode->storedResponse.returnString);
+                    }
+
+                    clientNode->requestNumber = request.requestNumber;
+                    readyToTransmit = OK;
+                }
+                else if((strcmp(parsed.commandString, "write") == 0) || (strcmp(parsed.commandString, "writeat") == 0))
+                {
+                    if(storage->write(lockNode, &parsed) == 0)
+                    {
+                        if(storage->commitTicket != NULL)
+                        {
+                            clientNode->commitTicket = storage->commitTicket();
+                        }
+                        clientNode->storedResponse.returnValue = OK;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Wrote '%s' to %s\n", parsed.messageString, parsed.filePath);
+                    }
+                    else
+                    {
+                        clientNode->storedResponse.returnValue = ERROR;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't write to %s\n", parsed.filePath);
+                        printError("%s", clientNode->storedResponse.returnString);
+                    }
+
+                    clientNode->requestNumber = request.requestNumber;
+                    readyToTransmit = OK;
+                }
+                else if(strcmp(parsed.commandString, "flush") == 0)
+                {
+                    if(ApplyDelegatedWrites(&serverStruct, lockNode, &parsed, clientNode) != OK)
+                    {
+                        printError("%s", clientNode->storedResponse.returnString);
+                    }
+                    /* The holder's position, which only it has kept up to date */
+                    else if((parsed.numBytes >= 0) && (storage->lseek(lockNode, &parsed) != 0))
+                    {
+                        clientNode->storedResponse.returnValue = ERROR;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't move %s file pointer to %d bytes from start\n", parsed.filePath, parsed.numBytes);
+                        printError("%s", clientNode->storedResponse.returnString);
+                    }
+                    else
+                    {
+                        if(parsed.delegate == false)
+                        {
+                            lockNode->delegated = false;
+                        }
+                        clientNode->storedResponse.returnValue = OK;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Flushed %d bytes to %s\n", serverStruct.payloadLength, parsed.filePath);
+                    }
+
+                    clientNode->requestNumber = request.requestNumber;
+                    readyToTransmit = OK;
+                }
+                else if(strcmp(parsed.commandString, "lseek") == 0)
+                {
+                    if(storage->lseek(lockNode, &parsed) == 0)
+                    {
+                        clientNode->storedResponse.returnValue = OK;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Moved %s file pointer to %d bytes from start\n", parsed.filePath, parsed.numBytes);
+                    }
+                    else
+                    {
+                        clientNode->storedResponse.returnValue = ERROR;
+                        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't move %s file pointer to %d bytes from start\n", parsed.filePath, parsed.numBytes);
+                        printError("%s", clientNode->storedResponse.returnString);
+                    }
+
+                    clientNode->requestNumber = request.requestNumber;
+                    readyToTransmit = OK;
+                }
+
+            }
+
+            if((position >= 0) && (StorageSeek(lockNode, &parsed, position) != 0))
+            {
+                printError("Can't move %s file pointer back to %ld bytes from start", parsed.filePath, position);
+            }
+            MetricsStageEnd(METRIC_STAGE_STORAGE, &stageStart);
+        }
+        else
+        {
+            clientNode->storedResponse.returnValue = ERROR;
+            snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Invalid command arguments: %s\n", request.operation);
+            printError("%s", clientNode->storedResponse.returnString);
+            clientNode->requestNumber = request.requestNumber;
+            readyToTransmit = OK;
+        }
+
+        /* Set done flag if we finished processing, but don't want to send anything */
+        if((readyToTransmit == OK) && (action == PROCESS_REQUEST_SEND_NOTHING))
+        {
+            status = OK;
+        }
+    }
+
+	/* Everything else checks out, but we haven't transmitted yet */
+    if((status != OK) &&
+       (readyToTransmit == OK) &&
+       (clientNode->commitTicket > __atomic_load_n(&committedTicket, __ATOMIC_ACQUIRE)))
+    {
+        /* Hold the response until the write is durable */
+        if(DeferResponse(serverStruct.sockfd, clientNode, &request, &(serverStruct.clientAddr)) == OK)
+        {
+            status = OK;
+        }
+    }
+    else if((status != OK) &&
+       (readyToTransmit == OK))
+    {
+        /* Transmit response */
+        status = SendResponse(serverStruct.sockfd, clientNode, &request, &(serverStruct.clientAddr));
+        MetricsStageEnd(METRIC_STAGE_SEND, &stageStart);
+    }
+
+    MetricsCountAction(action);
+    if(action != DROP_REQUEST_SEND_NOTHING)
+    {
+        MetricsRecordOp(op, startTime);
+    }
+    TraceEnd(MetricsNow());
+
+	return status;
+}
+
+/*
+ * The commit may have finished since the caller looked, and EngineCommitted()
+ * only releases what is already queued, so the ticket is checked again under
+ * deferredMutex and a committed response is sent at once.
+ */
+static status_t DeferResponse(int sockfd, ClientTableNode_t *clientNode, ClientRequest_t *request, struct sockaddr_in *clientAddr)
+{
+    DeferredResponse_t *deferred = NULL;
+    status_t status = ERROR;
+
+    if((deferred = malloc(sizeof(DeferredResponse_t))) != NULL)
+    {
+        deferred->commitTicket = clientNode->commitTicket;
+        deferred->request = *request;
+        deferred->clientAddr = *clientAddr;
+        MaterializeResponse(clientNode, &deferred->response);
+        deferred->next = NULL;
+
+        pthread_mutex_lock(&deferredMutex);
+        if(deferred->commitTicket <= committedTicket)
+        {
+            pthread_mutex_unlock(&deferredMutex);
+            free(deferred);
+            status = SendResponse(sockfd, clientNode, request, clientAddr);
+        }
+        else
+        {
+            if(deferredTail != NULL)
+            {
+                deferredTail->next = deferred;
+            }
+            else
+            {
+                deferredHead = deferred;
+            }
+            deferredTail = deferred;
+            pthread_mutex_unlock(&deferredMutex);
+
+            status = OK;
+        }
+    }
+    else
+    {
+        /* The client retransmits and gets the stored response after the commit */
+        printErrno("Malloc failed%s", "");
+    }
+
+    return status;
+}
+
+void EngineSetRedirect(const char *endpoint)
+{
+    pthread_mutex_lock(&redirectMutex);
+    if(endpoint != NULL)
+    {
+        snprintf(redirectTarget, sizeof(redirectTarget), "%s", endpoint);
+    }
+    __atomic_store_n(&redirecting, (endpoint != NULL), __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&redirectMutex);
+}
+
+/* Only an atomic load on the request path while serving */
+static bool RedirectRequest(int sockfd, struct sockaddr_in *clientAddr)
+{
+    char target[sizeof(redirectTarget) + 1];
+    bool redirected = false;
+
+    if(__atomic_load_n(&redirecting, __ATOMIC_ACQUIRE) == false)
+    {
+        return false;
+    }
+
+    pthread_mutex_lock(&redirectMutex);
+    if((redirected = redirecting) == true)
+    {
+        snprintf(target, sizeof(target), "%s\n", redirectTarget);
+    }
+    pthread_mutex_unlock(&redirectMutex);
+
+    if(redirected == true)
+    {
+        redirectCounter++;
+        SendNotice(sockfd, clientAddr, SERVER_REDIRECT, target);
+    }
+
+    return redirected;
+}
+
+/* A response that isn't the answer to a numbered request, so isn't stored */
+static void SendNotice(int sockfd, struct sockaddr_in *clientAddr, int returnValue, const char *text)
+{
+    EventMessage_t *message = EventMessage();
+    ServerResponse_t *notice = (ServerResponse_t *)message->buffer;
+
+    memset(notice, 0, sizeof(ServerResponse_t));
+    notice->returnValue = returnValue;
+    snprintf(notice->returnString, sizeof(notice->returnString), "%s", text);
+
+    message->addr = *clientAddr;
+    message->iov[0].iov_base = message->buffer;
+    message->iov[0].iov_len = sizeof(ServerResponse_t);
+    message->iovCount = 1;
+
+    EventSend(sockfd, message);
+}
+
+/* Handshake: find or make the client's entry, as ValidateClient() would, and
+ * answer with its session id.  A retransmit gets the same id. */
+static void OpenSession(ServerStruct_t *serverStruct, ClientRequest_t *request)
+{
+    ClientTableNode_t *clientNode = GetClient(*request);
+    char text[sizeof(((ServerResponse_t *)0)->returnString)];
+
+    /* Client crashed! */
+    if((clientNode != NULL) && (request->clientIncarnation != clientNode->clientIncarnation))
+    {
+        printDebug("%s:%d.%d - Client Crashed: Deleting Client Entry, Freeing Locks\n", request->machineName, request->clientNumber, request->clientIncarnation);
+        ReleaseClientLocks(clientNode->machineName, clientNode->clientNumber);
+        DeleteClient(clientNode->machineName, clientNode->clientNumber);
+        clientNode = NULL;
+    }
+
+    /* The request number is the client's last, so its next is processed */
+    if((clientNode == NULL) && ((clientNode = AddClient(*request)) == NULL))
+    {
+        SendNotice(serverStruct->sockfd, &(serverStruct->clientAddr), ERROR, "Can't open session\n");
+        return;
+    }
+
+    if((clientNode->sessionId == 0) && (SessionAssign(clientNode) == 0))
+    {
+        SendNotice(serverStruct->sockfd, &(serverStruct->clientAddr), ERROR, "Can't open session\n");
+        return;
+    }
+
+    ClientTouch(clientNode);
+    printDebug("%s:%d.%d - Session %llu\n", request->machineName, request->clientNumber, request->clientIncarnation, (unsigned long long)clientNode->sessionId);
+    snprintf(text, sizeof(text), "Session %llu\n", (unsigned long long)clientNode->sessionId);
+    SendNotice(serverStruct->sockfd, &(serverStruct->clientAddr), OK, text);
+}
+
+/* 0 if the slab can't grow */
+static uint64_t SessionAssign(ClientTableNode_t *clientNode)
+{
+    SessionSlot_t *slab = NULL;
+    uint32_t index = 0;
+
+    if(sessionFree != UINT32_MAX)
+    {
+        index = sessionFree;
+        sessionFree = sessionSlab[index].nextFree;
+    }
+    else
+    {
+        if(sessionSlabUsed == sessionSlabSize)
+        {
+            uint32_t size = (sessionSlabSize == 0) ? SESSION_SLAB_MIN : (sessionSlabSize * 2);
+
+            if((size > UINT32_MAX / 2) || ((slab = realloc(sessionSlab, size * sizeof(SessionSlot_t))) == NULL))
+            {
+                printErrno("Can't grow the session slab to %u", size);
+                return 0;
+            }
+            sessionSlab = slab;
+            sessionSlabSize = size;
+        }
+
+        index = sessionSlabUsed++;
+        sessionSlab[index].generation = (uint32_t)rand() | 1;
+    }
+
+    sessionSlab[index].clientNode = clientNode;
+    clientNode->sessionId = ((uint64_t)sessionSlab[index].generation << 32) | index;
+    sessionsOpened++;
+
+    return clientNode->sessionId;
+}
+
+static void SessionRelease(ClientTableNode_t *clientNode)
+{
+    uint32_t index = (uint32_t)clientNode->sessionId;
+
+    if(clientNode->sessionId != 0)
+    {
+        sessionSlab[index].clientNode = NULL;
+        sessionSlab[index].generation = (sessionSlab[index].generation + 1) | 1;
+        sessionSlab[index].nextFree = sessionFree;
+        sessionFree = index;
+        clientNode->sessionId = 0;
+    }
+}
+
+static ClientTableNode_t *SessionLookup(uint64_t sessionId)
+{
+    uint32_t index = (uint32_t)sessionId;
+
+    if((index < sessionSlabUsed) && (sessionSlab[index].clientNode != NULL) &&
+       (sessionSlab[index].generation == (uint32_t)(sessionId >> 32)))
+    {
+        return sessionSlab[index].clientNode;
+    }
+
+    return NULL;
+}
+
+/* Best effort: the requester retries its open, and each attempt recalls again */
+static void RecallDelegation(int sockfd, LockTableNode_t *lockNode)
+{
+    char text[sizeof(lockNode->fileName) + 1];
+
+    snprintf(text, sizeof(text), "%s\n", lockNode->fileName);
+
+    printDebug("Recalling delegation of %s:%s from client %d\n", lockNode->machineName, lockNode->fileName, lockNode->clientNumber);
+    delegationRecalls++;
+    SendNotice(sockfd, &lockNode->holderAddr, DELEGATION_RECALL, text);
+}
+
+/* lseek() takes its position from the operation, which for readat is the byte count */
+static int StorageSeek(LockTableNode_t *lockNode, ParsedOperation_t *parsed, long position)
+{
+    ParsedOperation_t seek = *parsed;
+
+    seek.numBytes = position;
+
+    return storage->lseek(lockNode, &seek);
+}
+
+/* Move to parsed->offset for readat or writeat, keeping the position to put back; on failure clientNode's response says why */
+static status_t SeekToOffset(LockTableNode_t *lockNode, ParsedOperation_t *parsed, ClientTableNode_t *clientNode, long *position)
+{
+    long current = -1;
+
+    if((lockNode->append == true) && (parsed->lockType == WRITE_LOCK))
+    {
+        clientNode->storedResponse.returnValue = ERROR;
+        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't write at a position in %s, it is open for append\n", parsed->filePath);
+        return ERROR;
+    }
+
+    if(((current = storage->tell(lockNode)) < 0) || (StorageSeek(lockNode, parsed, parsed->offset) != 0))
+    {
+        clientNode->storedResponse.returnValue = ERROR;
+        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't move %s file pointer to %d bytes from start\n", parsed->filePath, parsed->offset);
+        return ERROR;
+    }
+
+    *position = current;
+
+    return OK;
+}
+
+/*
+ * Locks are exclusive, so the holder can always change its lock's type.  The
+ * file is reopened for the new one (parsed->mode, which doesn't truncate) and
+ * the position carried over; on ERROR it is left closed.
+ */
+static status_t ChangeLock(LockTableNode_t *lockNode, ParsedOperation_t *parsed)
+{
+    ParsedOperation_t reopen = *parsed;
+    long position = storage->tell(lockNode);
+    int closed = storage->close(lockNode);
+
+    lockNode->fileHandle = NULL;
+    lockNode->append = false;
+    lockNode->lockStatus = reopen.lockType = (parsed->lockType == READ_LOCK) ? WRITE_LOCK : READ_LOCK;
+
+    if((position < 0) || (closed != 0) || ((lockNode->fileHandle = storage->open(&reopen)) == NULL))
+    {
+        return ERROR;
+    }
+
+    if(StorageSeek(lockNode, &reopen, position) != 0)
+    {
+        storage->close(lockNode);
+        lockNode->fileHandle = NULL;
+        return ERROR;
+    }
+
+    return OK;
+}
+
+/*
+ * Write the DelegatedWrite_t records that came with a close or flush, in
+ * order.  The whole payload is checked before anything is written.  On
+ * failure clientNode's response says why.
+ */
+static status_t ApplyDelegatedWrites(ServerStruct_t *serverStruct, LockTableNode_t *lockNode, ParsedOperation_t *parsed, ClientTableNode_t *clientNode)
+{
+    char text[DELEGATION_PAYLOAD_MAX + 1];
+    ParsedOperation_t extent = *parsed;
+    DelegatedWrite_t write;
+    int position = 0;
+    status_t status = OK;
+
+    if(serverStruct->payload == NULL)
+    {
+        return OK;
+    }
+
+    if(lockNode->delegated == false)
+    {
+        clientNode->storedResponse.returnValue = ERROR;
+        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "No delegation for %s\n", parsed->filePath);
+        return ERROR;
+    }
+
+    /* Each record needs a length that fits, text without a NUL, and an offset only where it means something */
+    while((status == OK) && (position < serverStruct->payloadLength))
+    {
+        if(serverStruct->payloadLength - position < (int)sizeof(DelegatedWrite_t))
+        {
+            status = ERROR;
+            break;
+        }
+
+        memcpy(&write, serverStruct->payload + position, sizeof(DelegatedWrite_t));
+        position += sizeof(DelegatedWrite_t);
+
+        if((write.length <= 0) || (write.length > serverStruct->payloadLength - position) ||
+           (memchr(serverStruct->payload + position, '\0', write.length) != NULL) ||
+           ((lockNode->append == true) != (write.offset == -1)) || (write.offset < -1))
+        {
+            status = ERROR;
+        }
+        position += write.length;
+    }
+
+    for(position = 0; (status == OK) && (position < serverStruct->payloadLength); position += write.length)
+    {
+        memcpy(&write, serverStruct->payload + position, sizeof(DelegatedWrite_t));
+        position += sizeof(DelegatedWrite_t);
+
+        memcpy(text, serverStruct->payload + position, write.length);
+        text[write.length] = '\0';
+        extent.messageString = text;
+        extent.numBytes = write.offset;
+
+        if(((write.offset >= 0) && (storage->lseek(lockNode, &extent) != 0)) ||
+           (storage->write(lockNode, &extent) != 0))
+        {
+            clientNode->storedResponse.returnValue = ERROR;
+            snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Can't write to %s\n", parsed->filePath);
+            return ERROR;
+        }
+        delegatedWrites++;
+    }
+
+    if(status != OK)
+    {
+        clientNode->storedResponse.returnValue = ERROR;
+        snprintf(clientNode->storedResponse.returnString, sizeof(clientNode->storedResponse.returnString), "Malformed delegated writes for %s\n", parsed->filePath);
+    }
+    else if(storage->commitTicket != NULL)
+    {
+        clientNode->commitTicket = storage->commitTicket();
+    }
+
+    return status;
+}
+
+/*
+ * Send clientNode's response as one datagram of the usual size: the framing
+ * up to the split, any referenced read data in place, the rest of the
+ * framing, and zero padding.  The framing is copied into the message because
+ * the client node can change before a queued send goes out.  Referenced data
+ * only stays put while the read lock is held, and a later request in the same
+ * batch (the client's next incarnation, say) can release it, so a queued send
+ * gets a copy of the data too.
+ */
+static status_t SendResponse(int sockfd, ClientTableNode_t *clientNode, ClientRequest_t *request, struct sockaddr_in *clientAddr)
+{
+    static const char padding[sizeof(ServerResponse_t)];
+    ServerResponse_t *response = &clientNode->storedResponse;
+    EventMessage_t *message = EventMessage();
+    size_t header = offsetof(ServerResponse_t, returnString) + clientNode->responseSplit;
+    size_t tail = strlen(response->returnString + clientNode->responseSplit) + 1;
+    status_t status = ERROR;
+
+    message->addr = *clientAddr;
+
+    if((clientNode->responseData != NULL) && EventQueued(sockfd, message))
+    {
+        MaterializeResponse(clientNode, (ServerResponse_t *)message->buffer);
+        message->iov[0].iov_base = message->buffer;
+        message->iov[0].iov_len = sizeof(*response);
+        message->iovCount = 1;
+    }
+    else
+    {
+        memcpy(message->buffer, response, header);
+        memcpy(message->buffer + header, response->returnString + clientNode->responseSplit, tail);
+
+        if(clientNode->responseData == NULL)
+        {
+            message->iov[0].iov_base = message->buffer;
+            message->iov[0].iov_len = header + tail;
+            message->iovCount = 1;
+        }
+        else
+        {
+            message->iov[0].iov_base = message->buffer;
+            message->iov[0].iov_len = header;
+            message->iov[1].iov_base = (void *)clientNode->responseData;
+            message->iov[1].iov_len = clientNode->responseDataLength;
+            message->iov[2].iov_base = message->buffer + header;
+            message->iov[2].iov_len = tail;
+            message->iovCount = 3;
+        }
+        message->iov[message->iovCount].iov_base = (void *)padding;
+        message->iov[message->iovCount].iov_len = sizeof(*response) - header - tail - ((clientNode->responseData != NULL) ? clientNode->responseDataLength : 0);
+        message->iovCount++;
+    }
+
+    if(EventSend(sockfd, message) == 0)
+    {
+        status = OK;
+
+        /* Only capture needs the whole response in one place */
+        if(CaptureEnabled())
+        {
+            ServerResponse_t captured;
+
+            MaterializeResponse(clientNode, &captured);
+            CaptureResponse(request, &captured, clientAddr);
+        }
+    }
+
+    return status;
+}
+
+/* Copy clientNode's response, with any referenced data, into a plain response */
+static void MaterializeResponse(ClientTableNode_t *clientNode, ServerResponse_t *response)
+{
+    if(clientNode->responseData == NULL)
+    {
+        *response = clientNode->storedResponse;
+    }
+    else
+    {
+        memset(response, 0, sizeof(*response));
+        response->returnValue = clientNode->storedResponse.returnValue;
+        memcpy(response->returnString, clientNode->storedResponse.returnString, clientNode->responseSplit);
+        memcpy(response->returnString + clientNode->responseSplit, clientNode->responseData, clientNode->responseDataLength);
+        strcpy(response->returnString + clientNode->responseSplit + clientNode->responseDataLength, clientNode->storedResponse.returnString + clientNode->responseSplit);
+    }
+}
+
+/* Called by the storage backend's commit thread */
+void EngineCommitted(uint64_t ticket)
+{
+    DeferredResponse_t *released = NULL;
+    DeferredResponse_t **link = &released;
+    int bytesSent = 0;
+
+    /* Tickets only grow, so the released responses are a prefix of the list */
+    pthread_mutex_lock(&deferredMutex);
+    while((deferredHead != NULL) && (deferredHead->commitTicket <= ticket))
+    {
+        *link = deferredHead;
+        link = &deferredHead->next;
+        deferredHead = deferredHead->next;
+    }
+    *link = NULL;
+    if(deferredHead == NULL)
+    {
+        deferredTail = NULL;
+    }
+    __atomic_store_n(&committedTicket, ticket, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&deferredMutex);
+
+    while(released != NULL)
+    {
+        DeferredResponse_t *next = released->next;
+
+        if((bytesSent = sendto(SocketFor(&released->clientAddr), &released->response, sizeof(released->response), 0, (struct sockaddr *) &(released->clientAddr), sizeof(released->clientAddr))) == sizeof(released->response))
+        {
+            CaptureResponse(&released->request, &released->response, &(released->clientAddr));
+        }
+        else
+        {
+            printErrno("Sent a different number of bytes than expected: %d instead of %d", bytesSent, (int)sizeof(released->response));
+        }
+
+        free(released);
+        released = next;
+    }
+}
+
+/* Tokenize the operation in place and work out the lock it needs */
+status_t ParseOperation(ClientRequest_t *request, ParsedOperation_t *parsed)
+{
+    status_t validArgs = ERROR;
+    char *modeString;
+    char *numBytesString;
+    char *positionString;
+
+    parsed->lockType = NO_LOCK;
+    parsed->delegate = false;
+    parsed->offset = -1;
+
+    if((parsed->commandString = strtok(request->operation, " \r\n")) != NULL)
+    {
+        if((parsed->fileNameString = strtok(NULL, " \r\n")) != NULL)
+        {
+            /* Build file path */
+            strcpy(parsed->filePath, request->machineName);
+            strcat(parsed->filePath, ":");
+            strcat(parsed->filePath, parsed->fileNameString);
+
+            if(strcmp(parsed->commandString, "open") == 0)
+            {
+                if((modeString = strtok(NULL, " \r\n")) != NULL)
+                {
+                    /* Build the mode string and lock type */
+                    if(strcmp(modeString, "read") == 0)
+                    {
+                        parsed->lockType = READ_LOCK;
+                        strcpy(parsed->mode, "r");
+                        validArgs = OK;
+                    }
+                    else if(strcmp(modeString, "write") == 0)
+                    {
+                        parsed->lockType = WRITE_LOCK;
+                        strcpy(parsed->mode, "w+");
+                        validArgs = OK;
+                    }
+                    else if(strcmp(modeString, "append") == 0)
+                    {
+                        parsed->lockType = WRITE_LOCK;
+                        strcpy(parsed->mode, "a");
+                        validArgs = OK;
+                    }
+                    else if(strcmp(modeString, "readwrite") == 0)
+                    {
+                        parsed->lockType = READ_LOCK | WRITE_LOCK;
+                        strcpy(parsed->mode, "r+");
+                        validArgs = OK;
+                    }
+                    else
+                    {
+                        printError("Invalid open 'mode': %s", modeString);
+                    }
+
+                    if((validArgs == OK) && ((modeString = strtok(NULL, " \r\n")) != NULL))
+                    {
+                        if(strcmp(modeString, "delegate") == 0)
+                        {
+                            parsed->delegate = true;
+                        }
+                        else
+                        {
+                            printError("Invalid open option: %s", modeString);
+                            validArgs = ERROR;
+                        }
+                    }
+                }
+                else
+                {
+                    printError("Invalid 'open' arguments: %s", request->operation);
+                }
+            }
+            else if(strcmp(parsed->commandString, "close") == 0)
+            {
+                parsed->lockType = READ_LOCK | WRITE_LOCK;
+                validArgs = OK;
+            }
+            else if(strcmp(parsed->commandString, "read") == 0)
+            {
+                if((numBytesString = strtok(NULL, " \r\n")) != NULL)
+                 {
+                     if((parsed->numBytes = strtol(numBytesString, NULL, 10)) > 0)
+                     {
+                         parsed->lockType = READ_LOCK;
+                         validArgs = OK;
+                     }
+                     else
+                     {
+                         printError("Invalid read 'numBytes': %d", parsed->numBytes);
+                     }
+                 }
+                else
+                {
+                    printError("Invalid 'read' arguments: %s", request->operation);
+                }
+            }
+            else if(strcmp(parsed->commandString, "write") == 0)
+            {
+                if((parsed->messageString = strtok(NULL, "\"")) != NULL)
+                 {
+                    parsed->lockType = WRITE_LOCK;
+                    validArgs = OK;
+                 }
+                else
+                {
+                    printError("Invalid 'write' arguments: %s", request->operation);
+                }
+            }
+            else if(strcmp(parsed->commandString, "lseek") == 0)
+            {
+                if((numBytesString = strtok(NULL, " \r\n")) != NULL)
+                {
+                    if((parsed->numBytes = strtol(numBytesString, NULL, 10)) > 0)
+                    {
+                        parsed->lockType = READ_LOCK | WRITE_LOCK;
+                        validArgs = OK;
+                    }
+                    else
+                    {
+                        printError("Invalid lseek 'position': %d", parsed->numBytes);
+                    }
+                }
+                else
+                {
+                    printError("Invalid 'lseek' arguments: %s", request->operation);
+                }
+            }
+            else if((strcmp(parsed->commandString, "upgrade") == 0) || (strcmp(parsed->commandString, "downgrade") == 0))
+            {
+                /* The lock held now, and the mode the file is reopened in */
+                parsed->lockType = (parsed->commandString[0] == 'u') ? READ_LOCK : WRITE_LOCK;
+                strcpy(parsed->mode, (parsed->commandString[0] == 'u') ? "r+" : "r");
+                validArgs = OK;
+            }
+            else if(strcmp(parsed->commandString, "readat") == 0)
+            {
+                /* readat <file> <position> <numBytes> */
+                if(((positionString = strtok(NULL, " \r\n")) != NULL) && ((numBytesString = strtok(NULL, " \r\n")) != NULL))
+                {
+                    if(((parsed->offset = strtol(positionString, NULL, 10)) >= 0) &&
+                       ((parsed->numBytes = strtol(numBytesString, NULL, 10)) > 0))
+                    {
+                        parsed->lockType = READ_LOCK;
+                        validArgs = OK;
+                    }
+                    else
+                    {
+                        printError("Invalid readat 'position' or 'numBytes': %d %d", parsed->offset, parsed->numBytes);
+                    }
+                }
+                else
+                {
+                    printError("Invalid 'readat' arguments: %s", request->operation);
+                }
+            }
+            else if(strcmp(parsed->commandString, "writeat") == 0)
+            {
+                /* writeat <file> <position> "<text>" */
+                if(((positionString = strtok(NULL, " \r\n")) != NULL) && ((parsed->messageString = strtok(NULL, "\"")) != NULL))
+                {
+                    if((parsed->offset = strtol(positionString, NULL, 10)) >= 0)
+                    {
+                        parsed->lockType = WRITE_LOCK;
+                        validArgs = OK;
+                    }
+                    else
+                    {
+                        printError("Invalid writeat 'position': %d", parsed->offset);
+                    }
+                }
+                else
+                {
+                    printError("Invalid 'writeat' arguments: %s", request->operation);
+                }
+            }
+            else if(strcmp(parsed->commandString, "flush") == 0)
+            {
+                /* flush <file> <position, -1 to leave it> [keep] */
+                if((numBytesString = strtok(NULL, " \r\n")) != NULL)
+                {
+                    if((parsed->numBytes = strtol(numBytesString, NULL, 10)) >= -1)
+                    {
+                        parsed->lockType = WRITE_LOCK;
+                        validArgs = OK;
+
+                        if((modeString = strtok(NULL, " \r\n")) != NULL)
+                        {
+                            if(strcmp(modeString, "keep") == 0)
+                            {
+                                parsed->delegate = true;
+                            }
+                            else
+                            {
+                                printError("Invalid flush option: %s", modeString);
+                                validArgs = ERROR;
+                            }
+                        }
+                    }
+                    else
+                    {
+                        printError("Invalid flush 'position': %d", parsed->numBytes);
+                    }
+                }
+                else
+                {
+                    printError("Invalid 'flush' arguments: %s", request->operation);
+                }
+            }
+            else
+            {
+                printError("Invalid command: %s\n", request->operation);
+            }
+        }
+        else
+        {
+            printError("Invalid argument: %s\n", request->operation);
+        }
+    }
+    else
+    {
+        printError("Invalid argument: %s\n", request->operation);
+    }
+
+    return validArgs;
+}
+
+RequestAction_t ValidateClient(ClientRequest_t request, ClientTableNode_t **clientNode)
+{
+    ClientTableNode_t *tempNode = *clientNode;
+    RequestAction_t action = DROP_REQUEST_SEND_NOTHING;
+
+    /* Client with same machine name and client number is already in the list */
+    if((tempNode != NULL) || ((tempNode = GetClient(request)) != NULL))
+    {
+        /* Client crashed! */
+        if(request.clientIncarnation != tempNode->clientIncarnation)
+        {
+            printDebug("%s:%d.%d_%d - Client Crashed: Deleting Client Entry, Freeing Locks\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
+            /* Remove all locks associated with that machine */
+            ReleaseClientLocks(tempNode->machineName, tempNode->clientNumber);
+
+            if(DeleteClient(tempNode->machineName, tempNode->clientNumber) != OK)
+            {
+                printError("Can't remove client entry: %s:%d", tempNode->machineName, tempNode->clientNumber);
+            }
+
+            printDebug("%s:%d.%d_%d - New Client: Process Request, Send Response\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
+            tempNode = AddClient(request);
+            action = PROCESS_REQUEST_SEND_RESPONSE;
+        }
+        else
+        {
+            /* Stale request, drop it */
+            if(request.requestNumber < tempNode->requestNumber)
+            {
+                printDebug("%s:%d.%d_%d - Stale Request: Drop Request, Send Nothing\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
+                action = DROP_REQUEST_SEND_NOTHING;
+            }
+
+            /* Client requesting duplicate request, send stored response */
+            else if(request.requestNumber == tempNode->requestNumber)
+            {
+                printDebug("%s:%d.%d_%d - Duplicate Request: Send Stored Response\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
+                action = SEND_STORED_RESPONSE;
+            }
+
+            /* Simulate com failure */
+            else if(request.requestNumber > tempNode->requestNumber)
+            {
+                switch(rand()%3)
+                {
+                    case 0:
+                    {
+                        printDebug("%s:%d.%d_%d - Comm Failure: Drop Request, Send Nothing\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
+                        action = DROP_REQUEST_SEND_NOTHING;
+                        break;
+                    }
+                    case 1:
+                    {
+                        printDebug("%s:%d.%d_%d - Comm Failure: Process Request, Send Nothing\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
+                        action = PROCESS_REQUEST_SEND_NOTHING;
+                        break;
+                    }
+                    case 2:
+                    {
+                        printDebug("%s:%d.%d_%d - Comm Failure: Process Request, Send Response\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
+                        action = PROCESS_REQUEST_SEND_RESPONSE;
+                        break;
+                    }
+                }
+
+                /* Increment counter */
+                commFailureCounter++;
+            }
+        }
+    }
+    /* No client with the requested machine name and client number exists in the list */
+    else
+    {
+            printDebug("%s:%d.%d_%d - New Client: Process Request, Send Response\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
+        tempNode = AddClient(request);
+        action = PROCESS_REQUEST_SEND_RESPONSE;
+    }
+
+    *clientNode = tempNode;
+
+    return action;
+}
+
+/* Lock table key is "<machineName>\0<fileName>" */
+static size_t BuildLockKey(char *key, char *machineName, char *fileName)
+{
+    size_t machineLength = strlen(machineName) + 1;
+    size_t fileLength = strlen(fileName);
+
+    memcpy(key, machineName, machineLength);
+    memcpy(key + machineLength, fileName, fileLength);
+
+    return machineLength + fileLength;
+}
+
+/* Client table key is "<machineName>\0<clientNumber>" */
+static size_t BuildClientKey(char *key, char *machineName, int clientNumber)
+{
+    size_t machineLength = strlen(machineName) + 1;
+
+    memcpy(key, machineName, machineLength);
+    memcpy(key + machineLength, &clientNumber, sizeof(clientNumber));
+
+    return machineLength + sizeof(clientNumber);
+}
+
+/* NOTE: getClientNode MUST have been called previously and returned NULL */
+ClientTableNode_t *AddClient(ClientRequest_t request)
+{
+    ClientTableNode_t *newNode = NULL;
+    char key[CLIENT_KEY_LEN];
+    size_t keyLength = 0;
+
+    if((newNode = malloc(sizeof(ClientTableNode_t))) != NULL)
+    {
+        memset(newNode, 0, sizeof(ClientTableNode_t));
+
+        /* Initialize new client node */
+        strcpy(newNode->machineName, request.machineName);
+        newNode->clientNumber = request.clientNumber;
+        newNode->requestNumber = request.requestNumber;
+        newNode->clientIncarnation = request.clientIncarnation;
+
+        /* Publish node */
+        keyLength = BuildClientKey(key, newNode->machineName, newNode->clientNumber);
+        if(MapInsert(clientTable, key, keyLength, newNode) == NULL)
+        {
+            printError("Client %d on machine %s already exists", request.clientNumber, request.machineName);
+            free(newNode);
+            newNode = NULL;
+        }
+        else
+        {
+            ClientTouch(newNode);
+        }
+    }
+    else
+    {
+        printErrno("Malloc failed%s", "");
+    }
+
+    return newNode;
+}
+
+status_t DeleteClient(char *machineName, int clientNumber)
+{
+    status_t status = ERROR;
+    char key[CLIENT_KEY_LEN];
+    size_t keyLength = BuildClientKey(key, machineName, clientNumber);
+    ClientTableNode_t *clientNode = NULL;
+
+    /* Node is freed once no reader can still be using it, its session id dies now */
+    if((clientNode = MapRemove(clientTable, key, keyLength)) != NULL)
+    {
+        SessionRelease(clientNode);
+        ClientUnlink(clientNode);
+        status = OK;
+    }
+    else
+    {
+        printInfo("Client %d on machine %s doesnt exist", clientNumber, machineName);
+    }
+
+    return status;
+}
+
+ClientTableNode_t *GetClient(ClientRequest_t request)
+{
+    char key[CLIENT_KEY_LEN];
+    size_t keyLength = BuildClientKey(key, request.machineName, request.clientNumber);
+
+    return MapLookup(clientTable, key, keyLength);
+}
+
+status_t ReleaseLock(char *machineName, char *fileName, int clientNumber)
+{
+    LockTableNode_t *tempNode = NULL;
+    status_t status = ERROR;
+    char key[LOCK_KEY_LEN];
+    size_t keyLength = BuildLockKey(key, machineName, fileName);
+
+    if((tempNode = MapLookup(lockTable, key, keyLength)) != NULL)
+    {
+        if(tempNode->clientNumber == clientNumber)
+        {
+            /* Node is freed once no reader can still be using it */
+            if(MapRemove(lockTable, key, keyLength) != NULL)
+            {
+                status = OK;
+            }
+        }
+        else
+        {
+            printError("Client %d attempting to delete lock for %s:%s which is owned by client %d", clientNumber, tempNode->machineName, tempNode->fileName, tempNode->clientNumber);
+        }
+    }
+
+    return status;
+}
+
+typedef struct ClientLockMatch_t
+{
+    char *machineName;
+    int clientNumber;
+}ClientLockMatch_t;
+
+static int IsClientLock(void *value, void *arg)
+{
+    LockTableNode_t *lockNode = value;
+    ClientLockMatch_t *match = arg;
+
+    return (lockNode->clientNumber == match->clientNumber) &&
+           (strcmp(lockNode->machineName, match->machineName) == 0);
+}
+
+/* A crashed client can't close its files, so they are closed before its locks go */
+static void CloseClientFile(void *value, void *arg)
+{
+    LockTableNode_t *lockNode = value;
+
+    if((IsClientLock(value, arg) != 0) && (lockNode->fileHandle != NULL))
+    {
+        storage->close(lockNode);
+        lockNode->fileHandle = NULL;
+    }
+}
+
+status_t ReleaseClientLocks(char *machineName, int clientNumber)
+{
+    ClientLockMatch_t match;
+    status_t status = ERROR;
+
+    match.machineName = machineName;
+    match.clientNumber = clientNumber;
+
+    /* Closing may sync to disk, which mustn't happen under the table's writeMutex */
+    MapForEach(lockTable, CloseClientFile, &match);
+
+    /* Remove every lock owned by machineName:clientNumber */
+    if(MapRemoveIf(lockTable, IsClientLock, &match) > 0)
+    {
+        status = OK;
+    }
+
+    return status;
+}
+
+
+/* Check if anyone has a lock on a particular machine:file.
+ * The caller must handle differentiating between other client's
+ * locks, and it's own locks as well as lockType */
+LockTableNode_t *GetLock(char *machineName,char *fileName)
+{
+    char key[LOCK_KEY_LEN];
+    size_t keyLength = BuildLockKey(key, machineName, fileName);
+
+    return MapLookup(lockTable, key, keyLength);
+}
+
+LockTableNode_t *AddLock(char *machineName,char *fileName, int clientNumber, LockType_t lockType)
+{
+    LockTableNode_t *newNode = NULL;
+    char key[LOCK_KEY_LEN];
+    size_t keyLength = 0;
+
+    if((newNode = malloc(sizeof(LockTableNode_t))) != NULL)
+    {
+        memset(newNode, 0, sizeof(LockTableNode_t));
+
+        /* Initialize new lock node */
+        strcpy(newNode->machineName, machineName);
+        strcpy(newNode->fileName, fileName);
+        newNode->clientNumber = clientNumber;
+        newNode->lockStatus = lockType;
+
+        /* Publish node */
+        keyLength = BuildLockKey(key, newNode->machineName, newNode->fileName);
+        if(MapInsert(lockTable, key, keyLength, newNode) == NULL)
+        {
+            printError("Lock for %s:%s already exists", machineName, fileName);
+            free(newNode);
+            newNode = NULL;
+        }
+    }
+    else
+    {
+        printErrno("Malloc failed%s", "");
+    }
+
+    return newNode;
+}
+
+double LockTableSize(void)
+{
+    return (double)MapCount(lockTable);
+}
+
+double ClientTableSize(void)
+{
+    return (double)MapCount(clientTable);
+}
+
+double ClientTableBytes(void)
+{
+    return (double)(MapCount(clientTable) * sizeof(ClientTableNode_t));
+}
+
+static time_t ClientClock(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC_COARSE, &now);
+
+    return now.tv_sec;
+}
+
+/* Most recently active first */
+static void ClientTouch(ClientTableNode_t *clientNode)
+{
+    if((clientTtl != 0) || (clientMax != 0))
+    {
+        clientNode->lastActive = ClientClock();
+    }
+
+    if(clientNode != clientLruHead)
+    {
+        ClientUnlink(clientNode);
+        clientNode->lruNext = clientLruHead;
+        if(clientLruHead != NULL)
+        {
+            clientLruHead->lruPrev = clientNode;
+        }
+        clientLruHead = clientNode;
+        if(clientLruTail == NULL)
+        {
+            clientLruTail = clientNode;
+        }
+    }
+}
+
+static void ClientUnlink(ClientTableNode_t *clientNode)
+{
+    if(clientNode->lruPrev != NULL)
+    {
+        clientNode->lruPrev->lruNext = clientNode->lruNext;
+    }
+    else if(clientLruHead == clientNode)
+    {
+        clientLruHead = clientNode->lruNext;
+    }
+
+    if(clientNode->lruNext != NULL)
+    {
+        clientNode->lruNext->lruPrev = clientNode->lruPrev;
+    }
+    else if(clientLruTail == clientNode)
+    {
+        clientLruTail = clientNode->lruPrev;
+    }
+
+    clientNode->lruPrev = NULL;
+    clientNode->lruNext = NULL;
+}
+
+/* Never the most recent client, which the current request may still be using */
+static void EvictClients(void)
+{
+    ClientTableNode_t *clientNode = clientLruTail;
+    time_t now = 0;
+    int looked = 0;
+
+    if((clientTtl == 0) && (clientMax == 0))
+    {
+        return;
+    }
+    now = ClientClock();
+
+    while((clientNode != NULL) && (clientNode != clientLruHead) && (looked++ < EVICT_BATCH))
+    {
+        ClientTableNode_t *newer = clientNode->lruPrev;
+        bool overCap = (clientMax != 0) && (MapCount(clientTable) > clientMax) && (clientNode->lastActive <= now - EVICT_MIN_IDLE);
+        bool idle = (clientTtl != 0) && (clientNode->lastActive <= now - clientTtl);
+
+        /* Clients holding locks are never forgotten.  Touching them keeps them
+         * from filling the batch at the idle end and keeps the list in
+         * lastActive order for the break below */
+        if(clientNode->locksHeld != 0)
+        {
+            ClientTouch(clientNode);
+        }
+        /* The rest are more recent */
+        else if((overCap == false) && (idle == false))
+        {
+            break;
+        }
+        /* A response waiting on a commit still needs the entry */
+        else if(clientNode->commitTicket <= __atomic_load_n(&committedTicket, __ATOMIC_ACQUIRE))
+        {
+            printDebug("%s:%d.%d - %s: Forgetting Client\n", clientNode->machineName, clientNode->clientNumber, clientNode->clientIncarnation, idle ? "Idle" : "Client Table Full");
+            if(DeleteClient(clientNode->machineName, clientNode->clientNumber) == OK)
+            {
+                if(idle == true)
+                {
+                    idleEvictions++;
+                }
+                else
+                {
+                    memoryEvictions++;
+                }
+            }
+        }
+
+        clientNode = newer;
+    }
+}
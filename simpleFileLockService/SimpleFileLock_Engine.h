@@ -0,0 +1,76 @@
+#ifndef SIMPLEFILELOCK_ENGINE_H
+#define SIMPLEFILELOCK_ENGINE_H
+
+#include "defns.h"
+#include "SimpleFileLock_Storage.h"
+#include "SimpleFileLock_Event.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Lock server engine.
+ *
+ * Everything both servers share: the client and lock tables, duplicate and
+ * incarnation handling, the simulated communication failures, parsing, and
+ * the receive loop.  The servers differ only in the StorageBackend_t they
+ * pass to EngineRun(), so the same protocol can run over local files,
+ * LogCabin, or memory alone.
+ */
+
+typedef struct EngineOptions_t
+{
+    int port;                      /* UDP port to serve */
+    EventEngine_t io;              /* How the socket is read and written */
+    int metricsPort;               /* Prometheus metrics on 127.0.0.1, 0 for off */
+    int traceRate;                 /* Trace one in every traceRate requests, 0 for off */
+    int dropStale;                 /* Drop requests queued longer than CLIENT_RETRANSMIT_MS */
+    const char *capturePath;       /* Record requests and responses, NULL for off */
+    int captureSize;               /* MB per capture file */
+    int captureFiles;              /* Capture files kept, 0 for all */
+    const char *redirect;          /* "<ip>:<port>" to send every client to, NULL to serve them */
+    const char *localPath;         /* Unix datagram socket for clients on this host, NULL for none */
+    int clientTtl;                 /* Seconds before an idle client without locks is forgotten, 0 for never */
+    int clientMemory;              /* MB of client table before the least recently active are forgotten, 0 for no cap */
+}EngineOptions_t;
+
+/* Long only options both servers take, clear of their own */
+#define ENGINE_OPTION_CLIENT_TTL    280
+#define ENGINE_OPTION_CLIENT_MEMORY 281
+
+/* Shortest clientTtl, longer than CLIENT_FAILOVER_RETRANSMITS retransmits so
+ * a client isn't forgotten between copies of the same request */
+#define ENGINE_CLIENT_TTL_MIN 2 /* s */
+
+/* Only returns if the server can't be started */
+status_t EngineRun(StorageBackend_t *backend, EngineOptions_t *options);
+
+/* StorageCommitted_t for backends with group commit: sends the responses
+ * held for every write with a commit ticket up to 'ticket' */
+void EngineCommitted(uint64_t ticket);
+
+/* Answer every request with a SERVER_REDIRECT to 'endpoint' ("<ip>:<port>",
+ * or "" to name none), or serve them again with NULL; callable from any thread */
+void EngineSetRedirect(const char *endpoint);
+
+status_t HandleRequest(ServerStruct_t, ClientRequest_t);
+status_t ParseOperation(ClientRequest_t *, ParsedOperation_t *);
+/* *clientNode is the client's entry if its session already found it, else NULL */
+RequestAction_t ValidateClient(ClientRequest_t, ClientTableNode_t **);
+ClientTableNode_t *GetClient(ClientRequest_t);
+status_t DeleteClient(char *, int);
+ClientTableNode_t *AddClient(ClientRequest_t);
+status_t ReleaseLock(char *, char *, int);
+status_t ReleaseClientLocks(char *, int);
+LockTableNode_t *GetLock(char *,char *);
+LockTableNode_t *AddLock(char *,char *, int, LockType_t);
+double LockTableSize(void);
+double ClientTableSize(void);
+double ClientTableBytes(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPLEFILELOCK_ENGINE_H */
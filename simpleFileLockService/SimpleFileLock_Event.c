@@ -0,0 +1,671 @@
+#define _GNU_SOURCE     /* for recvmmsg() and sendmmsg() */
+
+#include "SimpleFileLock_Event.h"
+#include "SimpleFileLock_Socket.h"
+#include "SimpleFileLock_Metrics.h"
+#include "SimpleFileLock_Log.h"
+
+#include <stdlib.h>     /* for malloc() and free() */
+#include <string.h>     /* for memset() and strcmp() */
+#include <errno.h>      /* for errno */
+#include <fcntl.h>      /* for fcntl() */
+#include <unistd.h>     /* for close() and syscall() */
+#include <sys/epoll.h>  /* for epoll_wait() */
+#include <sys/mman.h>   /* for mmap() */
+#include <sys/syscall.h>/* for __NR_io_uring_setup */
+#include <linux/io_uring.h>
+
+#define EVENT_SEND_SLOTS     128   /* Sends queued or in flight per loop */
+#define EVENT_URING_ENTRIES  256   /* Submission queue, above EVENT_SEND_SLOTS + 1 */
+#define EVENT_URING_CQ       1024  /* Completion queue, room for receive bursts */
+#define EVENT_URING_BUFFERS  256   /* Provided receive buffers, a power of 2 */
+#define EVENT_URING_RECV     UINT64_MAX /* user_data of the receive, sends use their slot */
+
+/* The control data SocketReceive() expects: one SO_TIMESTAMPNS stamp */
+#define EVENT_CONTROL_SIZE   CMSG_SPACE(sizeof(struct timespec))
+
+typedef struct EventUring_t
+{
+    int fd;
+    unsigned entries;                     /* Submission queue entries */
+    void *sqRing;
+    size_t sqRingSize;
+    void *cqRing;
+    size_t cqRingSize;
+    struct io_uring_sqe *sqes;
+    unsigned *sqHead;
+    unsigned *sqTail;
+    unsigned *sqMask;
+    unsigned *sqArray;
+    unsigned *cqHead;
+    unsigned *cqTail;
+    unsigned *cqMask;
+    struct io_uring_cqe *cqes;
+    unsigned toSubmit;                    /* Queued since the last io_uring_enter() */
+    struct io_uring_buf_ring *bufRing;    /* Provided buffers, group 0 */
+    unsigned short bufTail;
+    char *buffers;                        /* EVENT_URING_BUFFERS of bufferSize */
+    size_t bufferSize;
+    struct msghdr recvMsg;                /* Name and control sizes for the multishot receive */
+}EventUring_t;
+
+typedef struct EventLoop_t
+{
+    EventEngine_t engine;
+    int sockfd;
+    EventMessage_t slots[EVENT_SEND_SLOTS];
+    int freeSlots[EVENT_SEND_SLOTS];      /* Stack of slots not queued or in flight */
+    int numFree;
+    int queued[EVENT_SEND_SLOTS];         /* Slots to send at the end of the batch */
+    int numQueued;
+    EventUring_t uring;
+}EventLoop_t;
+
+const char *EventEngineNames[] = {"blocking", "epoll", "uring"};
+
+/* Set on the thread running EventRun() */
+static __thread EventLoop_t *loop;
+static __thread EventMessage_t immediate;
+
+static uint64_t syscalls;
+static uint64_t batches;
+
+static int EventRunBlocking(int sockfd, size_t datagramSize, EventReceived_t received);
+static int EventRunEpoll(EventLoop_t *eventLoop, size_t datagramSize, EventReceived_t received);
+static int EventRunUring(EventLoop_t *eventLoop, size_t datagramSize, EventReceived_t received);
+
+int EventEngineFromName(const char *name, EventEngine_t *engine)
+{
+    int status = -1;
+
+    for(int i = EVENT_BLOCKING; i <= EVENT_URING; i++)
+    {
+        if(strcmp(name, EventEngineNames[i]) == 0)
+        {
+            *engine = i;
+            status = 0;
+        }
+    }
+
+    return status;
+}
+
+void EventRegisterMetrics(void)
+{
+    MetricsRegisterCounter("sfl_io_syscalls_total", "Receive, send and wait syscalls made by the network loop", NULL, &syscalls);
+    MetricsRegisterCounter("sfl_io_batches_total", "Batches of received datagrams handled between sends", NULL, &batches);
+}
+
+int EventRun(int sockfd, EventEngine_t engine, size_t datagramSize, EventReceived_t received)
+{
+    EventLoop_t *eventLoop = NULL;
+    int status = -1;
+
+    if(engine == EVENT_BLOCKING)
+    {
+        printInfo("Network I/O: %s", EventEngineNames[engine]);
+        return EventRunBlocking(sockfd, datagramSize, received);
+    }
+
+    if((eventLoop = calloc(1, sizeof(EventLoop_t))) == NULL)
+    {
+        printErrno("Malloc failed%s", "");
+        return -1;
+    }
+
+    eventLoop->sockfd = sockfd;
+    eventLoop->uring.fd = -1;
+    for(int i = 0; i < EVENT_SEND_SLOTS; i++)
+    {
+        eventLoop->freeSlots[eventLoop->numFree++] = EVENT_SEND_SLOTS - 1 - i;
+    }
+    loop = eventLoop;
+
+    /* Falls back to epoll if the kernel says no before anything was received */
+    if(engine == EVENT_URING)
+    {
+        eventLoop->engine = EVENT_URING;
+        status = EventRunUring(eventLoop, datagramSize, received);
+    }
+    if(status != 0)
+    {
+        eventLoop->engine = EVENT_EPOLL;
+        status = EventRunEpoll(eventLoop, datagramSize, received);
+    }
+
+    loop = NULL;
+    free(eventLoop);
+
+    return status;
+}
+
+EventMessage_t *EventMessage(void)
+{
+    EventMessage_t *message = &immediate;
+
+    /* The next free slot, taken by EventSend() */
+    if((loop != NULL) && (loop->numFree > 0))
+    {
+        message = &loop->slots[loop->freeSlots[loop->numFree - 1]];
+    }
+    message->iovCount = 0;
+
+    return message;
+}
+
+int EventQueued(int sockfd, EventMessage_t *message)
+{
+    return (message != &immediate) && (sockfd == loop->sockfd);
+}
+
+int EventSend(int sockfd, EventMessage_t *message)
+{
+    int status = 0;
+
+    memset(&message->msg, 0, sizeof(message->msg));
+    message->msg.msg_name = &message->addr;
+    message->msg.msg_namelen = sizeof(message->addr);
+    message->msg.msg_iov = message->iov;
+    message->msg.msg_iovlen = message->iovCount;
+    message->length = 0;
+    for(int i = 0; i < message->iovCount; i++)
+    {
+        message->length += message->iov[i].iov_len;
+    }
+
+    /* Queued sends go out on the loop's own socket */
+    if(EventQueued(sockfd, message))
+    {
+        loop->queued[loop->numQueued++] = loop->freeSlots[--loop->numFree];
+    }
+    else
+    {
+        __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+        if(sendmsg(sockfd, &message->msg, 0) != (ssize_t)message->length)
+        {
+            printErrno("Can't send %d byte response", (int)message->length);
+            status = -1;
+        }
+    }
+
+    return status;
+}
+
+static int EventRunBlocking(int sockfd, size_t datagramSize, EventReceived_t received)
+{
+    char *datagram = NULL;
+    struct sockaddr_in fromAddr;
+    uint64_t queueDelay = 0;
+    ssize_t length = 0;
+
+    if((datagram = malloc(datagramSize)) == NULL)
+    {
+        printErrno("Malloc failed%s", "");
+        return -1;
+    }
+
+    for (;;) /* Run forever */
+    {
+        /* Block until receive message from a client */
+        __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+        if((length = SocketReceive(sockfd, datagram, datagramSize, &fromAddr, &queueDelay)) >= 0)
+        {
+            batches++;
+            received(sockfd, datagram, length, &fromAddr, queueDelay);
+        }
+        else
+        {
+            printErrno("Can't receive%s", "");
+        }
+    }
+
+    return -1;
+}
+
+/*
+ * epoll
+ */
+
+/* Send everything the batch queued, the slots are free again afterwards */
+static void EventFlushEpoll(EventLoop_t *eventLoop)
+{
+    struct mmsghdr messages[EVENT_SEND_SLOTS];
+    int sent = 0;
+    int count = 0;
+
+    for(int i = 0; i < eventLoop->numQueued; i++)
+    {
+        messages[i].msg_hdr = eventLoop->slots[eventLoop->queued[i]].msg;
+        messages[i].msg_len = 0;
+    }
+
+    while(sent < eventLoop->numQueued)
+    {
+        __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+        if((count = sendmmsg(eventLoop->sockfd, messages + sent, eventLoop->numQueued - sent, 0)) > 0)
+        {
+            sent += count;
+        }
+        else if(errno != EINTR)
+        {
+            /* Skip the message that failed */
+            printErrno("Can't send %d byte response", (int)eventLoop->slots[eventLoop->queued[sent]].length);
+            sent++;
+        }
+    }
+
+    for(int i = 0; i < eventLoop->numQueued; i++)
+    {
+        eventLoop->freeSlots[eventLoop->numFree++] = eventLoop->queued[i];
+    }
+    eventLoop->numQueued = 0;
+}
+
+static int EventRunEpoll(EventLoop_t *eventLoop, size_t datagramSize, EventReceived_t received)
+{
+    struct mmsghdr messages[EVENT_BATCH];
+    struct iovec iov[EVENT_BATCH];
+    struct sockaddr_in fromAddr[EVENT_BATCH];
+    char control[EVENT_BATCH][EVENT_CONTROL_SIZE];
+    struct epoll_event event;
+    char *datagrams = NULL;
+    int epfd = -1;
+    int count = 0;
+
+    if((datagrams = malloc(EVENT_BATCH * datagramSize)) == NULL)
+    {
+        printErrno("Malloc failed%s", "");
+        return -1;
+    }
+
+    memset(&event, 0, sizeof(event));
+    event.events = EPOLLIN;
+
+    if((fcntl(eventLoop->sockfd, F_SETFL, fcntl(eventLoop->sockfd, F_GETFL) | O_NONBLOCK) < 0) ||
+       ((epfd = epoll_create1(0)) < 0) ||
+       (epoll_ctl(epfd, EPOLL_CTL_ADD, eventLoop->sockfd, &event) < 0))
+    {
+        printErrno("Can't set up epoll%s", "");
+        if(epfd >= 0)
+        {
+            close(epfd);
+        }
+        free(datagrams);
+        return -1;
+    }
+
+    printInfo("Network I/O: %s", EventEngineNames[EVENT_EPOLL]);
+
+    for(int i = 0; i < EVENT_BATCH; i++)
+    {
+        iov[i].iov_base = datagrams + i * datagramSize;
+        iov[i].iov_len = datagramSize;
+        memset(&messages[i], 0, sizeof(messages[i]));
+        messages[i].msg_hdr.msg_name = &fromAddr[i];
+        messages[i].msg_hdr.msg_iov = &iov[i];
+        messages[i].msg_hdr.msg_iovlen = 1;
+        messages[i].msg_hdr.msg_control = control[i];
+    }
+
+    for (;;) /* Run forever */
+    {
+        __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+        if(epoll_wait(epfd, &event, 1, -1) < 0)
+        {
+            if(errno != EINTR)
+            {
+                printErrno("Can't wait for requests%s", "");
+            }
+            continue;
+        }
+
+        /* Drain the socket a batch at a time */
+        do
+        {
+            for(int i = 0; i < EVENT_BATCH; i++)
+            {
+                messages[i].msg_hdr.msg_namelen = sizeof(fromAddr[i]);
+                messages[i].msg_hdr.msg_controllen = EVENT_CONTROL_SIZE;
+            }
+
+            __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+            if((count = recvmmsg(eventLoop->sockfd, messages, EVENT_BATCH, MSG_DONTWAIT, NULL)) > 0)
+            {
+                batches++;
+                for(int i = 0; i < count; i++)
+                {
+                    received(eventLoop->sockfd, iov[i].iov_base, messages[i].msg_len, &fromAddr[i], SocketQueueDelay(&messages[i].msg_hdr));
+                }
+                EventFlushEpoll(eventLoop);
+            }
+            else if((errno != EAGAIN) && (errno != EINTR))
+            {
+                printErrno("Can't receive%s", "");
+            }
+        }while(count == EVENT_BATCH);
+    }
+
+    return -1;
+}
+
+/*
+ * io_uring, through the raw syscalls so there is nothing extra to link
+ */
+
+static int UringEnter(EventUring_t *uring, unsigned minComplete)
+{
+    int submitted = 0;
+
+    __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+    if((submitted = syscall(__NR_io_uring_enter, uring->fd, uring->toSubmit, minComplete, (minComplete != 0) ? IORING_ENTER_GETEVENTS : 0, NULL, 0)) >= 0)
+    {
+        uring->toSubmit -= submitted;
+    }
+
+    return submitted;
+}
+
+/* EVENT_URING_ENTRIES is more than can ever be queued, so this doesn't fail */
+static struct io_uring_sqe *UringSqe(EventUring_t *uring)
+{
+    unsigned tail = *uring->sqTail;
+    unsigned index = tail & *uring->sqMask;
+    struct io_uring_sqe *sqe = &uring->sqes[index];
+
+    memset(sqe, 0, sizeof(*sqe));
+    uring->sqArray[index] = index;
+    __atomic_store_n(uring->sqTail, tail + 1, __ATOMIC_RELEASE);
+    uring->toSubmit++;
+
+    return sqe;
+}
+
+static void UringProvideBuffer(EventUring_t *uring, unsigned short bid)
+{
+    struct io_uring_buf *buf = &uring->bufRing->bufs[uring->bufTail & (EVENT_URING_BUFFERS - 1)];
+
+    buf->addr = (uintptr_t)(uring->buffers + bid * uring->bufferSize);
+    buf->len = uring->bufferSize;
+    buf->bid = bid;
+    uring->bufTail++;
+}
+
+static void UringArmReceive(EventLoop_t *eventLoop)
+{
+    struct io_uring_sqe *sqe = UringSqe(&eventLoop->uring);
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = eventLoop->sockfd;
+    sqe->addr = (uintptr_t)&eventLoop->uring.recvMsg;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    sqe->user_data = EVENT_URING_RECV;
+}
+
+static void UringClose(EventUring_t *uring)
+{
+    if(uring->sqes != NULL)
+    {
+        munmap(uring->sqes, uring->entries * sizeof(struct io_uring_sqe));
+    }
+    if((uring->cqRing != NULL) && (uring->cqRing != uring->sqRing))
+    {
+        munmap(uring->cqRing, uring->cqRingSize);
+    }
+    if(uring->sqRing != NULL)
+    {
+        munmap(uring->sqRing, uring->sqRingSize);
+    }
+    if(uring->bufRing != NULL)
+    {
+        munmap(uring->bufRing, EVENT_URING_BUFFERS * sizeof(struct io_uring_buf));
+    }
+    if(uring->fd >= 0)
+    {
+        close(uring->fd);
+    }
+    free(uring->buffers);
+    memset(uring, 0, sizeof(*uring));
+    uring->fd = -1;
+}
+
+static int UringOpen(EventUring_t *uring, size_t datagramSize)
+{
+    struct io_uring_params params;
+    struct io_uring_buf_reg reg;
+
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE;
+    params.cq_entries = EVENT_URING_CQ;
+
+    if((uring->fd = syscall(__NR_io_uring_setup, EVENT_URING_ENTRIES, &params)) < 0)
+    {
+        return -1;
+    }
+
+    uring->entries = params.sq_entries;
+    uring->sqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    uring->cqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if(uring->cqRingSize > uring->sqRingSize)
+        {
+            uring->sqRingSize = uring->cqRingSize;
+        }
+        uring->cqRingSize = uring->sqRingSize;
+    }
+
+    if((uring->sqRing = mmap(NULL, uring->sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING)) == MAP_FAILED)
+    {
+        uring->sqRing = NULL;
+        return -1;
+    }
+    if(params.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        uring->cqRing = uring->sqRing;
+    }
+    else if((uring->cqRing = mmap(NULL, uring->cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING)) == MAP_FAILED)
+    {
+        uring->cqRing = NULL;
+        return -1;
+    }
+    if((uring->sqes = mmap(NULL, params.sq_entries * sizeof(struct io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES)) == MAP_FAILED)
+    {
+        uring->sqes = NULL;
+        return -1;
+    }
+
+    uring->sqHead = (unsigned *)((char *)uring->sqRing + params.sq_off.head);
+    uring->sqTail = (unsigned *)((char *)uring->sqRing + params.sq_off.tail);
+    uring->sqMask = (unsigned *)((char *)uring->sqRing + params.sq_off.ring_mask);
+    uring->sqArray = (unsigned *)((char *)uring->sqRing + params.sq_off.array);
+    uring->cqHead = (unsigned *)((char *)uring->cqRing + params.cq_off.head);
+    uring->cqTail = (unsigned *)((char *)uring->cqRing + params.cq_off.tail);
+    uring->cqMask = (unsigned *)((char *)uring->cqRing + params.cq_off.ring_mask);
+    uring->cqes = (struct io_uring_cqe *)((char *)uring->cqRing + params.cq_off.cqes);
+
+    /* Each buffer holds the recvmsg header, the sender, the timestamp and the datagram */
+    uring->recvMsg.msg_namelen = sizeof(struct sockaddr_in);
+    uring->recvMsg.msg_controllen = EVENT_CONTROL_SIZE;
+    uring->bufferSize = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) + EVENT_CONTROL_SIZE + datagramSize;
+
+    if((uring->buffers = malloc(EVENT_URING_BUFFERS * uring->bufferSize)) == NULL)
+    {
+        return -1;
+    }
+    if((uring->bufRing = mmap(NULL, EVENT_URING_BUFFERS * sizeof(struct io_uring_buf), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0)) == MAP_FAILED)
+    {
+        uring->bufRing = NULL;
+        return -1;
+    }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uintptr_t)uring->bufRing;
+    reg.ring_entries = EVENT_URING_BUFFERS;
+    reg.bgid = 0;
+    if(syscall(__NR_io_uring_register, uring->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0)
+    {
+        return -1;
+    }
+
+    for(int i = 0; i < EVENT_URING_BUFFERS; i++)
+    {
+        UringProvideBuffer(uring, i);
+    }
+    __atomic_store_n(&uring->bufRing->tail, uring->bufTail, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/* Returns -1 to fall back to epoll, only before the first datagram */
+static int EventRunUring(EventLoop_t *eventLoop, size_t datagramSize, EventReceived_t received)
+{
+    EventUring_t *uring = &eventLoop->uring;
+    bool receiving = false;
+    bool rearm = true;
+
+    if(UringOpen(uring, datagramSize) != 0)
+    {
+        printErrno("io_uring unavailable, using epoll%s", "");
+        UringClose(uring);
+        return -1;
+    }
+
+    printInfo("Network I/O: %s", EventEngineNames[EVENT_URING]);
+
+    for (;;) /* Run forever */
+    {
+        unsigned head = *uring->cqHead;
+        unsigned tail = 0;
+        bool batch = false;
+
+        if(rearm == true)
+        {
+            UringArmReceive(eventLoop);
+            rearm = false;
+        }
+
+        /* Submit the batch's sends and the receive, then wait for them and a request */
+        if((UringEnter(uring, 1 + EVENT_SEND_SLOTS - eventLoop->numFree) < 0) && (errno != EINTR) && (errno != EBUSY))
+        {
+            printErrno("io_uring_enter failed%s", "");
+        }
+
+        tail = __atomic_load_n(uring->cqTail, __ATOMIC_ACQUIRE);
+
+        /* Sends first: they were queued before any of the requests below */
+        for(unsigned i = head; i != tail; i++)
+        {
+            struct io_uring_cqe *cqe = &uring->cqes[i & *uring->cqMask];
+            EventMessage_t *message = NULL;
+            ssize_t sent = cqe->res;
+
+            if(cqe->user_data == EVENT_URING_RECV)
+            {
+                continue;
+            }
+
+            message = &eventLoop->slots[cqe->user_data];
+
+            /* Sent MSG_DONTWAIT so it never waits in the kernel, a full socket buffer is retried here */
+            if(sent == -EAGAIN)
+            {
+                __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+                sent = (sendmsg(eventLoop->sockfd, &message->msg, 0) < 0) ? -errno : (ssize_t)message->length;
+            }
+            if(sent != (ssize_t)message->length)
+            {
+                errno = (sent < 0) ? -sent : EMSGSIZE;
+                printErrno("Can't send %d byte response", (int)message->length);
+            }
+            eventLoop->freeSlots[eventLoop->numFree++] = cqe->user_data;
+        }
+
+        for(unsigned i = head; i != tail; i++)
+        {
+            struct io_uring_cqe *cqe = &uring->cqes[i & *uring->cqMask];
+            struct io_uring_recvmsg_out *out = NULL;
+            struct msghdr control;
+            unsigned short bid = 0;
+
+            if(cqe->user_data != EVENT_URING_RECV)
+            {
+                continue;
+            }
+
+            /* The multishot receive stopped, e.g. out of buffers */
+            if(!(cqe->flags & IORING_CQE_F_MORE))
+            {
+                rearm = true;
+            }
+
+            if(cqe->res < 0)
+            {
+                /* Kernels before 6.0 have no multishot recvmsg */
+                if((receiving == false) && (cqe->res == -EINVAL))
+                {
+                    errno = -cqe->res;
+                    printErrno("io_uring multishot receive unavailable, using epoll%s", "");
+                    __atomic_store_n(uring->cqHead, tail, __ATOMIC_RELEASE);
+                    UringClose(uring);
+                    return -1;
+                }
+                else if(cqe->res != -ENOBUFS)
+                {
+                    errno = -cqe->res;
+                    printErrno("Can't receive%s", "");
+                }
+                continue;
+            }
+
+            if(!(cqe->flags & IORING_CQE_F_BUFFER))
+            {
+                continue;
+            }
+
+            receiving = true;
+            batch = true;
+            bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+            out = (struct io_uring_recvmsg_out *)(uring->buffers + bid * uring->bufferSize);
+
+            if((size_t)cqe->res >= sizeof(*out) + uring->recvMsg.msg_namelen + uring->recvMsg.msg_controllen)
+            {
+                char *name = (char *)(out + 1);
+                char *payload = name + uring->recvMsg.msg_namelen + uring->recvMsg.msg_controllen;
+                ssize_t length = cqe->res - (payload - (char *)out);
+
+                memset(&control, 0, sizeof(control));
+                control.msg_control = name + uring->recvMsg.msg_namelen;
+                control.msg_controllen = out->controllen;
+
+                received(eventLoop->sockfd, payload, length, (struct sockaddr_in *)name, SocketQueueDelay(&control));
+            }
+
+            UringProvideBuffer(uring, bid);
+        }
+
+        __atomic_store_n(&uring->bufRing->tail, uring->bufTail, __ATOMIC_RELEASE);
+        __atomic_store_n(uring->cqHead, tail, __ATOMIC_RELEASE);
+        if(batch == true)
+        {
+            batches++;
+        }
+
+        /* Queue the batch's responses, submitted with the next wait */
+        for(int i = 0; i < eventLoop->numQueued; i++)
+        {
+            EventMessage_t *message = &eventLoop->slots[eventLoop->queued[i]];
+            struct io_uring_sqe *sqe = UringSqe(uring);
+
+            sqe->opcode = IORING_OP_SENDMSG;
+            sqe->fd = eventLoop->sockfd;
+            sqe->addr = (uintptr_t)&message->msg;
+            sqe->msg_flags = MSG_DONTWAIT;
+            sqe->user_data = eventLoop->queued[i];
+        }
+        eventLoop->numQueued = 0;
+    }
+
+    return -1;
+}
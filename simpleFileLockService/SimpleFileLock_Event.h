@@ -0,0 +1,84 @@
+#ifndef SIMPLEFILELOCK_EVENT_H
+#define SIMPLEFILELOCK_EVENT_H
+
+#include "defns.h"
+
+#include <stdint.h>     /* for uint64_t */
+#include <sys/types.h>  /* for ssize_t */
+#include <sys/socket.h> /* for msghdr */
+#include <sys/uio.h>    /* for iovec */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Server network I/O.
+ *
+ * EventRun() owns the server socket: it receives datagrams, hands each one to
+ * the EventReceived_t callback, and sends whatever the callback queued with
+ * EventSend().  The engines differ in how many syscalls that takes:
+ *
+ *   blocking  one recvmsg() and one sendmsg() per request, as the servers always did
+ *   epoll     waits with epoll, drains up to EVENT_BATCH datagrams with recvmmsg()
+ *             and sends their responses with one sendmmsg()
+ *   uring     one io_uring per loop thread: a multishot recvmsg into a ring of
+ *             provided buffers, and a batch's sends submitted together in the
+ *             same io_uring_enter() that waits for the next requests
+ *
+ * uring falls back to epoll when the kernel can't provide it (no io_uring,
+ * io_uring disabled, or a kernel older than 6.0).
+ *
+ * Queued sends go out after the batch that queued them, before any later
+ * request is handled.  Memory a message's iov points at outside its own
+ * buffer has to last that long.  From any thread not running EventRun(), or
+ * to a socket other than its own, EventSend() sends at once.
+ */
+
+#define EVENT_BATCH       64       /* Datagrams handled between sends */
+#define EVENT_SEND_IOV    4        /* iovec entries in a message */
+#define EVENT_SEND_BUFFER (sizeof(ServerResponse_t))
+
+typedef enum EventEngine_t
+{
+    EVENT_BLOCKING = 0,
+    EVENT_EPOLL    = 1,
+    EVENT_URING    = 2
+}EventEngine_t;
+
+typedef struct EventMessage_t
+{
+    struct sockaddr_in addr;              /* Destination */
+    struct iovec iov[EVENT_SEND_IOV];     /* Datagram contents */
+    int iovCount;                         /* iov entries used */
+    char buffer[EVENT_SEND_BUFFER];       /* Bytes owned by the message, for iov to point at */
+    struct msghdr msg;                    /* Built by EventSend() */
+    size_t length;                        /* Bytes in the datagram, set by EventSend() */
+}EventMessage_t;
+
+/* One datagram of 'length' bytes, which may not be the size asked for */
+typedef void (*EventReceived_t)(int sockfd, void *datagram, ssize_t length, struct sockaddr_in *fromAddr, uint64_t queueDelay);
+
+extern const char *EventEngineNames[];
+
+/* Parse "blocking", "epoll" or "uring", -1 if unknown */
+int EventEngineFromName(const char *name, EventEngine_t *engine);
+
+/* sfl_io_* metrics, before MetricsStart() */
+void EventRegisterMetrics(void);
+
+/* Only returns if the engine can't be started */
+int EventRun(int sockfd, EventEngine_t engine, size_t datagramSize, EventReceived_t received);
+
+/* A message to fill in and pass to EventSend(), valid until then */
+EventMessage_t *EventMessage(void);
+int EventSend(int sockfd, EventMessage_t *message);
+
+/* Non-zero if EventSend() would hold the message until the end of the batch */
+int EventQueued(int sockfd, EventMessage_t *message);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPLEFILELOCK_EVENT_H */
@@ -0,0 +1,81 @@
+#include "SimpleFileLock_Storage.h"
+
+#include <stdio.h>      /* for fopen() and fgetc() */
+#include <stdlib.h>     /* for system() */
+
+/*
+ * Local files through stdio.  The FILE * is the handle and keeps the file
+ * position.  Changes are flushed and synced before the response goes out.
+ */
+
+static void FileSync(void)
+{
+    if(system("sync") != 0)
+    {
+        printError("sync failed%s", "");
+    }
+}
+
+static void *FileOpen(ParsedOperation_t *parsed)
+{
+    return fopen(parsed->filePath, parsed->mode);
+}
+
+static int FileClose(LockTableNode_t *lockNode)
+{
+    int status = fclose(lockNode->fileHandle);
+
+    FileSync();
+
+    return status;
+}
+
+static int FileRead(LockTableNode_t *lockNode, ParsedOperation_t *parsed, char *buffer)
+{
+    int bytesRead = 0;
+    int c = 0;
+
+    while((bytesRead < parsed->numBytes) && ((c = fgetc(lockNode->fileHandle)) != EOF))
+    {
+        buffer[bytesRead++] = c;
+    }
+
+    return bytesRead;
+}
+
+static int FileWrite(LockTableNode_t *lockNode, ParsedOperation_t *parsed)
+{
+    int status = ERROR;
+
+    if(fputs(parsed->messageString, lockNode->fileHandle) != EOF)
+    {
+        fflush(lockNode->fileHandle);
+        FileSync();
+        status = OK;
+    }
+
+    return status;
+}
+
+static int FileLseek(LockTableNode_t *lockNode, ParsedOperation_t *parsed)
+{
+    return fseek(lockNode->fileHandle, parsed->numBytes, SEEK_SET);
+}
+
+static long FileTell(LockTableNode_t *lockNode)
+{
+    return ftell(lockNode->fileHandle);
+}
+
+StorageBackend_t FileStorage =
+{
+    "file",
+    FileOpen,
+    FileClose,
+    FileRead,
+    FileWrite,
+    FileLseek,
+    FileTell,
+    NULL,
+    NULL
+};
@@ -0,0 +1,242 @@
+#include "SimpleFileLock_Incarnation.h"
+
+#include <stdio.h>      /* for fopen() and fscanf() */
+#include <stdlib.h>     /* for malloc() */
+#include <string.h>     /* for strcpy() */
+#include <unistd.h>     /* for close() and ftruncate() */
+#include <fcntl.h>      /* for open() and fcntl() */
+#include <pthread.h>    /* for pthread_mutex_lock() */
+#include <sys/mman.h>   /* for mmap() */
+
+#define INCARNATION_MAGIC 0x53464c49   /* "SFLI": the number has been seeded */
+
+/* Layout of INCARNATION_LOCKFILE<machine> */
+typedef struct IncarnationShared_t
+{
+    int magic;
+    int incarnation;
+}IncarnationShared_t;
+
+struct Incarnation_t
+{
+    char *fileName;                /* INCARNATION_FILE<machine> */
+    int lockFile;                  /* INCARNATION_LOCKFILE<machine>, mapped */
+    IncarnationShared_t *shared;
+};
+
+/* fcntl() locks are per process, this orders the threads within one */
+static pthread_mutex_t incarnationMutex = PTHREAD_MUTEX_INITIALIZER;
+
+static status_t LockIncarnation(Incarnation_t *incarnation, short type)
+{
+    struct flock lock;
+    status_t status = OK;
+
+    memset(&lock, 0, sizeof(lock));
+    lock.l_type = type;
+
+    if(type != F_UNLCK)
+    {
+        pthread_mutex_lock(&incarnationMutex);
+        do
+        {
+            status = fcntl(incarnation->lockFile, F_SETLKW, &lock);
+        }while((status == ERROR) && (errno == EINTR));
+
+        if(status != OK)
+        {
+            pthread_mutex_unlock(&incarnationMutex);
+        }
+    }
+    else
+    {
+        fcntl(incarnation->lockFile, F_SETLK, &lock);
+        pthread_mutex_unlock(&incarnationMutex);
+    }
+
+    return status;
+}
+
+/* Text copy from an older client, or 0 */
+static int ReadIncarnationFile(const char *fileName)
+{
+    FILE *incarnationFile_ptr = NULL;
+    int clientIncarnation = 0;
+
+    if((incarnationFile_ptr = fopen(fileName, "r")) != NULL)
+    {
+        if(fscanf(incarnationFile_ptr, "%d\n", &clientIncarnation) != 1)
+        {
+            printErrno("Error reading from  %s", fileName);
+            clientIncarnation = 0;
+        }
+        fclose(incarnationFile_ptr);
+    }
+
+    return clientIncarnation;
+}
+
+static status_t WriteIncarnationFile(const char *fileName, int clientIncarnation)
+{
+    FILE *incarnationFile_ptr = NULL;
+    status_t status = ERROR;
+
+    if((incarnationFile_ptr = fopen(fileName, "w")) == NULL)
+    {
+        printErrno("Can't open %s for writing", fileName);
+    }
+    else
+    {
+        if(fprintf(incarnationFile_ptr, "%d\n", clientIncarnation) < 0)
+        {
+            printErrno("Error writing to  %s", fileName);
+        }
+        else
+        {
+            status = OK;
+        }
+        fclose(incarnationFile_ptr);
+    }
+
+    return status;
+}
+
+Incarnation_t *IncarnationOpen(const char *machineName)
+{
+    Incarnation_t *incarnation = NULL;
+    char *incarnationLockfileName = NULL;
+    void *shared = MAP_FAILED;
+
+    /* Allocate strings to hold full paths to the lock file and to the file holding the incarnation number */
+    incarnationLockfileName = malloc(sizeof(char) * (strlen(INCARNATION_LOCKFILE) + strlen(machineName) + 1));
+    incarnation = calloc(1, sizeof(Incarnation_t));
+
+    if((incarnationLockfileName == NULL) || (incarnation == NULL) ||
+       ((incarnation->fileName = malloc(sizeof(char) * (strlen(INCARNATION_FILE) + strlen(machineName) + 1))) == NULL))
+    {
+        printErrno("Malloc failed%s", "");
+        free(incarnationLockfileName);
+        if(incarnation != NULL)
+        {
+            free(incarnation->fileName);
+            free(incarnation);
+        }
+        return NULL;
+    }
+
+    strcpy(incarnationLockfileName, INCARNATION_LOCKFILE);
+    strcat(incarnationLockfileName, machineName);
+    strcpy(incarnation->fileName, INCARNATION_FILE);
+    strcat(incarnation->fileName, machineName);
+
+    /* Get file handle for incarnation lock file */
+    if((incarnation->lockFile = open(incarnationLockfileName, O_CREAT | O_RDWR, 0644)) == -1)
+    {
+        printErrno("Can't open %s for reading", incarnationLockfileName);
+    }
+    else if(LockIncarnation(incarnation, F_WRLCK) != OK)
+    {
+        printErrno("Can't lock %s", incarnationLockfileName);
+        close(incarnation->lockFile);
+    }
+    else
+    {
+        /* Lock files from older clients are empty; growing one leaves magic 0 */
+        if((ftruncate(incarnation->lockFile, sizeof(IncarnationShared_t)) == ERROR) ||
+           ((shared = mmap(NULL, sizeof(IncarnationShared_t), PROT_READ | PROT_WRITE, MAP_SHARED, incarnation->lockFile, 0)) == MAP_FAILED))
+        {
+            printErrno("Can't map %s", incarnationLockfileName);
+        }
+        else
+        {
+            incarnation->shared = shared;
+
+            if(incarnation->shared->magic != INCARNATION_MAGIC)
+            {
+                __atomic_store_n(&incarnation->shared->incarnation, ReadIncarnationFile(incarnation->fileName), __ATOMIC_RELAXED);
+                WriteIncarnationFile(incarnation->fileName, incarnation->shared->incarnation);
+                __atomic_store_n(&incarnation->shared->magic, INCARNATION_MAGIC, __ATOMIC_RELEASE);
+            }
+        }
+
+        /* Release lock */
+        LockIncarnation(incarnation, F_UNLCK);
+
+        if(shared == MAP_FAILED)
+        {
+            close(incarnation->lockFile);
+        }
+    }
+
+    free(incarnationLockfileName);
+
+    if(incarnation->shared == NULL)
+    {
+        free(incarnation->fileName);
+        free(incarnation);
+        incarnation = NULL;
+    }
+
+    return incarnation;
+}
+
+void IncarnationClose(Incarnation_t *incarnation)
+{
+    munmap(incarnation->shared, sizeof(IncarnationShared_t));
+
+    /* Closing any descriptor of the file drops this process's fcntl() lock on it */
+    pthread_mutex_lock(&incarnationMutex);
+    close(incarnation->lockFile);
+    pthread_mutex_unlock(&incarnationMutex);
+
+    free(incarnation->fileName);
+    free(incarnation);
+}
+
+int IncarnationCurrent(Incarnation_t *incarnation)
+{
+    return __atomic_load_n(&incarnation->shared->incarnation, __ATOMIC_ACQUIRE);
+}
+
+status_t IncarnationIncrement(Incarnation_t *incarnation, int *clientIncarnation)
+{
+    status_t status = ERROR;
+
+    /* Held so the text copy is written in the order of the bumps */
+    if(LockIncarnation(incarnation, F_WRLCK) == OK)
+    {
+        *clientIncarnation = __atomic_add_fetch(&incarnation->shared->incarnation, 1, __ATOMIC_ACQ_REL);
+        status = WriteIncarnationFile(incarnation->fileName, *clientIncarnation);
+
+        LockIncarnation(incarnation, F_UNLCK);
+    }
+    else
+    {
+        printErrno("Can't lock incarnation of %s", incarnation->fileName);
+    }
+
+    return status;
+}
+
+status_t GetIncarnation(const char *machineName, bool increment, int *clientIncarnation)
+{
+    Incarnation_t *incarnation = NULL;
+    status_t status = ERROR;
+
+    if((incarnation = IncarnationOpen(machineName)) != NULL)
+    {
+        if(increment == true)
+        {
+            status = IncarnationIncrement(incarnation, clientIncarnation);
+        }
+        else
+        {
+            *clientIncarnation = IncarnationCurrent(incarnation);
+            status = OK;
+        }
+
+        IncarnationClose(incarnation);
+    }
+
+    return status;
+}
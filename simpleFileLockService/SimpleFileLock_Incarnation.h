@@ -0,0 +1,30 @@
+#ifndef SIMPLEFILELOCK_INCARNATION_H
+#define SIMPLEFILELOCK_INCARNATION_H
+
+#include "defns.h"
+
+/*
+ * Client incarnation numbers.
+ *
+ * Each client machine keeps its incarnation number in INCARNATION_LOCKFILE<machine>,
+ * which every client process on the machine maps shared: reading the number
+ * is a load from memory, and the 'fail' command bumps it atomically.  The
+ * fcntl() lock on that file only guards setting the mapping up and bumping.
+ * INCARNATION_FILE<machine> keeps a text copy, which also seeds the mapping
+ * the first time, so numbers carry on from older clients.
+ */
+
+typedef struct Incarnation_t Incarnation_t;
+
+/* Map a machine's incarnation number, 0 for a new machine */
+Incarnation_t *IncarnationOpen(const char *machineName);
+void IncarnationClose(Incarnation_t *incarnation);
+
+/* No syscalls; sees bumps from any process on the machine */
+int IncarnationCurrent(Incarnation_t *incarnation);
+status_t IncarnationIncrement(Incarnation_t *incarnation, int *clientIncarnation);
+
+/* One shot IncarnationOpen() and read or bump, for callers without a session */
+status_t GetIncarnation(const char *machineName, bool increment, int *clientIncarnation);
+
+#endif /* SIMPLEFILELOCK_INCARNATION_H */
@@ -0,0 +1,1215 @@
+#include "SimpleFileLock_Lib.h"
+#include "SimpleFileLock_Incarnation.h"
+#include "SimpleFileLock_Socket.h"
+
+#include <sys/socket.h> /* for socket(), sendto(), and recvfrom() */
+#include <stdlib.h>     /* for malloc() and free() */
+#include <string.h>     /* for memset() and strcpy() */
+#include <unistd.h>     /* for close(), getpid() and usleep() */
+#include <pthread.h>    /* for pthread_create() */
+
+#define SFL_MAX_STEPS 3            /* Requests behind one future: open, write, close for append */
+#define SFL_MAX_ENDPOINTS 8        /* Servers a session can fail over between */
+#define SFL_MAX_REDIRECTS 4        /* Redirects followed for one request before waiting a retransmit */
+
+#define READ_PREFIX "Read '"
+#define READ_SUFFIX "' from "
+
+struct SflFuture_t
+{
+    char operations[SFL_MAX_STEPS][MAX_CMD_LEN]; /* Sent in order */
+    int numOperations;
+    SflResult_t result;
+    bool done;
+    struct SflSession_t *session;  /* Queued on */
+    SflCallback_t callback;        /* Set by SflThen() */
+    void *arg;
+    struct SflFuture_t *next;      /* Session queue */
+};
+
+/* A delegation the session holds, only touched by its thread */
+typedef struct SflDelegation_t
+{
+    char fileName[MAX_CMD_LEN];
+    bool append;                   /* Every write goes to the end */
+    int position;                  /* Local file pointer, -1 where the server's last write left it */
+    int incarnation;               /* Granted to, a 'fail' since loses it */
+    bool recalled;                 /* Another client wants the file */
+    char payload[DELEGATION_PAYLOAD_MAX]; /* DelegatedWrite_t records not yet sent */
+    int payloadLength;
+    int lastRecord;                /* Offset in payload of the last record, -1 if none */
+    struct SflDelegation_t *next;
+}SflDelegation_t;
+
+struct SflSession_t
+{
+    ClientStruct_t client;         /* Socket, server address, numbering, incarnation */
+    struct sockaddr_in endpoints[SFL_MAX_ENDPOINTS]; /* Servers to try, in order */
+    int numEndpoints;
+    int endpoint;                  /* Index of the one in use */
+    struct sockaddr_un localServer; /* Server on this host, for a "unix:" address */
+    int localServerLength;         /* 0 over UDP */
+    uint64_t sessionId;            /* From the server in use, 0 for none */
+    int sessionIncarnation;        /* Incarnation the session was opened with */
+    char machineName[100];
+    Incarnation_t *incarnation;    /* Shared with the machine's other clients */
+    pthread_t thread;
+    pthread_mutex_t mutex;         /* Queue, futures and numbering */
+    pthread_cond_t queueCond;      /* Work queued or disconnecting */
+    pthread_cond_t doneCond;       /* A future finished */
+    SflFuture_t *head;
+    SflFuture_t *tail;
+    bool disconnecting;
+    bool delegate;                 /* Ask for delegations */
+    SflDelegation_t *delegations;
+};
+
+static void *SflSessionThread(void *arg);
+static void SflRun(SflSession_t *session, const char *operation, SflResult_t *result);
+static void SflSend(SflSession_t *session, const char *operation, const char *payload, int payloadLength, SflResult_t *result);
+static void SflOpenSession(SflSession_t *session, ClientRequest_t *request, SflResult_t *result);
+static int SflExchange(SflSession_t *session, const char *datagram, int datagramLength, ServerResponse_t *response, SflResult_t *result);
+static status_t SflLocal(SflSession_t *session, SflDelegation_t *delegation, const char *operation, SflResult_t *result);
+static status_t SflFlush(SflSession_t *session, SflDelegation_t *delegation, bool keep);
+static SflDelegation_t *SflDelegationFind(SflSession_t *session, const char *fileName, bool current);
+static void SflDelegationRemove(SflSession_t *session, SflDelegation_t *delegation);
+static void SflRecalls(SflSession_t *session);
+static void SflRecalled(SflSession_t *session, ServerResponse_t *recall);
+static status_t SflEndpoint(const char *text, int defaultPort, struct sockaddr_in *addr);
+static status_t SflRedirected(SflSession_t *session, ServerResponse_t *redirect);
+static void SflFailover(SflSession_t *session);
+static int SflLocalSocket(void);
+static SflFuture_t *SflQueue(SflSession_t *session, SflFuture_t *future);
+static SflFuture_t *SflFuture(int numOperations);
+static status_t SflFinish(SflFuture_t *future, SflResult_t *result);
+static status_t SflFinishRead(SflFuture_t *future, int numBytes, char *buffer, SflResult_t *result);
+
+static const char *modeNames[] = {"read", "write", "readwrite", "append"};
+
+SflSession_t *SflConnect(const char *serverIpAddress, int serverPortNumber, const char *machineName, int clientNumber)
+{
+    SflSession_t *session = NULL;
+    char endpoints[MAX_CMD_LEN];
+    char *endpoint = NULL;
+    char *savePtr = NULL;
+    struct timeval tv;
+
+    if(strlen(machineName) >= sizeof(session->machineName))
+    {
+        printError("Machine name too long: %s", machineName);
+        return NULL;
+    }
+
+    if(strlen(serverIpAddress) >= sizeof(endpoints))
+    {
+        printError("Server list too long: %s", serverIpAddress);
+        return NULL;
+    }
+
+    if((session = calloc(1, sizeof(SflSession_t))) == NULL)
+    {
+        printErrno("Malloc failed%s", "");
+        return NULL;
+    }
+
+    /* A server on this host: "unix:<path>", sent to directly rather than over UDP */
+    if(strncmp(serverIpAddress, LOCAL_PREFIX, strlen(LOCAL_PREFIX)) == 0)
+    {
+        if((session->localServerLength = SocketLocalAddress(serverIpAddress + strlen(LOCAL_PREFIX), &session->localServer)) < 0)
+        {
+            printError("Bad local server address: %s", serverIpAddress);
+            free(session);
+            return NULL;
+        }
+        session->numEndpoints = 1;
+    }
+
+    /* "ip[:port],ip[:port],...", port defaulting to serverPortNumber */
+    strcpy(endpoints, serverIpAddress);
+    for(endpoint = (session->localServerLength > 0) ? NULL : strtok_r(endpoints, ",", &savePtr); endpoint != NULL; endpoint = strtok_r(NULL, ",", &savePtr))
+    {
+        if(session->numEndpoints == SFL_MAX_ENDPOINTS)
+        {
+            printError("More than %d servers: %s", SFL_MAX_ENDPOINTS, serverIpAddress);
+            free(session);
+            return NULL;
+        }
+
+        if(SflEndpoint(endpoint, serverPortNumber, &session->endpoints[session->numEndpoints]) != OK)
+        {
+            printError("Bad server address: %s", endpoint);
+            free(session);
+            return NULL;
+        }
+        session->numEndpoints++;
+    }
+
+    if(session->numEndpoints == 0)
+    {
+        printError("No server address given%s", "");
+        free(session);
+        return NULL;
+    }
+
+    strcpy(session->machineName, machineName);
+    session->client.machineName = session->machineName;
+    session->client.clientNumber = clientNumber;
+    session->client.serverPortNumber = serverPortNumber;
+
+    /* Start with the first server */
+    session->client.serverAddr = session->endpoints[0];
+
+    /* Retransmit every CLIENT_RETRANSMIT_MS */
+    tv.tv_sec = 0;
+    tv.tv_usec = CLIENT_RETRANSMIT_MS * 1000;
+
+    if ((session->client.sockfd = (session->localServerLength > 0) ? SflLocalSocket() : socket(PF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0)
+    {
+        printErrno("Can't create socket%s", "");
+    }
+    else if (setsockopt(session->client.sockfd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) < 0)
+    {
+        printErrno("Can't set socket timeout%s", "");
+    }
+    else if ((session->incarnation = IncarnationOpen(session->machineName)) == NULL)
+    {
+        printError("Can't get incarnation number for %s", session->machineName);
+    }
+    else
+    {
+        session->client.clientIncarnation = IncarnationCurrent(session->incarnation);
+
+        pthread_mutex_init(&session->mutex, NULL);
+        pthread_cond_init(&session->queueCond, NULL);
+        pthread_cond_init(&session->doneCond, NULL);
+
+        if(pthread_create(&session->thread, NULL, SflSessionThread, session) == 0)
+        {
+            return session;
+        }
+        printErrno("Can't start session thread%s", "");
+        IncarnationClose(session->incarnation);
+    }
+
+    if(session->client.sockfd >= 0)
+    {
+        close(session->client.sockfd);
+    }
+    free(session);
+
+    return NULL;
+}
+
+void SflDisconnect(SflSession_t *session)
+{
+    pthread_mutex_lock(&session->mutex);
+    session->disconnecting = true;
+    pthread_cond_signal(&session->queueCond);
+    pthread_mutex_unlock(&session->mutex);
+
+    pthread_join(session->thread, NULL);
+
+    close(session->client.sockfd);
+    IncarnationClose(session->incarnation);
+    pthread_mutex_destroy(&session->mutex);
+    pthread_cond_destroy(&session->queueCond);
+    pthread_cond_destroy(&session->doneCond);
+    free(session);
+}
+
+void SflDelegate(SflSession_t *session, bool enable)
+{
+    pthread_mutex_lock(&session->mutex);
+    session->delegate = enable;
+    pthread_mutex_unlock(&session->mutex);
+}
+
+status_t SflFail(SflSession_t *session)
+{
+    status_t status = ERROR;
+
+    /* Requests already queued go out as the new incarnation */
+    pthread_mutex_lock(&session->mutex);
+    if(IncarnationIncrement(session->incarnation, &session->client.clientIncarnation) == OK)
+    {
+        session->client.requestNumber = 0;
+        status = OK;
+    }
+    pthread_mutex_unlock(&session->mutex);
+
+    return status;
+}
+
+status_t SflWait(SflFuture_t *future, SflResult_t *result)
+{
+    SflSession_t *session = future->session;
+    status_t status = ERROR;
+
+    pthread_mutex_lock(&session->mutex);
+    while(future->done == false)
+    {
+        pthread_cond_wait(&session->doneCond, &session->mutex);
+    }
+    pthread_mutex_unlock(&session->mutex);
+
+    status = future->result.returnValue;
+    if(result != NULL)
+    {
+        *result = future->result;
+    }
+    free(future);
+
+    return status;
+}
+
+void SflThen(SflFuture_t *future, SflCallback_t callback, void *arg)
+{
+    SflSession_t *session = future->session;
+    bool done = false;
+
+    pthread_mutex_lock(&session->mutex);
+    if((done = future->done) == false)
+    {
+        future->callback = callback;
+        future->arg = arg;
+    }
+    pthread_mutex_unlock(&session->mutex);
+
+    /* Otherwise the session thread calls it */
+    if(done == true)
+    {
+        callback(&future->result, arg);
+        free(future);
+    }
+}
+
+const char *SflReadData(const SflResult_t *result, int *length)
+{
+    const char *data = NULL;
+    const char *suffix = NULL;
+    const char *next = NULL;
+
+    *length = 0;
+
+    if((result->returnValue == OK) && (strncmp(result->returnString, READ_PREFIX, strlen(READ_PREFIX)) == 0))
+    {
+        data = result->returnString + strlen(READ_PREFIX);
+
+        /* The data can itself hold READ_SUFFIX, the path can't */
+        for(next = strstr(data, READ_SUFFIX); next != NULL; next = strstr(next + 1, READ_SUFFIX))
+        {
+            suffix = next;
+        }
+
+        if(suffix != NULL)
+        {
+            *length = suffix - data;
+        }
+        else
+        {
+            data = NULL;
+        }
+    }
+
+    return data;
+}
+
+SflFuture_t *SflExecuteAsync(SflSession_t *session, const char *operation)
+{
+    SflFuture_t *future = NULL;
+
+    if(strlen(operation) >= MAX_CMD_LEN)
+    {
+        printError("Operation too long: %s", operation);
+        errno = EINVAL;
+    }
+    else if((future = SflFuture(1)) != NULL)
+    {
+        strcpy(future->operations[0], operation);
+        future = SflQueue(session, future);
+    }
+
+    return future;
+}
+
+SflFuture_t *SflOpenAsync(SflSession_t *session, const char *fileName, SflMode_t mode)
+{
+    char operation[MAX_CMD_LEN];
+
+    snprintf(operation, sizeof(operation), "open %s %s", fileName, modeNames[mode]);
+
+    return SflExecuteAsync(session, operation);
+}
+
+SflFuture_t *SflCloseAsync(SflSession_t *session, const char *fileName)
+{
+    char operation[MAX_CMD_LEN];
+
+    snprintf(operation, sizeof(operation), "close %s", fileName);
+
+    return SflExecuteAsync(session, operation);
+}
+
+SflFuture_t *SflReadAsync(SflSession_t *session, const char *fileName, int numBytes)
+{
+    char operation[MAX_CMD_LEN];
+
+    snprintf(operation, sizeof(operation), "read %s %d", fileName, numBytes);
+
+    return SflExecuteAsync(session, operation);
+}
+
+SflFuture_t *SflWriteAsync(SflSession_t *session, const char *fileName, const char *text)
+{
+    char operation[MAX_CMD_LEN];
+    SflFuture_t *future = NULL;
+
+    /* The server takes the text between the quotes */
+    if((text[0] == '\0') || (strchr(text, '"') != NULL))
+    {
+        printError("Can't write empty or quoted text: %s", text);
+        errno = EINVAL;
+    }
+    else if(snprintf(operation, sizeof(operation), "write %s \"%s\"", fileName, text) >= (int)sizeof(operation))
+    {
+        printError("Write to %s too long", fileName);
+        errno = EINVAL;
+    }
+    else
+    {
+        future = SflExecuteAsync(session, operation);
+    }
+
+    return future;
+}
+
+SflFuture_t *SflReadAtAsync(SflSession_t *session, const char *fileName, int position, int numBytes)
+{
+    char operation[MAX_CMD_LEN];
+
+    snprintf(operation, sizeof(operation), "readat %s %d %d", fileName, position, numBytes);
+
+    return SflExecuteAsync(session, operation);
+}
+
+SflFuture_t *SflWriteAtAsync(SflSession_t *session, const char *fileName, int position, const char *text)
+{
+    char operation[MAX_CMD_LEN];
+    SflFuture_t *future = NULL;
+
+    if((text[0] == '\0') || (strchr(text, '"') != NULL))
+    {
+        printError("Can't write empty or quoted text: %s", text);
+        errno = EINVAL;
+    }
+    else if(snprintf(operation, sizeof(operation), "writeat %s %d \"%s\"", fileName, position, text) >= (int)sizeof(operation))
+    {
+        printError("Write to %s too long", fileName);
+        errno = EINVAL;
+    }
+    else
+    {
+        future = SflExecuteAsync(session, operation);
+    }
+
+    return future;
+}
+
+/* Read lock to write lock, or back, keeping the position */
+SflFuture_t *SflUpgradeAsync(SflSession_t *session, const char *fileName)
+{
+    char operation[MAX_CMD_LEN];
+
+    snprintf(operation, sizeof(operation), "upgrade %s", fileName);
+
+    return SflExecuteAsync(session, operation);
+}
+
+SflFuture_t *SflDowngradeAsync(SflSession_t *session, const char *fileName)
+{
+    char operation[MAX_CMD_LEN];
+
+    snprintf(operation, sizeof(operation), "downgrade %s", fileName);
+
+    return SflExecuteAsync(session, operation);
+}
+
+SflFuture_t *SflLseekAsync(SflSession_t *session, const char *fileName, int position)
+{
+    char operation[MAX_CMD_LEN];
+
+    snprintf(operation, sizeof(operation), "lseek %s %d", fileName, position);
+
+    return SflExecuteAsync(session, operation);
+}
+
+/* Open for append, write and close, as one future */
+SflFuture_t *SflAppendAsync(SflSession_t *session, const char *fileName, const char *text)
+{
+    SflFuture_t *future = NULL;
+
+    if((text[0] == '\0') || (strchr(text, '"') != NULL))
+    {
+        printError("Can't write empty or quoted text: %s", text);
+        errno = EINVAL;
+    }
+    else if((future = SflFuture(3)) != NULL)
+    {
+        if((snprintf(future->operations[0], MAX_CMD_LEN, "open %s %s", fileName, modeNames[SFL_APPEND]) >= MAX_CMD_LEN) ||
+           (snprintf(future->operations[1], MAX_CMD_LEN, "write %s \"%s\"", fileName, text) >= MAX_CMD_LEN) ||
+           (snprintf(future->operations[2], MAX_CMD_LEN, "close %s", fileName) >= MAX_CMD_LEN))
+        {
+            printError("Append to %s too long", fileName);
+            errno = EINVAL;
+            free(future);
+            future = NULL;
+        }
+        else
+        {
+            future = SflQueue(session, future);
+        }
+    }
+
+    return future;
+}
+
+status_t SflExecute(SflSession_t *session, const char *operation, SflResult_t *result)
+{
+    return SflFinish(SflExecuteAsync(session, operation), result);
+}
+
+status_t SflOpen(SflSession_t *session, const char *fileName, SflMode_t mode, SflResult_t *result)
+{
+    return SflFinish(SflOpenAsync(session, fileName, mode), result);
+}
+
+status_t SflClose(SflSession_t *session, const char *fileName, SflResult_t *result)
+{
+    return SflFinish(SflCloseAsync(session, fileName), result);
+}
+
+/* 'buffer' gets exactly numBytes on success */
+status_t SflRead(SflSession_t *session, const char *fileName, int numBytes, char *buffer, SflResult_t *result)
+{
+    return SflFinishRead(SflReadAsync(session, fileName, numBytes), numBytes, buffer, result);
+}
+
+status_t SflReadAt(SflSession_t *session, const char *fileName, int position, int numBytes, char *buffer, SflResult_t *result)
+{
+    return SflFinishRead(SflReadAtAsync(session, fileName, position, numBytes), numBytes, buffer, result);
+}
+
+static status_t SflFinishRead(SflFuture_t *future, int numBytes, char *buffer, SflResult_t *result)
+{
+    SflResult_t readResult;
+    const char *data = NULL;
+    int length = 0;
+    status_t status = ERROR;
+
+    if(((status = SflFinish(future, &readResult)) == OK) &&
+       ((data = SflReadData(&readResult, &length)) != NULL) &&
+       (length == numBytes))
+    {
+        memcpy(buffer, data, length);
+    }
+    else
+    {
+        status = ERROR;
+    }
+
+    if(result != NULL)
+    {
+        *result = readResult;
+    }
+
+    return status;
+}
+
+status_t SflWrite(SflSession_t *session, const char *fileName, const char *text, SflResult_t *result)
+{
+    return SflFinish(SflWriteAsync(session, fileName, text), result);
+}
+
+status_t SflWriteAt(SflSession_t *session, const char *fileName, int position, const char *text, SflResult_t *result)
+{
+    return SflFinish(SflWriteAtAsync(session, fileName, position, text), result);
+}
+
+status_t SflUpgrade(SflSession_t *session, const char *fileName, SflResult_t *result)
+{
+    return SflFinish(SflUpgradeAsync(session, fileName), result);
+}
+
+status_t SflDowngrade(SflSession_t *session, const char *fileName, SflResult_t *result)
+{
+    return SflFinish(SflDowngradeAsync(session, fileName), result);
+}
+
+status_t SflLseek(SflSession_t *session, const char *fileName, int position, SflResult_t *result)
+{
+    return SflFinish(SflLseekAsync(session, fileName, position), result);
+}
+
+status_t SflAppend(SflSession_t *session, const char *fileName, const char *text, SflResult_t *result)
+{
+    return SflFinish(SflAppendAsync(session, fileName, text), result);
+}
+
+/* Wait for a future from an Async call, which may have failed with NULL */
+static status_t SflFinish(SflFuture_t *future, SflResult_t *result)
+{
+    SflResult_t failed;
+    status_t status = ERROR;
+
+    if(future == NULL)
+    {
+        memset(&failed, 0, sizeof(failed));
+        failed.returnValue = ERROR;
+        snprintf(failed.returnString, sizeof(failed.returnString), "Request not sent: %s\n", strerror(errno));
+        if(result != NULL)
+        {
+            *result = failed;
+        }
+    }
+    else
+    {
+        status = SflWait(future, result);
+    }
+
+    return status;
+}
+
+static SflFuture_t *SflFuture(int numOperations)
+{
+    SflFuture_t *future = NULL;
+
+    if((future = calloc(1, sizeof(SflFuture_t))) != NULL)
+    {
+        future->numOperations = numOperations;
+    }
+    else
+    {
+        printErrno("Malloc failed%s", "");
+    }
+
+    return future;
+}
+
+static SflFuture_t *SflQueue(SflSession_t *session, SflFuture_t *future)
+{
+    future->session = session;
+
+    pthread_mutex_lock(&session->mutex);
+    if(session->tail != NULL)
+    {
+        session->tail->next = future;
+    }
+    else
+    {
+        session->head = future;
+    }
+    session->tail = future;
+    pthread_cond_signal(&session->queueCond);
+    pthread_mutex_unlock(&session->mutex);
+
+    return future;
+}
+
+static void *SflSessionThread(void *arg)
+{
+    SflSession_t *session = arg;
+    SflFuture_t *future = NULL;
+    SflResult_t result;
+
+    for (;;)
+    {
+        pthread_mutex_lock(&session->mutex);
+        while((session->head == NULL) && (session->disconnecting == false))
+        {
+            pthread_cond_wait(&session->queueCond, &session->mutex);
+        }
+        if((future = session->head) == NULL)
+        {
+            pthread_mutex_unlock(&session->mutex);
+            break;
+        }
+        session->head = future->next;
+        if(session->head == NULL)
+        {
+            session->tail = NULL;
+        }
+        pthread_mutex_unlock(&session->mutex);
+
+        /* An append stops at a failed open and closes after a failed write.
+         * Its result is the write's, unless the close fails after it. */
+        for(int i = 0; i < future->numOperations; i++)
+        {
+            SflRun(session, future->operations[i], &result);
+
+            if((i <= 1) || ((future->result.returnValue == OK) && (result.returnValue != OK)))
+            {
+                future->result = result;
+            }
+            if((i == 0) && (result.returnValue != OK))
+            {
+                break;
+            }
+        }
+
+        pthread_mutex_lock(&session->mutex);
+        future->done = true;
+        if(future->callback != NULL)
+        {
+            pthread_mutex_unlock(&session->mutex);
+            future->callback(&future->result, future->arg);
+            free(future);
+        }
+        else
+        {
+            pthread_cond_broadcast(&session->doneCond);
+            pthread_mutex_unlock(&session->mutex);
+        }
+    }
+
+    /* Files left open keep their locks, so their writes go back */
+    while(session->delegations != NULL)
+    {
+        SflFlush(session, session->delegations, false);
+        SflDelegationRemove(session, session->delegations);
+    }
+
+    return NULL;
+}
+
+/* Answer an operation from a delegation when possible, otherwise send it */
+static void SflRun(SflSession_t *session, const char *operation, SflResult_t *result)
+{
+    char tokens[MAX_CMD_LEN];
+    char delegated[MAX_CMD_LEN];
+    char *command = NULL;
+    char *fileName = NULL;
+    char *mode = NULL;
+    SflDelegation_t *delegation = NULL;
+    bool delegate = false;
+
+    strcpy(tokens, operation);
+    if((command = strtok(tokens, " \r\n")) != NULL)
+    {
+        fileName = strtok(NULL, " \r\n");
+    }
+
+    if((fileName != NULL) && ((delegation = SflDelegationFind(session, fileName, true)) != NULL))
+    {
+        SflRecalls(session);
+
+        if((delegation->recalled == false) && (SflLocal(session, delegation, operation, result) == OK))
+        {
+            return;
+        }
+
+        /* The cached writes go with the close, or back before anything else is sent */
+        if(strcmp(command, "close") == 0)
+        {
+            SflSend(session, operation, delegation->payload, delegation->payloadLength, result);
+            SflDelegationRemove(session, delegation);
+            return;
+        }
+
+        SflFlush(session, delegation, false);
+        SflDelegationRemove(session, delegation);
+    }
+
+    if((fileName != NULL) && (strcmp(command, "open") == 0) &&
+       ((mode = strtok(NULL, " \r\n")) != NULL) && (strtok(NULL, " \r\n") == NULL) &&
+       ((strcmp(mode, "write") == 0) || (strcmp(mode, "append") == 0)))
+    {
+        pthread_mutex_lock(&session->mutex);
+        delegate = session->delegate;
+        pthread_mutex_unlock(&session->mutex);
+
+        if((delegate == true) && (snprintf(delegated, sizeof(delegated), "open %s %s delegate", fileName, mode) < (int)sizeof(delegated)))
+        {
+            operation = delegated;
+        }
+        else
+        {
+            delegate = false;
+        }
+    }
+
+    SflSend(session, operation, NULL, 0, result);
+
+    if((delegate == true) && (result->returnValue == OK) &&
+       (strstr(result->returnString, " " DELEGATED_SUFFIX "\n") != NULL) &&
+       ((delegation = calloc(1, sizeof(SflDelegation_t))) != NULL))
+    {
+        strcpy(delegation->fileName, fileName);
+        delegation->append = (strcmp(mode, "append") == 0);
+        delegation->position = delegation->append ? -1 : 0;
+        delegation->incarnation = result->clientIncarnation;
+        delegation->lastRecord = -1;
+        delegation->next = session->delegations;
+        session->delegations = delegation;
+    }
+}
+
+/*
+ * Under a delegation the session holds a write lock, so writes and seeks are
+ * applied to the cache and a read or upgrade gets the error the server would give.
+ * ERROR leaves the operation for the server.
+ */
+static status_t SflLocal(SflSession_t *session, SflDelegation_t *delegation, const char *operation, SflResult_t *result)
+{
+    char tokens[MAX_CMD_LEN];
+    char *command = NULL;
+    char *argument = NULL;
+    DelegatedWrite_t write = {0, 0};
+    int length = 0;
+    int offset = -1;
+
+    strcpy(tokens, operation);
+    command = strtok(tokens, " \r\n");
+    strtok(NULL, " \r\n");
+
+    memset(result, 0, sizeof(*result));
+    /* Numbered as the last request sent, which the delegation's open at least was */
+    pthread_mutex_lock(&session->mutex);
+    result->requestNumber = session->client.requestNumber - 1;
+    pthread_mutex_unlock(&session->mutex);
+    result->clientIncarnation = delegation->incarnation;
+
+    if((strcmp(command, "write") == 0) ||
+       ((strcmp(command, "writeat") == 0) && (delegation->append == false) &&
+        ((argument = strtok(NULL, " \r\n")) != NULL) && ((offset = strtol(argument, NULL, 10)) >= 0)))
+    {
+        /* The text between the quotes, as the server takes it */
+        if((argument = strtok(NULL, "\"")) == NULL)
+        {
+            return ERROR;
+        }
+        length = strlen(argument);
+        if(offset < 0)
+        {
+            offset = delegation->position;
+        }
+
+        if((delegation->payloadLength + (int)sizeof(DelegatedWrite_t) + length > DELEGATION_PAYLOAD_MAX) &&
+           (SflFlush(session, delegation, true) != OK))
+        {
+            return ERROR;
+        }
+
+        /* Extend the last record when this write carries straight on from it */
+        if(delegation->lastRecord >= 0)
+        {
+            memcpy(&write, delegation->payload + delegation->lastRecord, sizeof(write));
+        }
+        if((delegation->lastRecord >= 0) &&
+           (delegation->append ? (write.offset == -1) : (write.offset + write.length == offset)))
+        {
+            write.length += length;
+            memcpy(delegation->payload + delegation->lastRecord, &write, sizeof(write));
+        }
+        else
+        {
+            write.offset = offset;
+            write.length = length;
+            delegation->lastRecord = delegation->payloadLength;
+            memcpy(delegation->payload + delegation->payloadLength, &write, sizeof(write));
+            delegation->payloadLength += sizeof(write);
+        }
+        memcpy(delegation->payload + delegation->payloadLength, argument, length);
+        delegation->payloadLength += length;
+        /* writeat leaves the position where it was */
+        if(strcmp(command, "write") == 0)
+        {
+            delegation->position = delegation->append ? -1 : (delegation->position + length);
+        }
+
+        result->returnValue = OK;
+        snprintf(result->returnString, sizeof(result->returnString), "Wrote '%s' to %s:%s\n", argument, session->machineName, delegation->fileName);
+    }
+    else if((strcmp(command, "lseek") == 0) && ((argument = strtok(NULL, " \r\n")) != NULL) && (strtol(argument, NULL, 10) > 0))
+    {
+        delegation->position = strtol(argument, NULL, 10);
+
+        result->returnValue = OK;
+        snprintf(result->returnString, sizeof(result->returnString), "Moved %s:%s file pointer to %d bytes from start\n", session->machineName, delegation->fileName, delegation->position);
+    }
+    else if(((strcmp(command, "read") == 0) && ((argument = strtok(NULL, " \r\n")) != NULL) && (strtol(argument, NULL, 10) > 0)) ||
+            ((strcmp(command, "readat") == 0) && ((argument = strtok(NULL, " \r\n")) != NULL) && (strtol(argument, NULL, 10) >= 0) &&
+             ((argument = strtok(NULL, " \r\n")) != NULL) && (strtol(argument, NULL, 10) > 0)) ||
+            (strcmp(command, "upgrade") == 0))
+    {
+        result->returnValue = ERROR;
+        snprintf(result->returnString, sizeof(result->returnString), "Invalid lock type for %s operation\n", command);
+    }
+    else
+    {
+        return ERROR;
+    }
+
+    return OK;
+}
+
+/* Send the cached writes; without 'keep' the delegation goes back and the server takes the position */
+static status_t SflFlush(SflSession_t *session, SflDelegation_t *delegation, bool keep)
+{
+    char operation[MAX_CMD_LEN];
+    SflResult_t result;
+
+    /* The name fitted in "open <file> <mode> delegate", so this does too */
+    if(snprintf(operation, sizeof(operation), "flush %s %d%s", delegation->fileName, (keep == true) ? -1 : delegation->position, (keep == true) ? " keep" : "") >= (int)sizeof(operation))
+    {
+        return ERROR;
+    }
+
+    SflSend(session, operation, delegation->payload, delegation->payloadLength, &result);
+
+    if(result.returnValue != OK)
+    {
+        printError("Can't flush %s: %s", delegation->fileName, result.returnString);
+        return ERROR;
+    }
+
+    delegation->payloadLength = 0;
+    delegation->lastRecord = -1;
+
+    return OK;
+}
+
+/* With 'current', a delegation granted before a 'fail' is dropped: the server let its lock go */
+static SflDelegation_t *SflDelegationFind(SflSession_t *session, const char *fileName, bool current)
+{
+    SflDelegation_t *delegation = NULL;
+
+    for(delegation = session->delegations; delegation != NULL; delegation = delegation->next)
+    {
+        if(strcmp(delegation->fileName, fileName) == 0)
+        {
+            break;
+        }
+    }
+
+    if((delegation != NULL) && (current == true) && (delegation->incarnation != IncarnationCurrent(session->incarnation)))
+    {
+        SflDelegationRemove(session, delegation);
+        delegation = NULL;
+    }
+
+    return delegation;
+}
+
+static void SflDelegationRemove(SflSession_t *session, SflDelegation_t *delegation)
+{
+    SflDelegation_t **link = &session->delegations;
+
+    while(*link != delegation)
+    {
+        link = &(*link)->next;
+    }
+    *link = delegation->next;
+    free(delegation);
+}
+
+/* Recalls that came in while the session was idle */
+static void SflRecalls(SflSession_t *session)
+{
+    ServerResponse_t response;
+
+    while(recv(session->client.sockfd, &response, sizeof(ServerResponse_t), MSG_DONTWAIT) == sizeof(ServerResponse_t))
+    {
+        if(response.returnValue == DELEGATION_RECALL)
+        {
+            SflRecalled(session, &response);
+        }
+    }
+}
+
+static void SflRecalled(SflSession_t *session, ServerResponse_t *recall)
+{
+    SflDelegation_t *delegation = NULL;
+
+    recall->returnString[sizeof(recall->returnString) - 1] = '\0';
+    recall->returnString[strcspn(recall->returnString, "\n")] = '\0';
+
+    if((delegation = SflDelegationFind(session, recall->returnString, false)) != NULL)
+    {
+        printDebug("%s:%d - Delegation of %s recalled\n", session->machineName, session->client.clientNumber, delegation->fileName);
+        delegation->recalled = true;
+    }
+}
+
+/* Send until the server answers, as the script client always has */
+static void SflSend(SflSession_t *session, const char *operation, const char *payload, int payloadLength, SflResult_t *result)
+{
+    char datagram[sizeof(ClientRequest_t) + DELEGATION_PAYLOAD_MAX];
+    ClientRequest_t request;
+    SessionRequest_t sessionRequest;
+    ServerResponse_t response;
+    int headerLength = 0;
+    int bytesReceived = ERROR;
+
+    memset(&request, 0, sizeof(request));
+    memset(&sessionRequest, 0, sizeof(sessionRequest));
+    memset(result, 0, sizeof(*result));
+
+    pthread_mutex_lock(&session->mutex);
+
+    /* Another client process on this machine may have failed since the last request */
+    session->client.clientIncarnation = IncarnationCurrent(session->incarnation);
+
+    request.clientNumber = session->client.clientNumber;
+    request.requestNumber = session->client.requestNumber++;
+    request.clientIncarnation = session->client.clientIncarnation;
+    strcpy(request.operation, operation);
+    strcpy(request.machineName, session->machineName);
+    pthread_mutex_unlock(&session->mutex);
+
+    printDebug("%s:%d.%d_%d - Sent %.*s\n", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber, (int)strcspn(request.operation, "\n"), request.operation);
+
+    result->requestNumber = request.requestNumber;
+    result->clientIncarnation = request.clientIncarnation;
+
+    sessionRequest.magic = SESSION_MAGIC;
+    sessionRequest.requestNumber = request.requestNumber;
+    strcpy(sessionRequest.operation, operation);
+
+    do
+    {
+        /* A new incarnation is a new session, and the old one's locks go with it */
+        if((session->sessionId == 0) || (session->sessionIncarnation != request.clientIncarnation))
+        {
+            SflOpenSession(session, &request, result);
+        }
+
+        /* Only the session id once there is one, else the whole client identity */
+        if(session->sessionId != 0)
+        {
+            sessionRequest.sessionId = session->sessionId;
+            memcpy(datagram, &sessionRequest, sizeof(SessionRequest_t));
+            headerLength = sizeof(SessionRequest_t);
+        }
+        else
+        {
+            memcpy(datagram, &request, sizeof(ClientRequest_t));
+            headerLength = sizeof(ClientRequest_t);
+        }
+
+        /* Delegated writes follow the request in the same datagram */
+        if(payloadLength > 0)
+        {
+            memcpy(datagram + headerLength, payload, payloadLength);
+        }
+
+        bytesReceived = SflExchange(session, datagram, headerLength + payloadLength, &response, result);
+
+        /* The server restarted, evicted the client or isn't the one that opened it */
+        if((bytesReceived == sizeof(ServerResponse_t)) && (response.returnValue == SESSION_UNKNOWN) && (headerLength == sizeof(SessionRequest_t)))
+        {
+            printDebug("%s:%d - Session %llu unknown to the server\n", session->machineName, session->client.clientNumber, (unsigned long long)session->sessionId);
+            session->sessionId = 0;
+            bytesReceived = ERROR;
+        }
+    }while(bytesReceived == ERROR);
+
+    if (bytesReceived == sizeof(ServerResponse_t))
+    {
+        result->returnValue = response.returnValue;
+        memcpy(result->returnString, response.returnString, sizeof(result->returnString));
+        result->returnString[sizeof(result->returnString) - 1] = '\0';
+    }
+    else
+    {
+        result->returnValue = ERROR;
+        snprintf(result->returnString, sizeof(result->returnString), "Response of %d bytes instead of %d\n", bytesReceived, (int)sizeof(ServerResponse_t));
+    }
+}
+
+/* The handshake carries the last request number, so a client entry it
+ * creates takes the next one as new.  Without an id the request goes in
+ * full, which any server accepts. */
+static void SflOpenSession(SflSession_t *session, ClientRequest_t *request, SflResult_t *result)
+{
+    ClientRequest_t handshake = *request;
+    ServerResponse_t response;
+    unsigned long long sessionId = 0;
+
+    handshake.requestNumber = request->requestNumber - 1;
+    strcpy(handshake.operation, SESSION_OPERATION);
+
+    session->sessionId = 0;
+    if((SflExchange(session, (const char *)&handshake, sizeof(handshake), &response, result) == sizeof(ServerResponse_t)) &&
+       (response.returnValue == OK) && (sscanf(response.returnString, "Session %llu", &sessionId) == 1))
+    {
+        printDebug("%s:%d.%d - Session %llu\n", session->machineName, session->client.clientNumber, request->clientIncarnation, sessionId);
+        session->sessionId = sessionId;
+        session->sessionIncarnation = request->clientIncarnation;
+    }
+}
+
+/* Send 'datagram' until a response other than a recall arrives, following
+ * redirects and failing over on the way */
+static int SflExchange(SflSession_t *session, const char *datagram, int datagramLength, ServerResponse_t *response, SflResult_t *result)
+{
+    int bytesReceived = ERROR;
+    int timeouts = 0;
+    int redirects = 0;
+
+    do
+    {
+        if (((session->localServerLength > 0) &&
+             (sendto(session->client.sockfd, datagram, datagramLength, 0, (struct sockaddr *) &(session->localServer), session->localServerLength) == datagramLength)) ||
+            ((session->localServerLength == 0) &&
+             (sendto(session->client.sockfd, datagram, datagramLength, 0, (struct sockaddr *) &(session->client.serverAddr), sizeof(session->client.serverAddr)) == datagramLength)))
+        {
+            /* A recall can come in ahead of the response */
+            while(((bytesReceived = recv(session->client.sockfd, response, sizeof(ServerResponse_t), 0)) == sizeof(ServerResponse_t)) &&
+                  (response->returnValue == DELEGATION_RECALL))
+            {
+                SflRecalled(session, response);
+            }
+        }
+        else
+        {
+            printErrno("Didn't send expected number of bytes%s", "");
+        }
+
+        /* Not the active server: it names the one to ask, so resend there at once */
+        if((bytesReceived == sizeof(ServerResponse_t)) && (response->returnValue == SERVER_REDIRECT))
+        {
+            bytesReceived = ERROR;
+            if((++redirects <= SFL_MAX_REDIRECTS) && (SflRedirected(session, response) == OK))
+            {
+                timeouts = 0;
+                result->retransmits++;
+                continue;
+            }
+
+            /* Servers still settling who is active */
+            redirects = 0;
+            usleep(CLIENT_RETRANSMIT_MS * 1000);
+        }
+
+        if(bytesReceived == ERROR)
+        {
+            printDebug("%s:%d.%d_%d - Request timed out\n", session->machineName, session->client.clientNumber, result->clientIncarnation, result->requestNumber);
+            result->retransmits++;
+
+            if((++timeouts == CLIENT_FAILOVER_RETRANSMITS) && (session->numEndpoints > 1))
+            {
+                SflFailover(session);
+                timeouts = 0;
+            }
+        }
+    }while(bytesReceived == ERROR);
+
+    return bytesReceived;
+}
+
+/* "ip" or "ip:port" */
+static status_t SflEndpoint(const char *text, int defaultPort, struct sockaddr_in *addr)
+{
+    char ipAddress[INET_ADDRSTRLEN];
+    const char *colon = strchr(text, ':');
+    size_t length = (colon != NULL) ? (size_t)(colon - text) : strlen(text);
+    int port = defaultPort;
+
+    if((length >= sizeof(ipAddress)) || ((colon != NULL) && (sscanf(colon + 1, "%d", &port) != 1)) || (port <= 0) || (port > 65535))
+    {
+        return ERROR;
+    }
+
+    memcpy(ipAddress, text, length);
+    ipAddress[length] = '\0';
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_port = htons(port);
+
+    return (inet_pton(AF_INET, ipAddress, &addr->sin_addr) == 1) ? OK : ERROR;
+}
+
+/* Switch to the server a redirect names, which needn't be in the list */
+static status_t SflRedirected(SflSession_t *session, ServerResponse_t *redirect)
+{
+    struct sockaddr_in addr;
+    int i;
+
+    redirect->returnString[sizeof(redirect->returnString) - 1] = '\0';
+    redirect->returnString[strcspn(redirect->returnString, "\n")] = '\0';
+
+    if(session->localServerLength > 0)
+    {
+        printError("Can't follow a redirect to %s from a local server", redirect->returnString);
+        return ERROR;
+    }
+
+    if(SflEndpoint(redirect->returnString, session->client.serverPortNumber, &addr) != OK)
+    {
+        printError("Bad redirect: %s", redirect->returnString);
+        return ERROR;
+    }
+
+    for(i = 0; i < session->numEndpoints; i++)
+    {
+        if((session->endpoints[i].sin_addr.s_addr == addr.sin_addr.s_addr) && (session->endpoints[i].sin_port == addr.sin_port))
+        {
+            session->endpoint = i;
+        }
+    }
+
+    printDebug("%s:%d - Redirected to %s", session->machineName, session->client.clientNumber, redirect->returnString);
+    session->client.serverAddr = addr;
+    session->sessionId = 0;
+
+    return OK;
+}
+
+/* The server in use stopped answering: try the next one in the list */
+static void SflFailover(SflSession_t *session)
+{
+    char ipAddress[INET_ADDRSTRLEN];
+
+    session->endpoint = (session->endpoint + 1) % session->numEndpoints;
+    session->client.serverAddr = session->endpoints[session->endpoint];
+    session->sessionId = 0;
+
+    inet_ntop(AF_INET, &session->client.serverAddr.sin_addr, ipAddress, sizeof(ipAddress));
+    printInfo("%s:%d - No response in %d retransmits, failing over to %s:%d", session->machineName, session->client.clientNumber,
+              CLIENT_FAILOVER_RETRANSMITS, ipAddress, ntohs(session->client.serverAddr.sin_port));
+}
+
+/* Bound to an abstract name of exactly LOCAL_ADDR_LEN bytes, which the server
+ * keeps in a struct sockaddr_in */
+static int SflLocalSocket(void)
+{
+    static unsigned int sockets;
+    struct sockaddr_un addr;
+    int sockfd = -1;
+    int attempts = 0;
+
+    if((sockfd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+    {
+        return ERROR;
+    }
+
+    do
+    {
+        unsigned long long name = ((unsigned long long)(getpid() & 0xffffff) << 16) | (__atomic_fetch_add(&sockets, 1, __ATOMIC_RELAXED) & 0xffff);
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        snprintf(addr.sun_path + 1, sizeof(addr.sun_path) - 1, "sfl%010llx", name);
+
+        if(bind(sockfd, (struct sockaddr *)&addr, LOCAL_ADDR_LEN) == 0)
+        {
+            return sockfd;
+        }
+    }while((errno == EADDRINUSE) && (++attempts < 16));
+
+    printErrno("Can't bind local socket%s", "");
+    close(sockfd);
+
+    return ERROR;
+}
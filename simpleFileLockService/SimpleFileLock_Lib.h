@@ -0,0 +1,119 @@
+#ifndef SIMPLEFILELOCK_LIB_H
+#define SIMPLEFILELOCK_LIB_H
+
+#include "defns.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Client library (libsfl).
+ *
+ * A session is one client of the service: a machine name and client number,
+ * one socket, its request numbering and its machine's incarnation.  The
+ * server only answers a client's latest request, so a session sends one
+ * request at a time.  Each session has a thread that does this, taking
+ * requests in the order they were made and retransmitting every
+ * CLIENT_RETRANSMIT_MS until the response arrives.
+ *
+ * Every operation has an asynchronous form (the Async suffix), which queues
+ * the request and returns a future.  SflWait() blocks on a future, or
+ * SflThen() hands its result to a callback.  Either one consumes the future.
+ * The blocking forms are the Async call followed by SflWait().
+ *
+ * SflExecute() sends a command in the server's text form, e.g. from a
+ * script.  The calls that return status_t give OK only when the server
+ * returned OK.  With a non-NULL 'result' they also copy out the server's
+ * response.
+ *
+ * After SflDelegate(), opens for write or append ask the server for a
+ * delegation.  While the session holds one, writes and seeks on the file are
+ * answered locally and their data goes to the server in bulk with the close,
+ * so an open, N writes and a close take two round trips.  If another client
+ * opens the file the server recalls the delegation; the session writes back
+ * at its next operation and sends the file's operations from then on.
+ *
+ * SflReadAt() and SflWriteAt() name their position and leave the file's
+ * own alone, so retrying one reads or writes the same bytes.
+ *
+ * SflConnect() takes one server address or a list, "ip[:port],ip[:port]",
+ * with serverPortNumber for any port left out.  After
+ * CLIENT_FAILOVER_RETRANSMITS unanswered sends the session moves on to the
+ * next server, and a server that isn't the active one redirects it there.
+ * "unix:<path>" instead reaches a server on this host over its Unix socket.
+ *
+ * A session opens a server session before its first request and then sends
+ * only the session id, opening a new one after SflFail() or when the server
+ * doesn't know the id.
+ */
+
+#define SFL_MAX_STRING 1024        /* Longest server message */
+
+typedef struct SflSession_t SflSession_t;
+typedef struct SflFuture_t SflFuture_t;
+
+typedef enum SflMode_t
+{
+    SFL_READ      = 0,             /* Read lock, from the start */
+    SFL_WRITE     = 1,             /* Write lock, truncated */
+    SFL_READWRITE = 2,             /* Read and write lock, from the start */
+    SFL_APPEND    = 3              /* Write lock, every write goes to the end */
+}SflMode_t;
+
+typedef struct SflResult_t
+{
+    int returnValue;                     /* The server's, ERROR if the request wasn't sent */
+    char returnString[SFL_MAX_STRING];   /* The server's message, or why it wasn't sent */
+    int requestNumber;                   /* Request number used, the last one sent if answered under a delegation */
+    int clientIncarnation;               /* Incarnation it was sent with */
+    int retransmits;                     /* Sends after the first */
+}SflResult_t;
+
+/* Runs on the session's thread, or on the caller's if the result is already in */
+typedef void (*SflCallback_t)(const SflResult_t *result, void *arg);
+
+/* Sessions */
+SflSession_t *SflConnect(const char *serverIpAddress, int serverPortNumber, const char *machineName, int clientNumber);
+void SflDisconnect(SflSession_t *session);     /* Waits for queued requests */
+status_t SflFail(SflSession_t *session);       /* Simulate a crash: new incarnation, requests from 0 */
+void SflDelegate(SflSession_t *session, bool enable);
+
+/* Futures */
+status_t SflWait(SflFuture_t *future, SflResult_t *result);
+void SflThen(SflFuture_t *future, SflCallback_t callback, void *arg);
+
+/* Data of a successful read, within result->returnString */
+const char *SflReadData(const SflResult_t *result, int *length);
+
+/* Asynchronous, NULL if the request can't be queued */
+SflFuture_t *SflExecuteAsync(SflSession_t *session, const char *operation);
+SflFuture_t *SflOpenAsync(SflSession_t *session, const char *fileName, SflMode_t mode);
+SflFuture_t *SflCloseAsync(SflSession_t *session, const char *fileName);
+SflFuture_t *SflReadAsync(SflSession_t *session, const char *fileName, int numBytes);
+SflFuture_t *SflWriteAsync(SflSession_t *session, const char *fileName, const char *text);
+SflFuture_t *SflLseekAsync(SflSession_t *session, const char *fileName, int position);
+SflFuture_t *SflReadAtAsync(SflSession_t *session, const char *fileName, int position, int numBytes);
+SflFuture_t *SflWriteAtAsync(SflSession_t *session, const char *fileName, int position, const char *text);
+SflFuture_t *SflUpgradeAsync(SflSession_t *session, const char *fileName);
+SflFuture_t *SflDowngradeAsync(SflSession_t *session, const char *fileName);
+SflFuture_t *SflAppendAsync(SflSession_t *session, const char *fileName, const char *text);
+
+/* Blocking */
+status_t SflExecute(SflSession_t *session, const char *operation, SflResult_t *result);
+status_t SflOpen(SflSession_t *session, const char *fileName, SflMode_t mode, SflResult_t *result);
+status_t SflClose(SflSession_t *session, const char *fileName, SflResult_t *result);
+status_t SflRead(SflSession_t *session, const char *fileName, int numBytes, char *buffer, SflResult_t *result);
+status_t SflWrite(SflSession_t *session, const char *fileName, const char *text, SflResult_t *result);
+status_t SflLseek(SflSession_t *session, const char *fileName, int position, SflResult_t *result);
+status_t SflReadAt(SflSession_t *session, const char *fileName, int position, int numBytes, char *buffer, SflResult_t *result);
+status_t SflWriteAt(SflSession_t *session, const char *fileName, int position, const char *text, SflResult_t *result);
+status_t SflUpgrade(SflSession_t *session, const char *fileName, SflResult_t *result);
+status_t SflDowngrade(SflSession_t *session, const char *fileName, SflResult_t *result);
+status_t SflAppend(SflSession_t *session, const char *fileName, const char *text, SflResult_t *result);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPLEFILELOCK_LIB_H */
@@ -0,0 +1,847 @@
+/*
+ * Load generator.
+ *
+ * Runs thousands of virtual clients, one (machineName, clientNumber) session
+ * each, from a single process.  Every session has its own UDP socket and
+ * speaks the same protocol as SimpleFileLock_Client: requests carry the
+ * machine's incarnation number (bumped once at start up, as for a restarted
+ * client, so locks left behind by an earlier run are released) and an
+ * increasing request number, and are retransmitted every CLIENT_RETRANSMIT_MS
+ * until a response arrives.  All sockets are driven from one epoll loop.
+ *
+ * Operations are drawn from a weighted open/read/write/lseek/close mix.  A
+ * session holds at most one file; an operation the session can't issue in its
+ * current state becomes the close or open that gets it there, so the per-op
+ * counts in the report are the mix actually achieved.  Files are picked with
+ * Zipf popularity, and a session reads only what it knows has been written.
+ *
+ * Closed loop (the default): each session issues its next operation after an
+ * exponentially distributed think time.  Open loop (--rate): operations start
+ * at a fixed aggregate rate on whichever session is idle, and latency is taken
+ * from the time the operation was due, not from when a session was free to
+ * send it, so a slow server can't hide its queueing (coordinated omission).
+ *
+ * Results are printed as one tab separated row per operation:
+ *
+ *   op  ops  errors  retransmits  mean_ns  p50_ns  p90_ns  p99_ns  p999_ns  max_ns
+ */
+
+#include <sys/socket.h>   /* for socket(), connect(), send() and recv() */
+#include <sys/epoll.h>    /* for epoll_create1() and epoll_wait() */
+#include <sys/resource.h> /* for setrlimit() */
+#include <arpa/inet.h>    /* for sockaddr_in and inet_addr() */
+#include <stdlib.h>       /* for strtol() and calloc() */
+#include <string.h>       /* for memset() */
+#include <unistd.h>       /* for close() */
+#include <fcntl.h>        /* for O_NONBLOCK */
+#include <getopt.h>       /* for getopt_long() */
+#include <math.h>         /* for pow() and log() */
+#include <time.h>         /* for clock_gettime() */
+
+#include "defns.h"
+#include "SimpleFileLock_Incarnation.h"
+#include "SimpleFileLock_Metrics.h"
+
+#define LOAD_MAX_BYTES       128     /* Largest read/write, so a write fits in 'operation' */
+#define LOAD_MAX_MACHINES    1000
+#define LOAD_EPOLL_EVENTS    256
+
+typedef enum LoadOp_t
+{
+    LOAD_OP_OPEN    = 0,
+    LOAD_OP_READ    = 1,
+    LOAD_OP_WRITE   = 2,
+    LOAD_OP_LSEEK   = 3,
+    LOAD_OP_CLOSE   = 4,
+    LOAD_NUM_OPS    = 5
+}LoadOp_t;
+
+static const char *loadOpNames[LOAD_NUM_OPS] = {"open", "read", "write", "lseek", "close"};
+
+typedef struct LoadSession_t
+{
+    int sockfd;                    /* Connected UDP socket */
+    int machine;                   /* Index into machineNames */
+    int clientNumber;
+    int requestNumber;
+    int file;                      /* Open file, or -1 */
+    LockType_t mode;               /* READ_LOCK or WRITE_LOCK while a file is open */
+    int offset;                    /* Server side file position */
+    bool inFlight;                 /* Waiting for a response */
+    LoadOp_t op;                   /* Operation in flight */
+    int numBytes;                  /* Its read/write length or lseek target */
+    uint64_t dueTime;              /* When the operation was due (ns) */
+    uint64_t timerGeneration;      /* Invalidates older timer heap entries */
+    ClientRequest_t request;       /* Kept for retransmits */
+}LoadSession_t;
+
+typedef struct LoadTimer_t
+{
+    uint64_t when;                 /* Monotonic ns */
+    uint64_t generation;           /* Session's timerGeneration when armed */
+    int session;
+}LoadTimer_t;
+
+typedef struct LoadStats_t
+{
+    Histogram_t histogram;         /* Latency (ns) of completed operations */
+    uint64_t errors;               /* Completed with returnValue != OK */
+    uint64_t retransmits;
+}LoadStats_t;
+
+/* Settings */
+static int numSessions = 1000;
+static int numMachines = 100;
+static int numFiles = 100;
+static double zipfExponent = 0.99;
+static int mixWeights[LOAD_NUM_OPS] = {10, 40, 30, 10, 10};
+static double thinkTime = 0;       /* Mean, ns; closed loop only */
+static double arrivalRate = 0;     /* Operations/s; 0 for closed loop */
+static int duration = 10;          /* Seconds measured */
+static int warmup = 0;             /* Seconds run before measuring */
+static int numBytes = 32;
+static char *namePrefix = "load";
+
+static LoadSession_t *sessions;
+static char (*machineNames)[100];
+static int *machineIncarnations;
+static int *fileSizes;             /* Per machine and file: bytes the server holds */
+static double *zipfCdf;
+static LoadStats_t stats[LOAD_NUM_OPS];
+static Histogram_t allHistogram;
+static uint64_t measureStart;
+static uint64_t rngState = 88172645463325252ULL;
+
+/* Timer min-heap; cancelled timers stay in it until they fire */
+static LoadTimer_t *timers;
+static int numTimers;
+static int maxTimers;
+
+/* Idle sessions, open loop only */
+static int *idleSessions;
+static int numIdle;
+
+static uint64_t Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static uint64_t Random(void)
+{
+    rngState ^= rngState << 13;
+    rngState ^= rngState >> 7;
+    rngState ^= rngState << 17;
+
+    return rngState;
+}
+
+/* Uniform in [0, 1) */
+static double RandomDouble(void)
+{
+    return (Random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+static int ZipfFile(void)
+{
+    double u = RandomDouble();
+    int low = 0;
+    int high = numFiles - 1;
+
+    while(low < high)
+    {
+        int middle = (low + high) / 2;
+
+        if(zipfCdf[middle] < u)
+        {
+            low = middle + 1;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return low;
+}
+
+static status_t BuildZipf(void)
+{
+    double total = 0;
+
+    if((zipfCdf = malloc(sizeof(double) * numFiles)) == NULL)
+    {
+        printErrno("Malloc failed%s", "");
+        return ERROR;
+    }
+
+    for(int i = 0; i < numFiles; i++)
+    {
+        total += 1.0 / pow(i + 1, zipfExponent);
+        zipfCdf[i] = total;
+    }
+    for(int i = 0; i < numFiles; i++)
+    {
+        zipfCdf[i] /= total;
+    }
+
+    return OK;
+}
+
+static void TimerPush(int session, uint64_t when)
+{
+    LoadTimer_t timer = {when, sessions[session].timerGeneration, session};
+    int i = numTimers++;
+
+    if(numTimers > maxTimers)
+    {
+        maxTimers = (maxTimers == 0) ? 1024 : maxTimers * 2;
+        if((timers = realloc(timers, sizeof(LoadTimer_t) * maxTimers)) == NULL)
+        {
+            printErrno("Malloc failed%s", "");
+            exit(ERROR);
+        }
+    }
+
+    while((i > 0) && (timers[(i - 1) / 2].when > when))
+    {
+        timers[i] = timers[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    timers[i] = timer;
+}
+
+static LoadTimer_t TimerPop(void)
+{
+    LoadTimer_t top = timers[0];
+    LoadTimer_t last = timers[--numTimers];
+    int i = 0;
+
+    for(;;)
+    {
+        int child = 2 * i + 1;
+
+        if(child >= numTimers)
+        {
+            break;
+        }
+        if((child + 1 < numTimers) && (timers[child + 1].when < timers[child].when))
+        {
+            child++;
+        }
+        if(timers[child].when >= last.when)
+        {
+            break;
+        }
+        timers[i] = timers[child];
+        i = child;
+    }
+    if(numTimers > 0)
+    {
+        timers[i] = last;
+    }
+
+    return top;
+}
+
+static void TimerArm(int session, uint64_t when)
+{
+    sessions[session].timerGeneration++;
+    TimerPush(session, when);
+}
+
+static int *FileSize(LoadSession_t *session, int file)
+{
+    return &fileSizes[session->machine * numFiles + file];
+}
+
+/* Draw from the mix and turn it into something this session can issue */
+static LoadOp_t ChooseOp(LoadSession_t *session, LockType_t *openMode)
+{
+    int total = 0;
+    int pick = 0;
+    LoadOp_t op = LOAD_OP_OPEN;
+
+    for(int i = 0; i < LOAD_NUM_OPS; i++)
+    {
+        total += mixWeights[i];
+    }
+    pick = Random() % total;
+    while(pick >= mixWeights[op])
+    {
+        pick -= mixWeights[op];
+        op++;
+    }
+
+    if(session->file < 0)
+    {
+        /* Open in the mode the drawn operation needs, else in proportion to the mix */
+        if(op == LOAD_OP_READ)
+        {
+            *openMode = READ_LOCK;
+        }
+        else if(op == LOAD_OP_WRITE)
+        {
+            *openMode = WRITE_LOCK;
+        }
+        else
+        {
+            int readWrite = mixWeights[LOAD_OP_READ] + mixWeights[LOAD_OP_WRITE];
+
+            *openMode = ((readWrite != 0) && ((int)(Random() % readWrite) < mixWeights[LOAD_OP_READ])) ? READ_LOCK : WRITE_LOCK;
+        }
+        return LOAD_OP_OPEN;
+    }
+
+    if((op == LOAD_OP_OPEN) ||
+       ((op == LOAD_OP_READ) && (session->mode != READ_LOCK)) ||
+       ((op == LOAD_OP_WRITE) && (session->mode != WRITE_LOCK)))
+    {
+        return LOAD_OP_CLOSE;
+    }
+
+    return op;
+}
+
+static void SendRequest(int index)
+{
+    LoadSession_t *session = &sessions[index];
+
+    if(send(session->sockfd, &session->request, sizeof(ClientRequest_t), 0) != sizeof(ClientRequest_t))
+    {
+        printErrno("%s:%d - Didn't send expected number of bytes", machineNames[session->machine], session->clientNumber);
+    }
+
+    TimerArm(index, Now() + CLIENT_RETRANSMIT_MS * 1000000ULL);
+}
+
+static void StartOp(int index, uint64_t dueTime)
+{
+    LoadSession_t *session = &sessions[index];
+    ClientRequest_t *request = &session->request;
+    LockType_t openMode = READ_LOCK;
+    char fileName[16];
+    char payload[LOAD_MAX_BYTES + 1];
+    int size = 0;
+
+    session->op = ChooseOp(session, &openMode);
+    session->dueTime = dueTime;
+    session->inFlight = true;
+
+    memset(request, 0, sizeof(ClientRequest_t));
+    strcpy(request->machineName, machineNames[session->machine]);
+    request->clientNumber = session->clientNumber;
+    request->clientIncarnation = machineIncarnations[session->machine];
+    request->requestNumber = session->requestNumber;
+
+    if(session->op == LOAD_OP_OPEN)
+    {
+        session->file = ZipfFile();
+        /* Nothing to read in a file nobody has written */
+        if(*FileSize(session, session->file) == 0)
+        {
+            openMode = WRITE_LOCK;
+        }
+        session->mode = openMode;
+    }
+    snprintf(fileName, sizeof(fileName), "f%d", session->file);
+    size = *FileSize(session, session->file);
+
+    /* Reads past the end fail, so rewind instead; lseek 0 is rejected, 1 is the closest */
+    if((session->op == LOAD_OP_READ) && (session->offset >= size))
+    {
+        session->op = LOAD_OP_LSEEK;
+        session->numBytes = 1;
+    }
+    else if(session->op == LOAD_OP_LSEEK)
+    {
+        session->numBytes = 1 + Random() % ((size > 1) ? size - 1 : 1);
+    }
+    else if(session->op == LOAD_OP_READ)
+    {
+        session->numBytes = (size - session->offset < numBytes) ? size - session->offset : numBytes;
+    }
+    else
+    {
+        session->numBytes = numBytes;
+    }
+
+    switch(session->op)
+    {
+        case LOAD_OP_OPEN:
+            snprintf(request->operation, sizeof(request->operation), "open %s %s\n", fileName, (session->mode == READ_LOCK) ? "read" : "write");
+            break;
+        case LOAD_OP_READ:
+            snprintf(request->operation, sizeof(request->operation), "read %s %d\n", fileName, session->numBytes);
+            break;
+        case LOAD_OP_WRITE:
+            memset(payload, 'a' + Random() % 26, session->numBytes);
+            payload[session->numBytes] = '\0';
+            snprintf(request->operation, sizeof(request->operation), "write %s \"%s\"\n", fileName, payload);
+            break;
+        case LOAD_OP_LSEEK:
+            snprintf(request->operation, sizeof(request->operation), "lseek %s %d\n", fileName, session->numBytes);
+            break;
+        default:
+            snprintf(request->operation, sizeof(request->operation), "close %s\n", fileName);
+            break;
+    }
+
+    SendRequest(index);
+}
+
+/* Track the server's view of the file so the next operation is valid */
+static void CompleteOp(LoadSession_t *session, int returnValue)
+{
+    int *size = FileSize(session, session->file);
+
+    switch(session->op)
+    {
+        case LOAD_OP_OPEN:
+            if(returnValue == OK)
+            {
+                session->offset = 0;
+                /* Opening for write truncates */
+                if(session->mode == WRITE_LOCK)
+                {
+                    *size = 0;
+                }
+            }
+            else
+            {
+                /* Usually another session on the machine holds the lock */
+                session->file = -1;
+            }
+            break;
+        case LOAD_OP_READ:
+            /* A short read still moves to the end */
+            session->offset = (returnValue == OK) ? session->offset + session->numBytes : *size;
+            break;
+        case LOAD_OP_WRITE:
+            if(returnValue == OK)
+            {
+                session->offset += session->numBytes;
+                if(session->offset > *size)
+                {
+                    *size = session->offset;
+                }
+            }
+            break;
+        case LOAD_OP_LSEEK:
+            if(returnValue == OK)
+            {
+                session->offset = session->numBytes;
+            }
+            break;
+        default:
+            session->file = -1;
+            break;
+    }
+}
+
+static void SessionIdle(int index, uint64_t now)
+{
+    if(arrivalRate > 0)
+    {
+        idleSessions[numIdle++] = index;
+    }
+    else
+    {
+        /* Exponential think time */
+        TimerArm(index, now + (uint64_t)(-log(1.0 - RandomDouble()) * thinkTime));
+    }
+}
+
+static void ReceiveResponse(int index)
+{
+    LoadSession_t *session = &sessions[index];
+    ServerResponse_t response;
+    uint64_t now = 0;
+    ssize_t bytesReceived = 0;
+    bool gotResponse = false;
+
+    /* Drain, so a late duplicate isn't taken as the next request's response */
+    while((bytesReceived = recv(session->sockfd, &response, sizeof(ServerResponse_t), 0)) >= 0)
+    {
+        if((bytesReceived == sizeof(ServerResponse_t)) && (session->inFlight == true))
+        {
+            gotResponse = true;
+            break;
+        }
+    }
+
+    if(gotResponse == false)
+    {
+        return;
+    }
+
+    now = Now();
+    session->inFlight = false;
+    session->timerGeneration++;
+    session->requestNumber++;
+
+    if(session->dueTime >= measureStart)
+    {
+        HistogramRecord(&stats[session->op].histogram, now - session->dueTime);
+        HistogramRecord(&allHistogram, now - session->dueTime);
+        if(response.returnValue != OK)
+        {
+            stats[session->op].errors++;
+        }
+    }
+    if(response.returnValue != OK)
+    {
+        printDebug("%s:%d.%d_%d - %s", session->request.machineName, session->request.clientNumber, session->request.clientIncarnation, session->request.requestNumber, response.returnString);
+    }
+
+    CompleteOp(session, response.returnValue);
+    SessionIdle(index, now);
+}
+
+static void PrintRow(const char *name, Histogram_t *histogram, uint64_t errors, uint64_t retransmits)
+{
+    printf("%s\t%llu\t%llu\t%llu\t%.1f\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+           name,
+           (unsigned long long)histogram->count,
+           (unsigned long long)errors,
+           (unsigned long long)retransmits,
+           (histogram->count != 0) ? (double)histogram->sum / histogram->count : 0.0,
+           (unsigned long long)HistogramQuantile(histogram, 0.5),
+           (unsigned long long)HistogramQuantile(histogram, 0.9),
+           (unsigned long long)HistogramQuantile(histogram, 0.99),
+           (unsigned long long)HistogramQuantile(histogram, 0.999),
+           (unsigned long long)histogram->max);
+}
+
+static status_t ParseMix(char *mix)
+{
+    int weights[LOAD_NUM_OPS] = {0};
+    int total = 0;
+    char *token = NULL;
+    char *value = NULL;
+    int op = 0;
+
+    for(token = strtok(mix, ","); token != NULL; token = strtok(NULL, ","))
+    {
+        if((value = strchr(token, '=')) == NULL)
+        {
+            printError("Invalid mix entry: %s", token);
+            return ERROR;
+        }
+        *value++ = '\0';
+
+        for(op = 0; (op < LOAD_NUM_OPS) && (strcmp(token, loadOpNames[op]) != 0); op++)
+        {
+        }
+        if((op == LOAD_NUM_OPS) || ((weights[op] = strtol(value, NULL, 10)) < 0))
+        {
+            printError("Invalid mix entry: %s=%s", token, value);
+            return ERROR;
+        }
+        total += weights[op];
+    }
+
+    if(total == 0)
+    {
+        printError("Empty mix%s", "");
+        return ERROR;
+    }
+
+    memcpy(mixWeights, weights, sizeof(mixWeights));
+
+    return OK;
+}
+
+/* One connected non-blocking socket per session */
+static status_t OpenSessions(char *serverIpAddress, int serverPortNumber, int epollfd)
+{
+    struct sockaddr_in serverAddr;
+    struct epoll_event event;
+    struct rlimit limit;
+
+    /* Every session needs a descriptor */
+    if((getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < limit.rlim_max))
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = inet_addr(serverIpAddress);
+    serverAddr.sin_port = htons(serverPortNumber);
+
+    for(int i = 0; i < numSessions; i++)
+    {
+        LoadSession_t *session = &sessions[i];
+
+        session->machine = i % numMachines;
+        session->clientNumber = i / numMachines + 1;
+        session->file = -1;
+
+        if((session->sockfd = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP)) < 0)
+        {
+            printErrno("Can't create socket for session %d", i);
+            return ERROR;
+        }
+        if(connect(session->sockfd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) != 0)
+        {
+            printErrno("Can't connect socket for session %d", i);
+            return ERROR;
+        }
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        if(epoll_ctl(epollfd, EPOLL_CTL_ADD, session->sockfd, &event) != 0)
+        {
+            printErrno("Can't add session %d to epoll", i);
+            return ERROR;
+        }
+    }
+
+    return OK;
+}
+
+static void Run(int epollfd)
+{
+    struct epoll_event events[LOAD_EPOLL_EVENTS];
+    uint64_t start = Now();
+    uint64_t end = 0;
+    uint64_t now = start;
+    uint64_t nextArrival = start;
+    uint64_t interval = (arrivalRate > 0) ? (uint64_t)(1000000000.0 / arrivalRate) : 0;
+    uint64_t wake = 0;
+    int timeout = 0;
+    int numEvents = 0;
+
+    measureStart = start + warmup * 1000000000ULL;
+    end = measureStart + duration * 1000000000ULL;
+
+    for(int i = 0; i < numSessions; i++)
+    {
+        if(arrivalRate > 0)
+        {
+            idleSessions[numIdle++] = i;
+        }
+        else
+        {
+            /* Spread the first requests out over one think time */
+            TimerArm(i, start + (uint64_t)(RandomDouble() * thinkTime));
+        }
+    }
+
+    while((now = Now()) < end)
+    {
+        /* Due arrivals wait for an idle session but keep their due time */
+        while((interval != 0) && (nextArrival <= now) && (numIdle > 0))
+        {
+            StartOp(idleSessions[--numIdle], nextArrival);
+            nextArrival += interval;
+        }
+
+        while((numTimers > 0) && (timers[0].when <= now))
+        {
+            LoadTimer_t timer = TimerPop();
+            LoadSession_t *session = &sessions[timer.session];
+
+            if(timer.generation != session->timerGeneration)
+            {
+                continue;
+            }
+            if(session->inFlight == true)
+            {
+                if(session->dueTime >= measureStart)
+                {
+                    stats[session->op].retransmits++;
+                }
+                SendRequest(timer.session);
+            }
+            else
+            {
+                StartOp(timer.session, timer.when);
+            }
+        }
+
+        wake = end;
+        if((numTimers > 0) && (timers[0].when < wake))
+        {
+            wake = timers[0].when;
+        }
+        if((interval != 0) && (numIdle > 0) && (nextArrival < wake))
+        {
+            wake = nextArrival;
+        }
+        timeout = (wake > now) ? (int)((wake - now) / 1000000) : 0;
+
+        if((numEvents = epoll_wait(epollfd, events, LOAD_EPOLL_EVENTS, timeout)) < 0)
+        {
+            if(errno != EINTR)
+            {
+                printErrno("epoll_wait failed%s", "");
+                break;
+            }
+            continue;
+        }
+
+        for(int i = 0; i < numEvents; i++)
+        {
+            ReceiveResponse(events[i].data.u32);
+        }
+    }
+
+    /* Report what never got a response, or never got sent */
+    {
+        uint64_t inFlight = 0;
+        uint64_t backlog = (interval != 0) && (nextArrival < end) ? (end - nextArrival) / interval : 0;
+
+        for(int i = 0; i < numSessions; i++)
+        {
+            if(sessions[i].inFlight == true)
+            {
+                inFlight++;
+            }
+        }
+
+        printInfo("%d sessions, %s, %.0f ops/s completed", numSessions,
+                  (arrivalRate > 0) ? "open loop" : "closed loop",
+                  allHistogram.count / (double)duration);
+        if((inFlight != 0) || (backlog != 0))
+        {
+            printInfo("%llu operations in flight and %llu arrivals not started at the end", (unsigned long long)inFlight, (unsigned long long)backlog);
+        }
+    }
+}
+
+static void Usage(char *name)
+{
+    printError("Usage: %s [-s|--sessions <N>] [-m|--machines <N>] [-f|--files <N>] [-z|--zipf <exponent>] "
+               "[-x|--mix open=10,read=40,write=30,lseek=10,close=10] [-t|--think <ms>] [-r|--rate <ops/s>] "
+               "[-d|--duration <s>] [-w|--warmup <s>] [-b|--bytes <N>] [-n|--name <machine prefix>] "
+               "<Server IP address (dotted decimal)> <service port>", name);
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option longOptions[] =
+    {
+        {"sessions", required_argument, NULL, 's'},
+        {"machines", required_argument, NULL, 'm'},
+        {"files",    required_argument, NULL, 'f'},
+        {"zipf",     required_argument, NULL, 'z'},
+        {"mix",      required_argument, NULL, 'x'},
+        {"think",    required_argument, NULL, 't'},
+        {"rate",     required_argument, NULL, 'r'},
+        {"duration", required_argument, NULL, 'd'},
+        {"warmup",   required_argument, NULL, 'w'},
+        {"bytes",    required_argument, NULL, 'b'},
+        {"name",     required_argument, NULL, 'n'},
+        {NULL,       0,                 NULL, 0}
+    };
+    status_t status = ERROR;
+    int epollfd = -1;
+    int c = 0;
+
+    while((c = getopt_long(argc, argv, "s:m:f:z:x:t:r:d:w:b:n:", longOptions, NULL)) != -1)
+    {
+        switch(c)
+        {
+            case 's': numSessions = strtol(optarg, NULL, 10); break;
+            case 'm': numMachines = strtol(optarg, NULL, 10); break;
+            case 'f': numFiles = strtol(optarg, NULL, 10); break;
+            case 'z': zipfExponent = strtod(optarg, NULL); break;
+            case 'x':
+                if(ParseMix(optarg) != OK)
+                {
+                    return ERROR;
+                }
+                break;
+            case 't': thinkTime = strtod(optarg, NULL) * 1000000.0; break;
+            case 'r': arrivalRate = strtod(optarg, NULL); break;
+            case 'd': duration = strtol(optarg, NULL, 10); break;
+            case 'w': warmup = strtol(optarg, NULL, 10); break;
+            case 'b': numBytes = strtol(optarg, NULL, 10); break;
+            case 'n': namePrefix = optarg; break;
+            default:
+                Usage(argv[0]);
+                return ERROR;
+        }
+    }
+
+    if((argc - optind != 2) || (numSessions <= 0) || (numMachines <= 0) || (numMachines > LOAD_MAX_MACHINES) ||
+       (numFiles <= 0) || (duration <= 0) || (warmup < 0) || (numBytes <= 0) || (numBytes > LOAD_MAX_BYTES) ||
+       (thinkTime < 0) || (arrivalRate < 0))
+    {
+        Usage(argv[0]);
+        return ERROR;
+    }
+    if(numMachines > numSessions)
+    {
+        numMachines = numSessions;
+    }
+
+    /* Keep per-request logging off the hot path */
+    logLevel = LOG_INFO;
+
+    sessions = calloc(numSessions, sizeof(LoadSession_t));
+    idleSessions = calloc(numSessions, sizeof(int));
+    machineNames = calloc(numMachines, sizeof(*machineNames));
+    machineIncarnations = calloc(numMachines, sizeof(int));
+    fileSizes = calloc((size_t)numMachines * numFiles, sizeof(int));
+
+    if((sessions == NULL) || (idleSessions == NULL) || (machineNames == NULL) || (machineIncarnations == NULL) || (fileSizes == NULL))
+    {
+        printErrno("Malloc failed%s", "");
+    }
+    else if(BuildZipf() != OK)
+    {
+        printError("Can't build file popularity table%s", "");
+    }
+    else if((epollfd = epoll_create1(0)) < 0)
+    {
+        printErrno("Can't create epoll instance%s", "");
+    }
+    else
+    {
+        status = OK;
+
+        /* A new run is a new incarnation of every machine, as after 'fail' */
+        for(int i = 0; (i < numMachines) && (status == OK); i++)
+        {
+            snprintf(machineNames[i], sizeof(machineNames[i]), "%s_%d", namePrefix, i);
+            if(GetIncarnation(machineNames[i], true, &machineIncarnations[i]) != OK)
+            {
+                printError("Can't get incarnation number for %s", machineNames[i]);
+                status = ERROR;
+            }
+        }
+
+        if((status == OK) && ((status = OpenSessions(argv[optind], strtol(argv[optind + 1], NULL, 10), epollfd)) == OK))
+        {
+            rngState ^= Now();
+            Run(epollfd);
+
+            printf("op\tops\terrors\tretransmits\tmean_ns\tp50_ns\tp90_ns\tp99_ns\tp999_ns\tmax_ns\n");
+            for(int op = 0; op < LOAD_NUM_OPS; op++)
+            {
+                PrintRow(loadOpNames[op], &stats[op].histogram, stats[op].errors, stats[op].retransmits);
+            }
+            {
+                uint64_t errors = 0;
+                uint64_t retransmits = 0;
+
+                for(int op = 0; op < LOAD_NUM_OPS; op++)
+                {
+                    errors += stats[op].errors;
+                    retransmits += stats[op].retransmits;
+                }
+                PrintRow("all", &allHistogram, errors, retransmits);
+            }
+        }
+    }
+
+    return status;
+}
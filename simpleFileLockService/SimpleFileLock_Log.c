@@ -0,0 +1,514 @@
+#include "SimpleFileLock_Log.h"
+
+#include <stdio.h>      /* for snprintf() and fwrite() */
+#include <stdarg.h>     /* for va_list */
+#include <stdint.h>     /* for uint16_t and uint64_t */
+#include <stdlib.h>     /* for calloc() and atexit() */
+#include <string.h>     /* for memcpy() */
+#include <pthread.h>    /* for pthread_create() */
+#include <time.h>       /* for nanosleep() */
+
+#define LOG_RING_SIZE     (64 * 1024)  /* Bytes per thread, power of two */
+#define LOG_MAX_RECORD    4096         /* Largest encoded record */
+#define LOG_MAX_LINE      8192         /* Largest formatted line */
+#define LOG_DRAIN_SLEEP   1000000      /* Drain thread idle sleep (ns) */
+
+/* Argument encodings */
+#define LOG_ARG_INT    1
+#define LOG_ARG_LONG   2
+#define LOG_ARG_DOUBLE 3
+#define LOG_ARG_PTR    4
+#define LOG_ARG_STRING 5
+
+typedef struct LogRecord_t
+{
+    uint32_t length;               /* Record size in bytes, header included */
+    uint32_t reserved;
+    LogSite_t *site;               /* NULL marks a wrap to the ring start */
+}LogRecord_t;
+
+typedef struct LogRing_t
+{
+    struct LogRing_t *next;        /* Next registered ring */
+    uint64_t head;                 /* Next write position (producer) */
+    uint64_t tail;                 /* Next read position (drain thread) */
+    unsigned long dropped;         /* Records lost because the ring was full */
+    char buffer[LOG_RING_SIZE];    /* Encoded records */
+}LogRing_t;
+
+/* DEBUG builds trace every request without -v, as before there were levels */
+#ifdef DEBUG
+int logLevel = LOG_DEBUG;
+#else
+int logLevel = LOG_INFO;
+#endif
+
+static LogRing_t *logRingList;
+static __thread LogRing_t *threadRing;
+static pthread_t drainThread;
+static int isStarted;
+static int isStopping;
+
+static void ParseFormat(LogSite_t *site)
+{
+    const char *c = site->format;
+    int numArgs = 0;
+
+    while((*c != '\0') && (numArgs < LOG_MAX_ARGS))
+    {
+        int longCount = 0;
+
+        if(*c++ != '%')
+        {
+            continue;
+        }
+        if(*c == '%')
+        {
+            c++;
+            continue;
+        }
+
+        /* Flags, width and precision ('*' consumes an int) */
+        while((*c != '\0') && (strchr("-+ #0123456789.*", *c) != NULL))
+        {
+            if((*c == '*') && (numArgs < LOG_MAX_ARGS))
+            {
+                site->argTypes[numArgs++] = LOG_ARG_INT;
+            }
+            c++;
+        }
+
+        /* Length modifiers */
+        while((*c != '\0') && (strchr("hlLqjzt", *c) != NULL))
+        {
+            if(*c != 'h')
+            {
+                longCount++;
+            }
+            c++;
+        }
+
+        if((*c == '\0') || (numArgs >= LOG_MAX_ARGS))
+        {
+            break;
+        }
+
+        switch(*c++)
+        {
+            case 'd': case 'i': case 'u': case 'o': case 'x': case 'X': case 'c':
+                site->argTypes[numArgs++] = (longCount > 0) ? LOG_ARG_LONG : LOG_ARG_INT;
+                break;
+            case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+                site->argTypes[numArgs++] = LOG_ARG_DOUBLE;
+                break;
+            case 's':
+                site->argTypes[numArgs++] = LOG_ARG_STRING;
+                break;
+            default:
+                site->argTypes[numArgs++] = LOG_ARG_PTR;
+                break;
+        }
+    }
+
+    __atomic_store_n(&site->numArgs, numArgs, __ATOMIC_RELEASE);
+}
+
+/* Encode the arguments for 'site' after a LogRecord_t header in 'record' */
+static uint32_t EncodeRecord(char *record, LogSite_t *site, va_list args)
+{
+    uint32_t length = sizeof(LogRecord_t);
+    LogRecord_t header;
+
+    for(int i = 0; i < site->numArgs; i++)
+    {
+        switch(site->argTypes[i])
+        {
+            case LOG_ARG_INT:
+            {
+                int value = va_arg(args, int);
+                memcpy(record + length, &value, sizeof(value));
+                length += sizeof(value);
+                break;
+            }
+            case LOG_ARG_LONG:
+            {
+                long long value = va_arg(args, long long);
+                memcpy(record + length, &value, sizeof(value));
+                length += sizeof(value);
+                break;
+            }
+            case LOG_ARG_DOUBLE:
+            {
+                double value = va_arg(args, double);
+                memcpy(record + length, &value, sizeof(value));
+                length += sizeof(value);
+                break;
+            }
+            case LOG_ARG_PTR:
+            {
+                void *value = va_arg(args, void *);
+                memcpy(record + length, &value, sizeof(value));
+                length += sizeof(value);
+                break;
+            }
+            case LOG_ARG_STRING:
+            {
+                const char *value = va_arg(args, const char *);
+                /* Leave room for the largest encoding of every later argument */
+                long room = LOG_MAX_RECORD - 8 - (long)length - (long)sizeof(uint16_t) - (site->numArgs - i - 1) * (long)(sizeof(long long) + sizeof(uint16_t));
+                uint16_t stringLength = 0;
+
+                if(value == NULL)
+                {
+                    value = "(null)";
+                }
+                stringLength = (room > 0) ? strnlen(value, room) : 0;
+
+                memcpy(record + length, &stringLength, sizeof(stringLength));
+                memcpy(record + length + sizeof(stringLength), value, stringLength);
+                length += sizeof(stringLength) + stringLength;
+                break;
+            }
+        }
+    }
+
+    /* Keep records 8 byte aligned in the ring */
+    length = (length + 7) & ~7u;
+
+    header.length = length;
+    header.reserved = 0;
+    header.site = site;
+    memcpy(record, &header, sizeof(header));
+
+    return length;
+}
+
+/* Format one encoded record into 'line', returns the number of bytes */
+static size_t FormatRecord(const char *record, char *line, size_t lineSize)
+{
+    LogRecord_t header;
+    LogSite_t *site = NULL;
+    const char *arg = record + sizeof(LogRecord_t);
+    const char *c = NULL;
+    size_t used = 0;
+    int argIndex = 0;
+
+    memcpy(&header, record, sizeof(header));
+    site = header.site;
+    c = site->format;
+
+    /* Reserve room for the trailing newline */
+    lineSize--;
+
+    if(site->prefix != NULL)
+    {
+        used += snprintf(line, lineSize, "%s: %s:%d %s() - ", site->prefix, site->file, site->line, site->func);
+    }
+
+    while((*c != '\0') && (used < lineSize))
+    {
+        char spec[32];
+        size_t specLength = 0;
+
+        if(*c != '%')
+        {
+            line[used++] = *c++;
+            continue;
+        }
+        if(c[1] == '%')
+        {
+            line[used++] = '%';
+            c += 2;
+            continue;
+        }
+
+        /* Copy the conversion spec, substituting any '*' */
+        spec[specLength++] = *c++;
+        while((*c != '\0') && (strchr("-+ #0123456789.*hlLqjzt", *c) != NULL) && (specLength < sizeof(spec) - 12))
+        {
+            if((*c == '*') && (argIndex < site->numArgs))
+            {
+                int value = 0;
+                memcpy(&value, arg, sizeof(value));
+                arg += sizeof(value);
+                argIndex++;
+                specLength += snprintf(spec + specLength, sizeof(spec) - specLength, "%d", value);
+            }
+            else
+            {
+                spec[specLength++] = *c;
+            }
+            c++;
+        }
+        if(*c == '\0')
+        {
+            break;
+        }
+        spec[specLength++] = *c++;
+        spec[specLength] = '\0';
+
+        if(argIndex >= site->numArgs)
+        {
+            break;
+        }
+
+        switch(site->argTypes[argIndex++])
+        {
+            case LOG_ARG_INT:
+            {
+                int value = 0;
+                memcpy(&value, arg, sizeof(value));
+                arg += sizeof(value);
+                used += snprintf(line + used, lineSize - used, spec, value);
+                break;
+            }
+            case LOG_ARG_LONG:
+            {
+                long long value = 0;
+                memcpy(&value, arg, sizeof(value));
+                arg += sizeof(value);
+                used += snprintf(line + used, lineSize - used, spec, value);
+                break;
+            }
+            case LOG_ARG_DOUBLE:
+            {
+                double value = 0;
+                memcpy(&value, arg, sizeof(value));
+                arg += sizeof(value);
+                used += snprintf(line + used, lineSize - used, spec, value);
+                break;
+            }
+            case LOG_ARG_PTR:
+            {
+                void *value = NULL;
+                memcpy(&value, arg, sizeof(value));
+                arg += sizeof(value);
+                used += snprintf(line + used, lineSize - used, spec, value);
+                break;
+            }
+            case LOG_ARG_STRING:
+            {
+                char value[LOG_MAX_RECORD];
+                uint16_t stringLength = 0;
+                memcpy(&stringLength, arg, sizeof(stringLength));
+                memcpy(value, arg + sizeof(stringLength), stringLength);
+                value[stringLength] = '\0';
+                arg += sizeof(stringLength) + stringLength;
+                used += snprintf(line + used, lineSize - used, spec, value);
+                break;
+            }
+        }
+    }
+
+    if(used > lineSize)
+    {
+        used = lineSize;
+    }
+
+    /* Bare messages carry their own newline, prefixed ones never do */
+    if(site->prefix != NULL)
+    {
+        line[used++] = '\n';
+    }
+
+    return used;
+}
+
+static void WriteLine(LogSite_t *site, const char *line, size_t length)
+{
+    fwrite(line, 1, length, (site->prefix != NULL) ? stderr : stdout);
+}
+
+static LogRing_t *GetThreadRing(void)
+{
+    LogRing_t *ring = threadRing;
+
+    if(ring == NULL)
+    {
+        if((ring = calloc(1, sizeof(LogRing_t))) != NULL)
+        {
+            ring->next = __atomic_load_n(&logRingList, __ATOMIC_RELAXED);
+            while(!__atomic_compare_exchange_n(&logRingList, &ring->next, ring, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            {
+            }
+            threadRing = ring;
+        }
+    }
+
+    return ring;
+}
+
+void LogWrite(LogSite_t *site, ...)
+{
+    char record[LOG_MAX_RECORD];
+    uint32_t length = 0;
+    LogRing_t *ring = NULL;
+    va_list args;
+
+    if(__atomic_load_n(&site->numArgs, __ATOMIC_ACQUIRE) < 0)
+    {
+        ParseFormat(site);
+    }
+
+    va_start(args, site);
+    length = EncodeRecord(record, site, args);
+    va_end(args);
+
+    /* Not started (or no ring): format in the caller */
+    if((__atomic_load_n(&isStarted, __ATOMIC_ACQUIRE) == 0) || ((ring = GetThreadRing()) == NULL))
+    {
+        char line[LOG_MAX_LINE];
+        WriteLine(site, line, FormatRecord(record, line, sizeof(line)));
+    }
+    else
+    {
+        uint64_t head = ring->head;
+        uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+        uint32_t position = head & (LOG_RING_SIZE - 1);
+        uint32_t skip = 0;
+
+        /* Records never straddle the end of the ring */
+        if(LOG_RING_SIZE - position < length)
+        {
+            skip = LOG_RING_SIZE - position;
+        }
+
+        /* Never block the caller: count the record as dropped instead */
+        if(LOG_RING_SIZE - (head - tail) < skip + length)
+        {
+            __atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+        }
+        else
+        {
+            if(skip > 0)
+            {
+                if(skip >= sizeof(LogRecord_t))
+                {
+                    LogRecord_t wrap = {skip, 0, NULL};
+                    memcpy(ring->buffer + position, &wrap, sizeof(wrap));
+                }
+                head += skip;
+                position = 0;
+            }
+
+            memcpy(ring->buffer + position, record, length);
+            __atomic_store_n(&ring->head, head + length, __ATOMIC_RELEASE);
+        }
+    }
+}
+
+/* Drain every ring once, returns the number of records written */
+static int DrainRings(void)
+{
+    char line[LOG_MAX_LINE];
+    int numRecords = 0;
+
+    for(LogRing_t *ring = __atomic_load_n(&logRingList, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next)
+    {
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        uint64_t tail = ring->tail;
+        unsigned long dropped = 0;
+
+        while(tail != head)
+        {
+            uint32_t position = tail & (LOG_RING_SIZE - 1);
+            LogRecord_t header;
+
+            if(LOG_RING_SIZE - position < sizeof(LogRecord_t))
+            {
+                tail += LOG_RING_SIZE - position;
+                continue;
+            }
+
+            memcpy(&header, ring->buffer + position, sizeof(header));
+            if(header.site == NULL)
+            {
+                tail += header.length;
+                continue;
+            }
+
+            WriteLine(header.site, line, FormatRecord(ring->buffer + position, line, sizeof(line)));
+            tail += header.length;
+            numRecords++;
+        }
+
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+
+        if((dropped = __atomic_exchange_n(&ring->dropped, 0, __ATOMIC_RELAXED)) != 0)
+        {
+            fprintf(stderr, "Warning: %s:%d %s() - Dropped %lu log records\n", __FILE__, __LINE__, __func__, dropped);
+        }
+    }
+
+    if(numRecords > 0)
+    {
+        fflush(stdout);
+        fflush(stderr);
+    }
+
+    return numRecords;
+}
+
+static void *DrainThread(void *arg)
+{
+    struct timespec idle = {0, LOG_DRAIN_SLEEP};
+
+    (void)arg;
+
+    while(__atomic_load_n(&isStopping, __ATOMIC_ACQUIRE) == 0)
+    {
+        if(DrainRings() == 0)
+        {
+            nanosleep(&idle, NULL);
+        }
+    }
+
+    /* Final pass for anything logged before LogStop() */
+    DrainRings();
+
+    return NULL;
+}
+
+int LogStart(void)
+{
+    int status = -1;
+
+    if(__atomic_load_n(&isStarted, __ATOMIC_ACQUIRE) == 0)
+    {
+        if(pthread_create(&drainThread, NULL, DrainThread, NULL) == 0)
+        {
+            __atomic_store_n(&isStarted, 1, __ATOMIC_RELEASE);
+            atexit(LogStop);
+            status = 0;
+        }
+        else
+        {
+            printErrno("Can't start log drain thread%s", "");
+        }
+    }
+
+    return status;
+}
+
+void LogStop(void)
+{
+    if(__atomic_exchange_n(&isStarted, 0, __ATOMIC_ACQ_REL) != 0)
+    {
+        __atomic_store_n(&isStopping, 1, __ATOMIC_RELEASE);
+        pthread_join(drainThread, NULL);
+    }
+}
+
+void LogSetLevel(int level)
+{
+    if(level < LOG_ERROR)
+    {
+        level = LOG_ERROR;
+    }
+    else if(level > LOG_DEBUG)
+    {
+        level = LOG_DEBUG;
+    }
+
+    __atomic_store_n(&logLevel, level, __ATOMIC_RELAXED);
+}
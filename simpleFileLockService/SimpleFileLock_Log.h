@@ -0,0 +1,80 @@
+#ifndef SIMPLEFILELOCK_LOG_H
+#define SIMPLEFILELOCK_LOG_H
+
+#include <string.h>     /* for strerror() */
+#include <errno.h>      /* for errno */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Asynchronous logger.
+ *
+ * Each call site owns a static LogSite_t holding its format string and
+ * location, so the hot path only copies the site pointer, a timestamp and the
+ * binary encoded arguments into a per-thread ring buffer.  A background thread
+ * started by LogStart() drains the rings and does all of the formatting.
+ * Before LogStart() (and in the client, which never calls it) records are
+ * formatted and written synchronously.
+ *
+ * Levels above LOG_COMPILE_LEVEL compile away entirely; the remaining ones
+ * are filtered at run time by LogSetLevel().
+ */
+
+#define LOG_ERROR   0
+#define LOG_WARNING 1
+#define LOG_INFO    2
+#define LOG_DEBUG   3
+
+#ifndef LOG_COMPILE_LEVEL
+#ifdef DEBUG
+#define LOG_COMPILE_LEVEL LOG_DEBUG
+#else
+#define LOG_COMPILE_LEVEL LOG_INFO
+#endif
+#endif
+
+#define LOG_MAX_ARGS 12
+
+typedef struct LogSite_t
+{
+    int level;                            /* LOG_ERROR .. LOG_DEBUG */
+    const char *prefix;                   /* "Error", ... or NULL for a bare message */
+    const char *file;                     /* __FILE__ */
+    int line;                             /* __LINE__ */
+    const char *func;                     /* __func__ */
+    const char *format;                   /* printf style format */
+    int numArgs;                          /* -1 until the format has been parsed */
+    unsigned char argTypes[LOG_MAX_ARGS]; /* Encoding of each argument */
+}LogSite_t;
+
+extern int logLevel;
+
+void LogWrite(LogSite_t *site, ...);
+int LogStart(void);
+void LogStop(void);
+void LogSetLevel(int level);
+
+#define LOG_AT(lvl, pfx, fmt, ...)                                                   \
+    do                                                                               \
+    {                                                                                \
+        if(((lvl) <= LOG_COMPILE_LEVEL) && ((lvl) <= logLevel))                      \
+        {                                                                            \
+            static LogSite_t logSite = {(lvl), (pfx), __FILE__, __LINE__, __func__, fmt, -1, {0}}; \
+            LogWrite(&logSite, __VA_ARGS__);                                         \
+        }                                                                            \
+    }while(0)
+
+#define printError(errorMsg, ...) LOG_AT(LOG_ERROR, "Error", errorMsg, __VA_ARGS__)
+#define printWarning(errorMsg, ...) LOG_AT(LOG_WARNING, "Warning", errorMsg, __VA_ARGS__)
+#define printInfo(errorMsg, ...) LOG_AT(LOG_INFO, "Info", errorMsg, __VA_ARGS__)
+#define printDebug(debugMsg, ...) LOG_AT(LOG_DEBUG, NULL, debugMsg, __VA_ARGS__)
+
+#define printErrno(errorMsg, ...) LOG_AT(LOG_ERROR, "Error", errorMsg ":%s", __VA_ARGS__, strerror(errno))
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPLEFILELOCK_LOG_H */
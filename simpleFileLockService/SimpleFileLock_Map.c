@@ -0,0 +1,515 @@
+#include "SimpleFileLock_Map.h"
+#include "defns.h"
+
+#include <stdint.h>     /* for uint64_t */
+#include <stdlib.h>     /* for malloc() and free() */
+#include <string.h>     /* for memcmp() and memcpy() */
+#include <pthread.h>    /* for pthread_mutex_t */
+
+#define MAP_MIN_BUCKETS 16
+#define MAP_MAX_LOAD    2     /* Grow once count > buckets * MAP_MAX_LOAD */
+
+typedef struct MapNode_t
+{
+    struct MapNode_t *next; /* Next node in the bucket chain */
+    uint64_t hash;          /* Full hash of the key */
+    size_t keyLength;       /* Length of the key in bytes */
+    void *value;            /* Caller's value */
+    char key[];             /* Key bytes (not NUL terminated) */
+}MapNode_t;
+
+typedef struct MapBuckets_t
+{
+    size_t mask;            /* Number of buckets - 1 (power of two) */
+    MapNode_t *bucket[];    /* Bucket chain heads */
+}MapBuckets_t;
+
+struct ConcurrentMap_t
+{
+    MapBuckets_t *buckets;        /* Published bucket array */
+    size_t count;                 /* Number of entries */
+    pthread_mutex_t writeMutex;   /* Serializes updates */
+    MapFreeValue_t freeValue;     /* Destructor for removed values */
+};
+
+typedef struct EpochRecord_t
+{
+    struct EpochRecord_t *next;   /* Next registered thread */
+    unsigned long epoch;          /* Global epoch seen on entry */
+    int active;                   /* Inside a read-side section */
+    int nesting;                  /* EpochEnter() depth */
+}EpochRecord_t;
+
+typedef struct RetiredNode_t
+{
+    struct RetiredNode_t *next;   /* Next retired pointer */
+    unsigned long epoch;          /* Global epoch when retired */
+    void *ptr;                    /* Pointer to free */
+    MapFreeValue_t freeFn;        /* How to free it */
+}RetiredNode_t;
+
+/* Epoch state shared by every map */
+static EpochRecord_t *epochRecordList;
+static unsigned long globalEpoch;
+static RetiredNode_t *retiredList;
+static pthread_mutex_t retiredMutex = PTHREAD_MUTEX_INITIALIZER;
+static __thread EpochRecord_t *threadRecord;
+
+static uint64_t HashKey(const void *key, size_t keyLength)
+{
+    const unsigned char *bytes = key;
+    uint64_t hash = 14695981039346656037ULL; /* FNV-1a */
+
+    for(size_t i = 0; i < keyLength; i++)
+    {
+        hash ^= bytes[i];
+        hash *= 1099511628211ULL;
+    }
+
+    return hash;
+}
+
+static MapBuckets_t *AllocBuckets(size_t numBuckets)
+{
+    MapBuckets_t *buckets = NULL;
+
+    if((buckets = calloc(1, sizeof(MapBuckets_t) + numBuckets * sizeof(MapNode_t *))) != NULL)
+    {
+        buckets->mask = numBuckets - 1;
+    }
+    else
+    {
+        printErrno("Malloc failed%s", "");
+    }
+
+    return buckets;
+}
+
+static MapNode_t *AllocNode(const void *key, size_t keyLength, uint64_t hash, void *value)
+{
+    MapNode_t *node = NULL;
+
+    if((node = malloc(sizeof(MapNode_t) + keyLength)) != NULL)
+    {
+        node->next = NULL;
+        node->hash = hash;
+        node->keyLength = keyLength;
+        node->value = value;
+        memcpy(node->key, key, keyLength);
+    }
+    else
+    {
+        printErrno("Malloc failed%s", "");
+    }
+
+    return node;
+}
+
+ConcurrentMap_t *MapCreate(size_t initialBuckets, MapFreeValue_t freeValue)
+{
+    ConcurrentMap_t *map = NULL;
+    size_t numBuckets = MAP_MIN_BUCKETS;
+
+    /* Round up to a power of two */
+    while(numBuckets < initialBuckets)
+    {
+        numBuckets <<= 1;
+    }
+
+    if((map = calloc(1, sizeof(ConcurrentMap_t))) != NULL)
+    {
+        if((map->buckets = AllocBuckets(numBuckets)) != NULL)
+        {
+            pthread_mutex_init(&map->writeMutex, NULL);
+            map->freeValue = freeValue;
+        }
+        else
+        {
+            free(map);
+            map = NULL;
+        }
+    }
+    else
+    {
+        printErrno("Malloc failed%s", "");
+    }
+
+    return map;
+}
+
+/* NOTE: No reader may be using the map */
+void MapDestroy(ConcurrentMap_t *map)
+{
+    if(map != NULL)
+    {
+        for(size_t i = 0; i <= map->buckets->mask; i++)
+        {
+            MapNode_t *node = map->buckets->bucket[i];
+
+            while(node != NULL)
+            {
+                MapNode_t *next = node->next;
+
+                if(map->freeValue != NULL)
+                {
+                    map->freeValue(node->value);
+                }
+                free(node);
+                node = next;
+            }
+        }
+
+        free(map->buckets);
+        pthread_mutex_destroy(&map->writeMutex);
+        free(map);
+    }
+}
+
+void *MapLookup(ConcurrentMap_t *map, const void *key, size_t keyLength)
+{
+    uint64_t hash = HashKey(key, keyLength);
+    MapBuckets_t *buckets = __atomic_load_n(&map->buckets, __ATOMIC_ACQUIRE);
+    MapNode_t *node = __atomic_load_n(&buckets->bucket[hash & buckets->mask], __ATOMIC_ACQUIRE);
+
+    /* Search the bucket chain for a matching key */
+    while(node != NULL)
+    {
+        if((node->hash == hash) &&
+           (node->keyLength == keyLength) &&
+           (memcmp(node->key, key, keyLength) == 0))
+        {
+            return node->value;
+        }
+        node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+    }
+
+    return NULL;
+}
+
+void MapForEach(ConcurrentMap_t *map, MapVisitor_t visitor, void *arg)
+{
+    MapBuckets_t *buckets = __atomic_load_n(&map->buckets, __ATOMIC_ACQUIRE);
+
+    for(size_t i = 0; i <= buckets->mask; i++)
+    {
+        MapNode_t *node = __atomic_load_n(&buckets->bucket[i], __ATOMIC_ACQUIRE);
+
+        while(node != NULL)
+        {
+            visitor(node->value, arg);
+            node = __atomic_load_n(&node->next, __ATOMIC_ACQUIRE);
+        }
+    }
+}
+
+size_t MapCount(ConcurrentMap_t *map)
+{
+    return __atomic_load_n(&map->count, __ATOMIC_RELAXED);
+}
+
+/* Double the bucket array.  Readers may still be walking the old chains, so
+ * every node is copied into the new array and the old ones are retired
+ * without touching their values.
+ * NOTE: writeMutex must be held */
+static void GrowBuckets(ConcurrentMap_t *map)
+{
+    MapBuckets_t *oldBuckets = map->buckets;
+    MapBuckets_t *newBuckets = NULL;
+
+    if((newBuckets = AllocBuckets((oldBuckets->mask + 1) << 1)) != NULL)
+    {
+        /* Copy every node into the new array */
+        for(size_t i = 0; i <= oldBuckets->mask; i++)
+        {
+            for(MapNode_t *node = oldBuckets->bucket[i]; node != NULL; node = node->next)
+            {
+                MapNode_t *copy = NULL;
+
+                if((copy = AllocNode(node->key, node->keyLength, node->hash, node->value)) == NULL)
+                {
+                    /* Undo the partial copy and keep the old array */
+                    for(size_t j = 0; j <= newBuckets->mask; j++)
+                    {
+                        while(newBuckets->bucket[j] != NULL)
+                        {
+                            MapNode_t *next = newBuckets->bucket[j]->next;
+                            free(newBuckets->bucket[j]);
+                            newBuckets->bucket[j] = next;
+                        }
+                    }
+                    free(newBuckets);
+                    return;
+                }
+
+                copy->next = newBuckets->bucket[copy->hash & newBuckets->mask];
+                newBuckets->bucket[copy->hash & newBuckets->mask] = copy;
+            }
+        }
+
+        /* Publish the new array, then retire the old one */
+        __atomic_store_n(&map->buckets, newBuckets, __ATOMIC_RELEASE);
+
+        for(size_t i = 0; i <= oldBuckets->mask; i++)
+        {
+            for(MapNode_t *node = oldBuckets->bucket[i]; node != NULL; node = node->next)
+            {
+                EpochRetire(node, free);
+            }
+        }
+        EpochRetire(oldBuckets, free);
+    }
+}
+
+void *MapInsert(ConcurrentMap_t *map, const void *key, size_t keyLength, void *value)
+{
+    uint64_t hash = HashKey(key, keyLength);
+    MapNode_t *node = NULL;
+    MapNode_t **head = NULL;
+    void *result = NULL;
+
+    pthread_mutex_lock(&map->writeMutex);
+
+    head = &map->buckets->bucket[hash & map->buckets->mask];
+
+    /* Refuse duplicate keys */
+    for(node = *head; node != NULL; node = node->next)
+    {
+        if((node->hash == hash) &&
+           (node->keyLength == keyLength) &&
+           (memcmp(node->key, key, keyLength) == 0))
+        {
+            break;
+        }
+    }
+
+    if(node == NULL)
+    {
+        if((node = AllocNode(key, keyLength, hash, value)) != NULL)
+        {
+            /* Fully initialize the node before it becomes reachable */
+            node->next = *head;
+            __atomic_store_n(head, node, __ATOMIC_RELEASE);
+            __atomic_store_n(&map->count, map->count + 1, __ATOMIC_RELAXED);
+            result = value;
+
+            if(map->count > (map->buckets->mask + 1) * MAP_MAX_LOAD)
+            {
+                GrowBuckets(map);
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&map->writeMutex);
+
+    EpochReclaim();
+
+    return result;
+}
+
+/* NOTE: writeMutex must be held */
+static void UnlinkNode(ConcurrentMap_t *map, MapNode_t **link, MapNode_t *node)
+{
+    /* Readers already past 'link' keep a valid 'node->next' */
+    __atomic_store_n(link, node->next, __ATOMIC_RELEASE);
+    __atomic_store_n(&map->count, map->count - 1, __ATOMIC_RELAXED);
+
+    if(map->freeValue != NULL)
+    {
+        EpochRetire(node->value, map->freeValue);
+    }
+    EpochRetire(node, free);
+}
+
+void *MapRemove(ConcurrentMap_t *map, const void *key, size_t keyLength)
+{
+    uint64_t hash = HashKey(key, keyLength);
+    MapNode_t **link = NULL;
+    void *result = NULL;
+
+    pthread_mutex_lock(&map->writeMutex);
+
+    link = &map->buckets->bucket[hash & map->buckets->mask];
+
+    /* Search the bucket chain for a matching key */
+    while(*link != NULL)
+    {
+        MapNode_t *node = *link;
+
+        if((node->hash == hash) &&
+           (node->keyLength == keyLength) &&
+           (memcmp(node->key, key, keyLength) == 0))
+        {
+            result = node->value;
+            UnlinkNode(map, link, node);
+            break;
+        }
+        link = &node->next;
+    }
+
+    pthread_mutex_unlock(&map->writeMutex);
+
+    EpochReclaim();
+
+    return result;
+}
+
+size_t MapRemoveIf(ConcurrentMap_t *map, MapPredicate_t predicate, void *arg)
+{
+    size_t numRemoved = 0;
+
+    pthread_mutex_lock(&map->writeMutex);
+
+    for(size_t i = 0; i <= map->buckets->mask; i++)
+    {
+        MapNode_t **link = &map->buckets->bucket[i];
+
+        while(*link != NULL)
+        {
+            MapNode_t *node = *link;
+
+            if(predicate(node->value, arg) != 0)
+            {
+                UnlinkNode(map, link, node);
+                numRemoved++;
+            }
+            else
+            {
+                link = &node->next;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&map->writeMutex);
+
+    EpochReclaim();
+
+    return numRemoved;
+}
+
+void EpochEnter(void)
+{
+    EpochRecord_t *record = threadRecord;
+
+    /* First use on this thread: register a record (never freed) */
+    if(record == NULL)
+    {
+        if((record = calloc(1, sizeof(EpochRecord_t))) == NULL)
+        {
+            printErrno("Malloc failed%s", "");
+            abort();
+        }
+
+        record->next = __atomic_load_n(&epochRecordList, __ATOMIC_RELAXED);
+        while(!__atomic_compare_exchange_n(&epochRecordList, &record->next, record, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        {
+        }
+        threadRecord = record;
+    }
+
+    if(record->nesting++ == 0)
+    {
+        __atomic_store_n(&record->active, 1, __ATOMIC_RELAXED);
+        /* Announce we are active before observing the epoch or any pointer */
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        __atomic_store_n(&record->epoch, __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE), __ATOMIC_RELAXED);
+    }
+}
+
+void EpochExit(void)
+{
+    EpochRecord_t *record = threadRecord;
+
+    if((record != NULL) && (--record->nesting == 0))
+    {
+        __atomic_store_n(&record->active, 0, __ATOMIC_RELEASE);
+    }
+}
+
+void EpochRetire(void *ptr, MapFreeValue_t freeFn)
+{
+    RetiredNode_t *retired = NULL;
+
+    if((retired = malloc(sizeof(RetiredNode_t))) != NULL)
+    {
+        retired->ptr = ptr;
+        retired->freeFn = freeFn;
+
+        pthread_mutex_lock(&retiredMutex);
+        retired->epoch = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+        retired->next = retiredList;
+        retiredList = retired;
+        pthread_mutex_unlock(&retiredMutex);
+    }
+    else
+    {
+        /* Leaking is the only safe option here */
+        printErrno("Malloc failed%s", "");
+    }
+}
+
+void EpochReclaim(void)
+{
+    RetiredNode_t *freeList = NULL;
+    RetiredNode_t **link = NULL;
+    unsigned long epoch = 0;
+    bool canAdvance = true;
+
+    /* Don't make writers wait on each other just to reclaim */
+    if(pthread_mutex_trylock(&retiredMutex) != 0)
+    {
+        return;
+    }
+
+    if(retiredList != NULL)
+    {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        epoch = __atomic_load_n(&globalEpoch, __ATOMIC_ACQUIRE);
+
+        /* The epoch can move on once every active reader has observed it */
+        for(EpochRecord_t *record = __atomic_load_n(&epochRecordList, __ATOMIC_ACQUIRE); record != NULL; record = record->next)
+        {
+            if((__atomic_load_n(&record->active, __ATOMIC_ACQUIRE) != 0) &&
+               (__atomic_load_n(&record->epoch, __ATOMIC_ACQUIRE) != epoch))
+            {
+                canAdvance = false;
+                break;
+            }
+        }
+
+        if(canAdvance == true)
+        {
+            epoch++;
+            __atomic_store_n(&globalEpoch, epoch, __ATOMIC_RELEASE);
+        }
+
+        /* Anything retired two epochs ago is unreachable */
+        link = &retiredList;
+        while(*link != NULL)
+        {
+            RetiredNode_t *retired = *link;
+
+            if(retired->epoch + 2 <= epoch)
+            {
+                *link = retired->next;
+                retired->next = freeList;
+                freeList = retired;
+            }
+            else
+            {
+                link = &retired->next;
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&retiredMutex);
+
+    /* Run destructors outside the lock */
+    while(freeList != NULL)
+    {
+        RetiredNode_t *next = freeList->next;
+
+        freeList->freeFn(freeList->ptr);
+        free(freeList);
+        freeList = next;
+    }
+}
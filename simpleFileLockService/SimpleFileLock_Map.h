@@ -0,0 +1,62 @@
+#ifndef SIMPLEFILELOCK_MAP_H
+#define SIMPLEFILELOCK_MAP_H
+
+#include <stddef.h>     /* for size_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Concurrent hash map used for the lock and client tables.
+ *
+ * Readers never take a lock: a lookup is a bounded walk of one bucket chain
+ * and must be done between EpochEnter() and EpochExit().  Any value returned
+ * by MapLookup() stays valid until the matching EpochExit(), even if another
+ * thread removes it in the meantime.
+ *
+ * Updates (MapInsert, MapRemove, MapRemoveIf) are serialized by a per-map
+ * mutex.  New nodes are published with a release store, and unlinked nodes
+ * (and their values) are handed to the epoch reclaimer, which frees them once
+ * every thread that could still see them has left its read-side section.
+ */
+
+typedef struct ConcurrentMap_t ConcurrentMap_t;
+
+/* Called on a value once it has been removed and no reader can see it */
+typedef void (*MapFreeValue_t)(void *value);
+
+/* Return non-zero to remove 'value' in MapRemoveIf() */
+typedef int (*MapPredicate_t)(void *value, void *arg);
+
+/* Called for every value in MapForEach() */
+typedef void (*MapVisitor_t)(void *value, void *arg);
+
+ConcurrentMap_t *MapCreate(size_t initialBuckets, MapFreeValue_t freeValue);
+void MapDestroy(ConcurrentMap_t *map);
+
+/* Read side: caller must be inside EpochEnter()/EpochExit() */
+void *MapLookup(ConcurrentMap_t *map, const void *key, size_t keyLength);
+void MapForEach(ConcurrentMap_t *map, MapVisitor_t visitor, void *arg);
+size_t MapCount(ConcurrentMap_t *map);
+
+/* Write side: returns 'value' on success, NULL if the key exists or on error */
+void *MapInsert(ConcurrentMap_t *map, const void *key, size_t keyLength, void *value);
+
+/* Write side: returns the removed value (retired, not yet freed) or NULL */
+void *MapRemove(ConcurrentMap_t *map, const void *key, size_t keyLength);
+
+/* Write side: removes every value matching 'predicate', returns the count */
+size_t MapRemoveIf(ConcurrentMap_t *map, MapPredicate_t predicate, void *arg);
+
+/* Epoch based reclamation */
+void EpochEnter(void);
+void EpochExit(void);
+void EpochRetire(void *ptr, MapFreeValue_t freeFn);
+void EpochReclaim(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPLEFILELOCK_MAP_H */
@@ -0,0 +1,239 @@
+#include "defns.h"
+#include "SimpleFileLock_Map.h"
+
+#include <stdio.h>      /* for printf() */
+#include <stdlib.h>     /* for strtol() */
+#include <string.h>     /* for memcpy() */
+#include <pthread.h>    /* for pthread_create() */
+#include <time.h>       /* for clock_gettime() */
+
+/*
+ * Lookup contention benchmark for the lock table.
+ *
+ * Fills a map with lock-table style keys, then runs 1..maxThreads reader
+ * threads doing random lookups while one writer thread keeps inserting and
+ * removing a separate set of keys (so reclamation is exercised).  The same
+ * run is repeated with every lookup taken under a single mutex, which is
+ * what a conventionally locked table would cost.
+ */
+
+#define BENCH_CHURN_KEYS 1024
+
+typedef struct BenchKey_t
+{
+    char key[LOCK_KEY_LEN];        /* Lock table style key */
+    size_t keyLength;              /* Bytes used in 'key' */
+}BenchKey_t;
+
+typedef struct BenchStruct_t
+{
+    ConcurrentMap_t *map;          /* Map under test */
+    BenchKey_t *keys;              /* Preloaded keys, built once up front */
+    pthread_mutex_t mutex;         /* Used by the locked variant only */
+    int numEntries;                /* Keys preloaded into the map */
+    bool useMutex;                 /* Take 'mutex' around every lookup */
+    volatile int stop;             /* Set to end the run */
+}BenchStruct_t;
+
+typedef struct ReaderStruct_t
+{
+    BenchStruct_t *bench;          /* Shared benchmark state */
+    unsigned int seed;             /* Per-thread PRNG state */
+    unsigned long lookups;         /* Lookups done */
+    unsigned long hits;            /* Lookups that found a value */
+}ReaderStruct_t;
+
+static size_t BuildKey(char *key, int index)
+{
+    char fileName[32];
+    size_t machineLength = strlen("client_1") + 1;
+    size_t fileLength = snprintf(fileName, sizeof(fileName), "file_%d.txt", index);
+
+    memcpy(key, "client_1", machineLength);
+    memcpy(key + machineLength, fileName, fileLength);
+
+    return machineLength + fileLength;
+}
+
+static double Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void *ReaderThread(void *arg)
+{
+    ReaderStruct_t *reader = arg;
+    BenchStruct_t *bench = reader->bench;
+
+    while(bench->stop == 0)
+    {
+        BenchKey_t *key = &bench->keys[rand_r(&reader->seed) % bench->numEntries];
+
+        if(bench->useMutex == true)
+        {
+            pthread_mutex_lock(&bench->mutex);
+        }
+        EpochEnter();
+
+        if(MapLookup(bench->map, key->key, key->keyLength) != NULL)
+        {
+            reader->hits++;
+        }
+
+        EpochExit();
+        if(bench->useMutex == true)
+        {
+            pthread_mutex_unlock(&bench->mutex);
+        }
+
+        reader->lookups++;
+    }
+
+    return NULL;
+}
+
+static void *WriterThread(void *arg)
+{
+    BenchStruct_t *bench = arg;
+    char key[LOCK_KEY_LEN];
+    int i = 0;
+
+    while(bench->stop == 0)
+    {
+        /* Churn keys above the preloaded range */
+        size_t keyLength = BuildKey(key, bench->numEntries + (i % BENCH_CHURN_KEYS));
+        int *value = malloc(sizeof(int));
+
+        if(bench->useMutex == true)
+        {
+            pthread_mutex_lock(&bench->mutex);
+        }
+
+        if(MapInsert(bench->map, key, keyLength, value) == NULL)
+        {
+            free(value);
+        }
+        keyLength = BuildKey(key, bench->numEntries + ((i + BENCH_CHURN_KEYS / 2) % BENCH_CHURN_KEYS));
+        MapRemove(bench->map, key, keyLength);
+
+        if(bench->useMutex == true)
+        {
+            pthread_mutex_unlock(&bench->mutex);
+        }
+
+        i++;
+    }
+
+    return NULL;
+}
+
+static double RunStep(BenchStruct_t *bench, int numThreads, double seconds)
+{
+    pthread_t threads[numThreads];
+    ReaderStruct_t readers[numThreads];
+    pthread_t writer;
+    unsigned long totalLookups = 0;
+    double start = 0;
+    double elapsed = 0;
+
+    bench->stop = 0;
+    start = Now();
+
+    pthread_create(&writer, NULL, WriterThread, bench);
+    for(int i = 0; i < numThreads; i++)
+    {
+        memset(&readers[i], 0, sizeof(ReaderStruct_t));
+        readers[i].bench = bench;
+        readers[i].seed = i + 1;
+        pthread_create(&threads[i], NULL, ReaderThread, &readers[i]);
+    }
+
+    while(Now() - start < seconds)
+    {
+        struct timespec ts = {0, 10000000};
+        nanosleep(&ts, NULL);
+    }
+    bench->stop = 1;
+
+    for(int i = 0; i < numThreads; i++)
+    {
+        pthread_join(threads[i], NULL);
+        totalLookups += readers[i].lookups;
+    }
+    pthread_join(writer, NULL);
+
+    elapsed = Now() - start;
+
+    return totalLookups / elapsed;
+}
+
+int main(int argc, char *argv[])
+{
+    BenchStruct_t bench;
+    int maxThreads = 64;
+    double seconds = 0.5;
+
+    memset(&bench, 0, sizeof(BenchStruct_t));
+    bench.numEntries = 100000;
+
+    if (argc > 4)
+    {
+        printError("Usage: %s [max threads] [table entries] [seconds per step]", argv[0]);
+        return ERROR;
+    }
+    if (argc > 1)
+    {
+        maxThreads = strtol(argv[1], NULL, 10);
+    }
+    if (argc > 2)
+    {
+        bench.numEntries = strtol(argv[2], NULL, 10);
+    }
+    if (argc > 3)
+    {
+        seconds = strtod(argv[3], NULL);
+    }
+
+    if(((bench.map = MapCreate(bench.numEntries, free)) == NULL) ||
+       ((bench.keys = malloc(sizeof(BenchKey_t) * bench.numEntries)) == NULL))
+    {
+        printErrno("Can't allocate %d entries", bench.numEntries);
+        return ERROR;
+    }
+    pthread_mutex_init(&bench.mutex, NULL);
+
+    /* Preload the table */
+    for(int i = 0; i < bench.numEntries; i++)
+    {
+        int *value = malloc(sizeof(int));
+
+        *value = i;
+        bench.keys[i].keyLength = BuildKey(bench.keys[i].key, i);
+        MapInsert(bench.map, bench.keys[i].key, bench.keys[i].keyLength, value);
+    }
+
+    printf("%-8s %18s %18s\n", "threads", "epoch lookups/s", "mutex lookups/s");
+
+    for(int numThreads = 1; numThreads <= maxThreads; numThreads *= 2)
+    {
+        double epochRate = 0;
+        double mutexRate = 0;
+
+        bench.useMutex = false;
+        epochRate = RunStep(&bench, numThreads, seconds);
+
+        bench.useMutex = true;
+        mutexRate = RunStep(&bench, numThreads, seconds);
+
+        printf("%-8d %18.0f %18.0f\n", numThreads, epochRate, mutexRate);
+    }
+
+    MapDestroy(bench.map);
+    free(bench.keys);
+
+    return OK;
+}
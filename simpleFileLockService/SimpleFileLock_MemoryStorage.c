@@ -0,0 +1,199 @@
+#include "SimpleFileLock_Storage.h"
+#include "SimpleFileLock_Map.h"
+
+#include <stdlib.h>     /* for malloc() and realloc() */
+#include <string.h>     /* for memcpy() and strlen() */
+
+/*
+ * Files held in process memory, for measuring the protocol and lock layers
+ * without the disk.  A file is a growable buffer in a map keyed by path; the
+ * handle is the buffer and the position lives in lockNode->byteOffset.
+ * Files are never removed, like files on disk.
+ */
+
+#define MEMORY_FILE_BUCKETS 1024
+#define MEMORY_FILE_MIN     64      /* Smallest buffer allocated for a file */
+
+typedef struct MemoryFile_t
+{
+    char *data;
+    size_t size;                   /* Bytes of file contents */
+    size_t capacity;               /* Bytes allocated for data */
+}MemoryFile_t;
+
+static ConcurrentMap_t *memoryFiles;
+
+static void MemoryFileFree(void *value)
+{
+    MemoryFile_t *file = value;
+
+    free(file->data);
+    free(file);
+}
+
+static void *MemoryOpen(ParsedOperation_t *parsed)
+{
+    MemoryFile_t *file = NULL;
+    size_t keyLength = strlen(parsed->filePath);
+
+    if((memoryFiles == NULL) && ((memoryFiles = MapCreate(MEMORY_FILE_BUCKETS, MemoryFileFree)) == NULL))
+    {
+        errno = ENOMEM;
+    }
+    else if((file = MapLookup(memoryFiles, parsed->filePath, keyLength)) != NULL)
+    {
+        /* "w+" truncates, "a" keeps the contents */
+        if(parsed->mode[0] == 'w')
+        {
+            file->size = 0;
+        }
+    }
+    /* "r" and "r+" need an existing file */
+    else if(parsed->mode[0] == 'r')
+    {
+        errno = ENOENT;
+    }
+    else if((file = calloc(1, sizeof(MemoryFile_t))) == NULL)
+    {
+        errno = ENOMEM;
+    }
+    else if(MapInsert(memoryFiles, parsed->filePath, keyLength, file) == NULL)
+    {
+        free(file);
+        file = NULL;
+        errno = EEXIST;
+    }
+
+    return file;
+}
+
+static int MemoryClose(LockTableNode_t *lockNode)
+{
+    return OK;
+}
+
+static int MemoryRead(LockTableNode_t *lockNode, ParsedOperation_t *parsed, char *buffer)
+{
+    MemoryFile_t *file = lockNode->fileHandle;
+    int bytesRead = 0;
+
+    if((size_t)lockNode->byteOffset < file->size)
+    {
+        bytesRead = file->size - lockNode->byteOffset;
+        if(bytesRead > parsed->numBytes)
+        {
+            bytesRead = parsed->numBytes;
+        }
+
+        memcpy(buffer, file->data + lockNode->byteOffset, bytesRead);
+        lockNode->byteOffset += bytesRead;
+    }
+
+    return bytesRead;
+}
+
+static int MemoryWrite(LockTableNode_t *lockNode, ParsedOperation_t *parsed)
+{
+    MemoryFile_t *file = lockNode->fileHandle;
+    size_t length = strlen(parsed->messageString);
+    size_t end = 0;
+    size_t capacity = file->capacity;
+    char *data = file->data;
+    int status = ERROR;
+
+    if(lockNode->append == true)
+    {
+        lockNode->byteOffset = file->size;
+    }
+    end = lockNode->byteOffset + length;
+
+    if(end > capacity)
+    {
+        capacity = (capacity < MEMORY_FILE_MIN) ? MEMORY_FILE_MIN : capacity;
+        while(capacity < end)
+        {
+            capacity *= 2;
+        }
+
+        if((data = realloc(file->data, capacity)) != NULL)
+        {
+            file->data = data;
+            file->capacity = capacity;
+        }
+        else
+        {
+            errno = ENOMEM;
+        }
+    }
+
+    if(end <= file->capacity)
+    {
+        /* Writing past the end leaves a hole of zeros, as fseek() then fputs() would */
+        if((size_t)lockNode->byteOffset > file->size)
+        {
+            memset(file->data + file->size, 0, lockNode->byteOffset - file->size);
+        }
+
+        memcpy(file->data + lockNode->byteOffset, parsed->messageString, length);
+        lockNode->byteOffset = end;
+        if(end > file->size)
+        {
+            file->size = end;
+        }
+        status = OK;
+    }
+
+    return status;
+}
+
+/* Nothing can write the file while it is read locked, so the buffer holds still */
+static const char *MemoryReadReference(LockTableNode_t *lockNode, ParsedOperation_t *parsed, int *length)
+{
+    MemoryFile_t *file = lockNode->fileHandle;
+    const char *data = NULL;
+
+    if(lockNode->lockStatus == READ_LOCK)
+    {
+        *length = 0;
+        data = file->data;
+
+        if((size_t)lockNode->byteOffset < file->size)
+        {
+            *length = file->size - lockNode->byteOffset;
+            if(*length > parsed->numBytes)
+            {
+                *length = parsed->numBytes;
+            }
+
+            data = file->data + lockNode->byteOffset;
+            lockNode->byteOffset += *length;
+        }
+    }
+
+    return data;
+}
+
+static int MemoryLseek(LockTableNode_t *lockNode, ParsedOperation_t *parsed)
+{
+    lockNode->byteOffset = parsed->numBytes;
+
+    return OK;
+}
+
+static long MemoryTell(LockTableNode_t *lockNode)
+{
+    return lockNode->byteOffset;
+}
+
+StorageBackend_t MemoryStorage =
+{
+    "memory",
+    MemoryOpen,
+    MemoryClose,
+    MemoryRead,
+    MemoryWrite,
+    MemoryLseek,
+    MemoryTell,
+    MemoryReadReference,
+    NULL
+};
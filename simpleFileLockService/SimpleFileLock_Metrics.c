@@ -0,0 +1,522 @@
+#include "SimpleFileLock_Metrics.h"
+#include "SimpleFileLock_Log.h"
+#include "SimpleFileLock_Trace.h"
+
+#include <stdio.h>      /* for snprintf() */
+#include <stdlib.h>     /* for realloc() */
+#include <string.h>     /* for strcmp() */
+#include <stdbool.h>    /* for bool */
+#include <unistd.h>     /* for close() */
+#include <pthread.h>    /* for pthread_create() */
+#include <time.h>       /* for clock_gettime() */
+#include <sys/socket.h> /* for socket(), bind() and accept() */
+#include <arpa/inet.h>  /* for sockaddr_in and htonl() */
+
+#define METRICS_MAX_ENTRIES   64
+#define METRICS_PAGE_SIZE     (256 * 1024)
+
+typedef enum MetricType_t
+{
+    METRIC_GAUGE       = 0,
+    METRIC_COUNTER     = 1,
+    METRIC_INT_COUNTER = 2,
+    METRIC_HISTOGRAM   = 3
+}MetricType_t;
+
+typedef struct MetricEntry_t
+{
+    MetricType_t type;             /* How to read 'value' */
+    const char *name;              /* Family name */
+    const char *help;              /* HELP text */
+    const char *label;             /* Label set without braces, or NULL */
+    void *value;                   /* Gauge callback, counter or histogram */
+    int isTime;                    /* Histogram values are ns */
+}MetricEntry_t;
+
+static MetricEntry_t metricEntries[METRICS_MAX_ENTRIES];
+static int numMetricEntries;
+static int metricsEnabled;
+static int metricsSockfd = -1;
+static pthread_t metricsThread;
+
+/* Request path metrics */
+static Histogram_t opHistograms[METRIC_NUM_OPS];
+static Histogram_t stageHistograms[METRIC_NUM_STAGES];
+static uint64_t actionCounters[METRIC_NUM_ACTIONS];
+static Histogram_t queueHistogram;
+
+static const char *opNames[METRIC_NUM_OPS] = {"open", "close", "read", "write", "lseek", "readat", "writeat", "other"};
+static const char *opLabels[METRIC_NUM_OPS] = {"op=\"open\"", "op=\"close\"", "op=\"read\"", "op=\"write\"", "op=\"lseek\"", "op=\"readat\"", "op=\"writeat\"", "op=\"other\""};
+static const char *stageNames[METRIC_NUM_STAGES] = {"validate", "parse", "lock", "storage", "send"};
+static const char *stageLabels[METRIC_NUM_STAGES] = {"stage=\"validate\"", "stage=\"parse\"", "stage=\"lock\"", "stage=\"storage\"", "stage=\"send\""};
+static const char *actionLabels[METRIC_NUM_ACTIONS] = {"action=\"drop_request_send_nothing\"", "action=\"process_request_send_nothing\"", "action=\"process_request_send_response\"", "action=\"send_stored_response\""};
+
+/* Exported bucket bounds, in seconds for latencies and as-is for counts */
+static const double timeBounds[] = {1e-6, 2e-6, 5e-6, 1e-5, 2e-5, 5e-5, 1e-4, 2e-4, 5e-4, 1e-3, 2e-3, 5e-3, 1e-2, 2e-2, 5e-2, 0.1, 0.2, 0.5, 1, 2, 5, 10};
+static const double countBounds[] = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512, 1024, 4096, 16384, 65536};
+
+static int HistogramIndex(uint64_t value)
+{
+    int msb = 0;
+
+    if(value < HISTOGRAM_SUB_BUCKETS)
+    {
+        return (int)value;
+    }
+
+    msb = 63 - __builtin_clzll(value);
+
+    /* Top HISTOGRAM_SUB_BITS + 1 bits select the sub-bucket */
+    return HISTOGRAM_SUB_BUCKETS +
+           (msb - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_BUCKETS +
+           (int)((value >> (msb - HISTOGRAM_SUB_BITS)) - HISTOGRAM_SUB_BUCKETS);
+}
+
+/* Largest value that lands in bucket 'index' */
+static uint64_t HistogramUpperBound(int index)
+{
+    int magnitude = 0;
+    uint64_t subBucket = 0;
+
+    if(index < HISTOGRAM_SUB_BUCKETS)
+    {
+        return (uint64_t)index;
+    }
+
+    magnitude = (index - HISTOGRAM_SUB_BUCKETS) / HISTOGRAM_SUB_BUCKETS;
+    subBucket = (index - HISTOGRAM_SUB_BUCKETS) % HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BUCKETS;
+
+    return ((subBucket + 1) << magnitude) - 1;
+}
+
+void HistogramRecord(Histogram_t *histogram, uint64_t value)
+{
+    uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+
+    __atomic_fetch_add(&histogram->buckets[HistogramIndex(value)], 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->sum, value, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&histogram->count, 1, __ATOMIC_RELAXED);
+
+    while((value > max) &&
+          !__atomic_compare_exchange_n(&histogram->max, &max, value, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    {
+    }
+}
+
+uint64_t HistogramQuantile(Histogram_t *histogram, double quantile)
+{
+    uint64_t count = __atomic_load_n(&histogram->count, __ATOMIC_RELAXED);
+    uint64_t rank = (uint64_t)(quantile * count + 0.5);
+    uint64_t seen = 0;
+
+    if(count == 0)
+    {
+        return 0;
+    }
+    if(rank < 1)
+    {
+        rank = 1;
+    }
+
+    for(int i = 0; i < HISTOGRAM_NUM_BUCKETS; i++)
+    {
+        seen += __atomic_load_n(&histogram->buckets[i], __ATOMIC_RELAXED);
+        if(seen >= rank)
+        {
+            uint64_t bound = HistogramUpperBound(i);
+            uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+            return (bound < max) ? bound : max;
+        }
+    }
+
+    return __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+}
+
+uint64_t MetricsNow(void)
+{
+    struct timespec ts;
+
+    /* Tracing needs the stage timestamps too */
+    if((__atomic_load_n(&metricsEnabled, __ATOMIC_RELAXED) == 0) &&
+       (__atomic_load_n(&traceSampleRate, __ATOMIC_RELAXED) == 0))
+    {
+        return 0;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+int MetricsEnabled(void)
+{
+    return __atomic_load_n(&metricsEnabled, __ATOMIC_RELAXED);
+}
+
+MetricsOp_t MetricsOpFromOperation(const char *operation)
+{
+    size_t length = strcspn(operation, " \r\n");
+
+    for(int op = 0; op < METRIC_OP_OTHER; op++)
+    {
+        if((strlen(opNames[op]) == length) && (strncmp(operation, opNames[op], length) == 0))
+        {
+            return (MetricsOp_t)op;
+        }
+    }
+
+    return METRIC_OP_OTHER;
+}
+
+void MetricsRecordOp(MetricsOp_t op, uint64_t startTime)
+{
+    if(startTime != 0)
+    {
+        HistogramRecord(&opHistograms[op], MetricsNow() - startTime);
+    }
+}
+
+void MetricsStageEnd(MetricsStage_t stage, uint64_t *stageStart)
+{
+    if(*stageStart != 0)
+    {
+        uint64_t now = MetricsNow();
+
+        HistogramRecord(&stageHistograms[stage], now - *stageStart);
+        TraceSpan(stageNames[stage], *stageStart, now);
+        *stageStart = now;
+    }
+}
+
+void MetricsCountAction(int action)
+{
+    if((action >= 0) && (action < METRIC_NUM_ACTIONS))
+    {
+        __atomic_fetch_add(&actionCounters[action], 1, __ATOMIC_RELAXED);
+    }
+}
+
+void MetricsRecordQueueDelay(uint64_t queueDelay)
+{
+    if(__atomic_load_n(&metricsEnabled, __ATOMIC_RELAXED) != 0)
+    {
+        HistogramRecord(&queueHistogram, queueDelay);
+    }
+}
+
+static void RegisterEntry(MetricType_t type, const char *name, const char *help, const char *label, void *value, int isTime)
+{
+    if(numMetricEntries < METRICS_MAX_ENTRIES)
+    {
+        metricEntries[numMetricEntries].type = type;
+        metricEntries[numMetricEntries].name = name;
+        metricEntries[numMetricEntries].help = help;
+        metricEntries[numMetricEntries].label = label;
+        metricEntries[numMetricEntries].value = value;
+        metricEntries[numMetricEntries].isTime = isTime;
+        numMetricEntries++;
+    }
+    else
+    {
+        printError("Too many metrics, dropping %s", name);
+    }
+}
+
+void MetricsRegisterGauge(const char *name, const char *help, const char *label, MetricsGauge_t gauge)
+{
+    RegisterEntry(METRIC_GAUGE, name, help, label, (void *)gauge, 0);
+}
+
+void MetricsRegisterCounter(const char *name, const char *help, const char *label, uint64_t *counter)
+{
+    RegisterEntry(METRIC_COUNTER, name, help, label, counter, 0);
+}
+
+void MetricsRegisterIntCounter(const char *name, const char *help, const char *label, int *counter)
+{
+    RegisterEntry(METRIC_INT_COUNTER, name, help, label, counter, 0);
+}
+
+void MetricsRegisterHistogram(const char *name, const char *help, const char *label, Histogram_t *histogram, int isTime)
+{
+    RegisterEntry(METRIC_HISTOGRAM, name, help, label, histogram, isTime);
+}
+
+/* "{label}" / "{label,extra}" / "{extra}" / "" */
+static void FormatLabels(char *labels, size_t size, const char *label, const char *extra)
+{
+    if((label != NULL) && (extra != NULL))
+    {
+        snprintf(labels, size, "{%s,%s}", label, extra);
+    }
+    else if((label != NULL) || (extra != NULL))
+    {
+        snprintf(labels, size, "{%s}", (label != NULL) ? label : extra);
+    }
+    else
+    {
+        labels[0] = '\0';
+    }
+}
+
+static size_t FormatHistogram(char *page, size_t size, MetricEntry_t *entry)
+{
+    Histogram_t *histogram = entry->value;
+    const double *bounds = entry->isTime ? timeBounds : countBounds;
+    int numBounds = entry->isTime ? sizeof(timeBounds) / sizeof(double) : sizeof(countBounds) / sizeof(double);
+    double scale = entry->isTime ? 1e-9 : 1;
+    uint64_t cumulative = 0;
+    char labels[160];
+    char extra[48];
+    size_t used = 0;
+    int bucket = 0;
+
+    for(int i = 0; (i < numBounds) && (used < size); i++)
+    {
+        /* Sum every HDR bucket that lies entirely below this bound */
+        while((bucket < HISTOGRAM_NUM_BUCKETS) && (HistogramUpperBound(bucket) * scale <= bounds[i]))
+        {
+            cumulative += __atomic_load_n(&histogram->buckets[bucket], __ATOMIC_RELAXED);
+            bucket++;
+        }
+
+        snprintf(extra, sizeof(extra), "le=\"%g\"", bounds[i]);
+        FormatLabels(labels, sizeof(labels), entry->label, extra);
+        used += snprintf(page + used, size - used, "%s_bucket%s %llu\n", entry->name, labels, (unsigned long long)cumulative);
+    }
+
+    if(used < size)
+    {
+        FormatLabels(labels, sizeof(labels), entry->label, "le=\"+Inf\"");
+        used += snprintf(page + used, size - used, "%s_bucket%s %llu\n", entry->name, labels, (unsigned long long)__atomic_load_n(&histogram->count, __ATOMIC_RELAXED));
+    }
+    if(used < size)
+    {
+        FormatLabels(labels, sizeof(labels), entry->label, NULL);
+        used += snprintf(page + used, size - used, "%s_sum%s %g\n%s_count%s %llu\n",
+                         entry->name, labels, __atomic_load_n(&histogram->sum, __ATOMIC_RELAXED) * scale,
+                         entry->name, labels, (unsigned long long)__atomic_load_n(&histogram->count, __ATOMIC_RELAXED));
+    }
+
+    return used;
+}
+
+static size_t FormatQuantiles(char *page, size_t size, MetricEntry_t *entry)
+{
+    static const double quantiles[] = {0.5, 0.9, 0.99, 0.999, 1.0};
+    double scale = entry->isTime ? 1e-9 : 1;
+    char labels[160];
+    char extra[48];
+    size_t used = 0;
+
+    for(size_t i = 0; (i < sizeof(quantiles) / sizeof(double)) && (used < size); i++)
+    {
+        snprintf(extra, sizeof(extra), "quantile=\"%g\"", quantiles[i]);
+        FormatLabels(labels, sizeof(labels), entry->label, extra);
+        used += snprintf(page + used, size - used, "%s_quantile%s %g\n", entry->name, labels, HistogramQuantile(entry->value, quantiles[i]) * scale);
+    }
+
+    return used;
+}
+
+/* Render every metric, grouping entries that share a family name */
+static size_t FormatMetrics(char *page, size_t size)
+{
+    static const char *typeNames[] = {"gauge", "counter", "counter", "histogram"};
+    size_t used = 0;
+
+    for(int i = 0; (i < numMetricEntries) && (used < size); i++)
+    {
+        MetricEntry_t *first = &metricEntries[i];
+        bool isFirst = true;
+
+        /* Only handle each family once, at its first entry */
+        for(int j = 0; j < i; j++)
+        {
+            if(strcmp(metricEntries[j].name, first->name) == 0)
+            {
+                isFirst = false;
+                break;
+            }
+        }
+        if(isFirst == false)
+        {
+            continue;
+        }
+
+        used += snprintf(page + used, size - used, "# HELP %s %s\n# TYPE %s %s\n", first->name, first->help, first->name, typeNames[first->type]);
+
+        for(int j = i; (j < numMetricEntries) && (used < size); j++)
+        {
+            MetricEntry_t *entry = &metricEntries[j];
+            char labels[160];
+
+            if(strcmp(entry->name, first->name) != 0)
+            {
+                continue;
+            }
+
+            FormatLabels(labels, sizeof(labels), entry->label, NULL);
+
+            switch(entry->type)
+            {
+                case METRIC_GAUGE:
+                    used += snprintf(page + used, size - used, "%s%s %g\n", entry->name, labels, ((MetricsGauge_t)entry->value)());
+                    break;
+                case METRIC_COUNTER:
+                    used += snprintf(page + used, size - used, "%s%s %llu\n", entry->name, labels, (unsigned long long)__atomic_load_n((uint64_t *)entry->value, __ATOMIC_RELAXED));
+                    break;
+                case METRIC_INT_COUNTER:
+                    used += snprintf(page + used, size - used, "%s%s %d\n", entry->name, labels, __atomic_load_n((int *)entry->value, __ATOMIC_RELAXED));
+                    break;
+                case METRIC_HISTOGRAM:
+                    used += FormatHistogram(page + used, size - used, entry);
+                    break;
+            }
+        }
+
+        /* Precomputed quantiles from the same histograms, as a gauge family */
+        if((first->type == METRIC_HISTOGRAM) && (used < size))
+        {
+            used += snprintf(page + used, size - used, "# HELP %s_quantile %s (quantiles)\n# TYPE %s_quantile gauge\n", first->name, first->help, first->name);
+
+            for(int j = i; (j < numMetricEntries) && (used < size); j++)
+            {
+                if(strcmp(metricEntries[j].name, first->name) == 0)
+                {
+                    used += FormatQuantiles(page + used, size - used, &metricEntries[j]);
+                }
+            }
+        }
+    }
+
+    return (used < size) ? used : size;
+}
+
+static void *MetricsThread(void *arg)
+{
+    char *page = NULL;
+    char header[128];
+    char request[1024];
+
+    (void)arg;
+
+    if((page = malloc(METRICS_PAGE_SIZE)) == NULL)
+    {
+        printErrno("Malloc failed%s", "");
+        return NULL;
+    }
+
+    for(;;) /* Run forever */
+    {
+        int connection = -1;
+        size_t pageLength = 0;
+        int headerLength = 0;
+
+        if((connection = accept(metricsSockfd, NULL, NULL)) < 0)
+        {
+            printErrno("Can't accept metrics connection%s", "");
+            continue;
+        }
+
+        memset(request, 0, sizeof(request));
+
+        /* GET /trace dumps the request traces, anything else gets the full page */
+        if(recv(connection, request, sizeof(request) - 1, 0) >= 0)
+        {
+            if(strncmp(request, "GET /trace", strlen("GET /trace")) == 0)
+            {
+                char path[64];
+                int numEvents = TraceDump(path, sizeof(path));
+
+                if(numEvents >= 0)
+                {
+                    pageLength = snprintf(page, METRICS_PAGE_SIZE, "Wrote %d trace events to %s\n", numEvents, path);
+                }
+                else
+                {
+                    pageLength = snprintf(page, METRICS_PAGE_SIZE, "Trace dump failed\n");
+                }
+            }
+            else
+            {
+                pageLength = FormatMetrics(page, METRICS_PAGE_SIZE);
+            }
+            headerLength = snprintf(header, sizeof(header),
+                                    "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", pageLength);
+
+            if((send(connection, header, headerLength, MSG_NOSIGNAL) != headerLength) ||
+               (send(connection, page, pageLength, MSG_NOSIGNAL) != (ssize_t)pageLength))
+            {
+                printErrno("Can't send metrics%s", "");
+            }
+        }
+
+        close(connection);
+    }
+
+    return NULL;
+}
+
+int MetricsStart(int port)
+{
+    struct sockaddr_in metricsAddr;
+    int status = -1;
+    int reuse = 1;
+
+    /* Request path metrics */
+    for(int op = 0; op < METRIC_NUM_OPS; op++)
+    {
+        MetricsRegisterHistogram("sfl_request_latency_seconds", "End to end request handling time by operation", opLabels[op], &opHistograms[op], 1);
+    }
+    for(int stage = 0; stage < METRIC_NUM_STAGES; stage++)
+    {
+        MetricsRegisterHistogram("sfl_stage_latency_seconds", "Request handling time by stage", stageLabels[stage], &stageHistograms[stage], 1);
+    }
+    MetricsRegisterHistogram("sfl_queue_delay_seconds", "Time between kernel arrival and the server reading the request", NULL, &queueHistogram, 1);
+    for(int action = 0; action < METRIC_NUM_ACTIONS; action++)
+    {
+        MetricsRegisterCounter("sfl_request_actions_total", "Requests by ValidateClient() outcome", actionLabels[action], &actionCounters[action]);
+    }
+
+    if((metricsSockfd = socket(PF_INET, SOCK_STREAM, IPPROTO_TCP)) >= 0)
+    {
+        setsockopt(metricsSockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+        /* Local connections only */
+        memset(&metricsAddr, 0, sizeof(metricsAddr));
+        metricsAddr.sin_family = AF_INET;
+        metricsAddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        metricsAddr.sin_port = htons(port);
+
+        if((bind(metricsSockfd, (struct sockaddr *) &metricsAddr, sizeof(metricsAddr)) >= 0) &&
+           (listen(metricsSockfd, 8) >= 0))
+        {
+            if(pthread_create(&metricsThread, NULL, MetricsThread, NULL) == 0)
+            {
+                __atomic_store_n(&metricsEnabled, 1, __ATOMIC_RELEASE);
+                status = 0;
+            }
+            else
+            {
+                printErrno("Can't start metrics thread%s", "");
+            }
+        }
+        else
+        {
+            printErrno("Can't listen for metrics on port %d", port);
+        }
+
+        if(status != 0)
+        {
+            close(metricsSockfd);
+            metricsSockfd = -1;
+        }
+    }
+    else
+    {
+        printErrno("Can't create metrics socket%s", "");
+    }
+
+    return status;
+}
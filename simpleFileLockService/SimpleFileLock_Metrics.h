@@ -0,0 +1,90 @@
+#ifndef SIMPLEFILELOCK_METRICS_H
+#define SIMPLEFILELOCK_METRICS_H
+
+#include <stdint.h>     /* for uint64_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Server metrics.
+ *
+ * Latencies are kept in HDR-style log-linear histograms (16 sub-buckets per
+ * power of two, so a recorded value is within ~6% of its bucket), one per
+ * operation and one per request stage.  Recording is a few relaxed atomic
+ * adds, and nothing is timed until MetricsStart() has been called, so a server
+ * run without a metrics port pays only a branch per call.
+ *
+ * MetricsStart() serves every registered metric in Prometheus text format from
+ * a background thread listening on 127.0.0.1:<port>.
+ */
+
+#define HISTOGRAM_SUB_BITS    4
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_NUM_BUCKETS (HISTOGRAM_SUB_BUCKETS + (64 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_BUCKETS)
+
+typedef struct Histogram_t
+{
+    uint64_t count;                          /* Values recorded */
+    uint64_t sum;                            /* Sum of values recorded */
+    uint64_t max;                            /* Largest value recorded */
+    uint64_t buckets[HISTOGRAM_NUM_BUCKETS]; /* Log-linear buckets */
+}Histogram_t;
+
+typedef enum MetricsOp_t
+{
+    METRIC_OP_OPEN    = 0,
+    METRIC_OP_CLOSE   = 1,
+    METRIC_OP_READ    = 2,
+    METRIC_OP_WRITE   = 3,
+    METRIC_OP_LSEEK   = 4,
+    METRIC_OP_READAT  = 5,
+    METRIC_OP_WRITEAT = 6,
+    METRIC_OP_OTHER   = 7,  /* Unparseable or unknown command */
+    METRIC_NUM_OPS    = 8
+}MetricsOp_t;
+
+typedef enum MetricsStage_t
+{
+    METRIC_STAGE_VALIDATE = 0, /* ValidateClient() */
+    METRIC_STAGE_PARSE    = 1, /* Tokenizing the operation */
+    METRIC_STAGE_LOCK     = 2, /* Lock table lookup/insert */
+    METRIC_STAGE_STORAGE  = 3, /* File I/O or LogCabin RPC */
+    METRIC_STAGE_SEND     = 4, /* sendto() of the response */
+    METRIC_NUM_STAGES     = 5
+}MetricsStage_t;
+
+#define METRIC_NUM_ACTIONS 4   /* One counter per RequestAction_t */
+
+/* Returns the current value of a gauge */
+typedef double (*MetricsGauge_t)(void);
+
+int MetricsStart(int port);
+int MetricsEnabled(void);
+
+/* Registration (before MetricsStart()); 'label' may be NULL or e.g. "op=\"read\"".
+ * Histograms are exported in seconds when 'isTime' is set, else as plain counts */
+void MetricsRegisterGauge(const char *name, const char *help, const char *label, MetricsGauge_t gauge);
+void MetricsRegisterCounter(const char *name, const char *help, const char *label, uint64_t *counter);
+void MetricsRegisterIntCounter(const char *name, const char *help, const char *label, int *counter);
+void MetricsRegisterHistogram(const char *name, const char *help, const char *label, Histogram_t *histogram, int isTime);
+
+/* Monotonic time in ns, or 0 when metrics are off */
+uint64_t MetricsNow(void);
+
+void HistogramRecord(Histogram_t *histogram, uint64_t value);
+uint64_t HistogramQuantile(Histogram_t *histogram, double quantile);
+
+/* Request path helpers */
+MetricsOp_t MetricsOpFromOperation(const char *operation);
+void MetricsRecordOp(MetricsOp_t op, uint64_t startTime);
+void MetricsStageEnd(MetricsStage_t stage, uint64_t *stageStart);
+void MetricsCountAction(int action);
+void MetricsRecordQueueDelay(uint64_t queueDelay);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPLEFILELOCK_METRICS_H */
@@ -0,0 +1,604 @@
+#include "SimpleFileLock_Storage.h"
+#include "SimpleFileLock_Map.h"
+#include "SimpleFileLock_Metrics.h"
+
+#include <stdlib.h>     /* for malloc() */
+#include <string.h>     /* for strcpy() */
+#include <unistd.h>     /* for pread(), pwrite() and fdatasync() */
+#include <fcntl.h>      /* for open() */
+#include <sys/mman.h>   /* for mmap() */
+#include <sys/stat.h>   /* for fstat() */
+#include <time.h>       /* for nanosleep() */
+#include <pthread.h>    /* for pthread_create() */
+
+/*
+ * Local files through raw descriptors.  Reads and writes are pread()/pwrite()
+ * at lockNode->byteOffset, so there is no stdio buffer and no shared file
+ * position.  Descriptors are cached by path and stay open after the last
+ * close, so a client that opens and closes the same file repeatedly costs no
+ * open() after the first; idle descriptors beyond the cache size are closed
+ * least recently used first.
+ *
+ * Durability:
+ *   none   data reaches the page cache only
+ *   close  fdatasync() on close when the file was written
+ *   group  writes are acknowledged only once a group commit has synced them.
+ *          The first write to a clean cache opens a batch, the commit thread
+ *          waits up to N ms for more writes to join it, then fdatasync()s
+ *          every file dirtied in the batch and tells the engine, which sends
+ *          the held responses.  Writes made while a batch syncs go in the
+ *          next one, so one flush covers many requests under load.
+ *
+ * A file opened for reading only and at least --mmap-min bytes long is also
+ * mapped, and its reads are a copy from the mapping straight into the
+ * response.  The mapping belongs to the cache entry, is shared by every read
+ * lock on the file, and is unmapped when the last one is released; no write
+ * lock can be granted while it exists, so the file can't change under it.
+ *
+ * The cache is shared with the group commit thread, so every change to it is
+ * made under cacheMutex; the syscalls themselves are made without it.
+ */
+
+typedef struct FdCacheEntry_t
+{
+    char path[200];                /* machineName:fileName */
+    int fd;
+    int references;                /* Open handles plus in-flight syncs */
+    bool writable;                 /* fd is O_RDWR, not O_RDONLY */
+    bool dirty;                    /* Written since the last fdatasync() */
+    struct FdCacheEntry_t *idlePrev; /* Unreferenced entries, most recent first */
+    struct FdCacheEntry_t *idleNext;
+    struct FdCacheEntry_t *dirtyNext;
+    char *map;                     /* Read only mapping of the file, or NULL */
+    size_t mapLength;
+    int mapReferences;             /* Read locks sharing the mapping */
+}FdCacheEntry_t;
+
+#define PREAD_CACHE_BUCKETS 1024
+
+static ConcurrentMap_t *fdCache;
+static pthread_mutex_t cacheMutex = PTHREAD_MUTEX_INITIALIZER;
+static FdCacheEntry_t *idleHead;
+static FdCacheEntry_t *idleTail;
+static FdCacheEntry_t *dirtyHead;
+static int cacheSize = PREAD_DEFAULT_CACHE;
+static int cachedDescriptors;
+static StorageDurability_t durability = DURABILITY_NONE;
+static int groupMs = PREAD_DEFAULT_GROUP_MS;
+static long mmapMin = PREAD_DEFAULT_MMAP_MIN;
+static pthread_t groupThread;
+static pthread_cond_t batchCond = PTHREAD_COND_INITIALIZER;
+static StorageCommitted_t committedCallback;
+static uint64_t openTicket = 1;    /* Commit round the next write joins */
+static uint64_t writeTicket;       /* Round of the last write, for PreadCommitTicket() */
+static uint64_t batchStart;        /* When the open batch got its first write */
+static uint64_t batchWrites;       /* Writes in the open batch */
+
+static uint64_t cacheHits;
+static uint64_t cacheMisses;
+static uint64_t cacheEvictions;
+static uint64_t mappedReads;
+static Histogram_t syncHistogram;
+static Histogram_t batchWritesHistogram;
+static Histogram_t batchFilesHistogram;
+static Histogram_t commitHistogram;
+
+static uint64_t Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Caller holds cacheMutex */
+static void IdleRemove(FdCacheEntry_t *entry)
+{
+    if(entry->idlePrev != NULL)
+    {
+        entry->idlePrev->idleNext = entry->idleNext;
+    }
+    else
+    {
+        idleHead = entry->idleNext;
+    }
+
+    if(entry->idleNext != NULL)
+    {
+        entry->idleNext->idlePrev = entry->idlePrev;
+    }
+    else
+    {
+        idleTail = entry->idlePrev;
+    }
+
+    entry->idlePrev = NULL;
+    entry->idleNext = NULL;
+}
+
+/* Caller holds cacheMutex */
+static void IdlePush(FdCacheEntry_t *entry)
+{
+    entry->idlePrev = NULL;
+    entry->idleNext = idleHead;
+    if(idleHead != NULL)
+    {
+        idleHead->idlePrev = entry;
+    }
+    else
+    {
+        idleTail = entry;
+    }
+    idleHead = entry;
+}
+
+/* Caller holds cacheMutex */
+static void Reference(FdCacheEntry_t *entry)
+{
+    if(entry->references++ == 0)
+    {
+        IdleRemove(entry);
+    }
+}
+
+/* Caller holds cacheMutex */
+static void Unreference(FdCacheEntry_t *entry)
+{
+    if(--entry->references == 0)
+    {
+        IdlePush(entry);
+    }
+}
+
+/* Caller holds cacheMutex */
+static void MarkDirty(FdCacheEntry_t *entry)
+{
+    if(entry->dirty == false)
+    {
+        entry->dirty = true;
+
+        /* Only the group commit thread walks the dirty list */
+        if(durability == DURABILITY_GROUP)
+        {
+            entry->dirtyNext = dirtyHead;
+            dirtyHead = entry;
+        }
+    }
+
+    if(durability == DURABILITY_GROUP)
+    {
+        if(batchWrites++ == 0)
+        {
+            batchStart = Now();
+            pthread_cond_signal(&batchCond);
+        }
+        writeTicket = openTicket;
+    }
+}
+
+static void Sync(FdCacheEntry_t *entry)
+{
+    uint64_t start = MetricsNow();
+
+    if(fdatasync(entry->fd) != 0)
+    {
+        printErrno("fdatasync of %s failed", entry->path);
+    }
+
+    if(start != 0)
+    {
+        HistogramRecord(&syncHistogram, MetricsNow() - start);
+    }
+}
+
+/* Close idle descriptors, oldest first, until the cache fits.  Dirty ones
+ * wait for the group commit thread.  Caller holds cacheMutex */
+static void Evict(void)
+{
+    FdCacheEntry_t *entry = idleTail;
+    FdCacheEntry_t *previous = NULL;
+
+    while((cachedDescriptors > cacheSize) && (entry != NULL))
+    {
+        previous = entry->idlePrev;
+
+        if(entry->dirty == false)
+        {
+            IdleRemove(entry);
+            MapRemove(fdCache, entry->path, strlen(entry->path));
+            close(entry->fd);
+            cachedDescriptors--;
+            cacheEvictions++;
+        }
+
+        entry = previous;
+    }
+}
+
+static void *GroupCommitThread(void *arg)
+{
+    FdCacheEntry_t **batch = NULL;
+    int batchCapacity = 0;
+    int batchSize = 0;
+    uint64_t ticket = 0;
+    uint64_t writes = 0;
+    uint64_t start = 0;
+    uint64_t now = 0;
+
+    (void)arg;
+
+    for(;;) /* Run forever */
+    {
+        /* Wait for a batch to open, then give it groupMs to fill */
+        pthread_mutex_lock(&cacheMutex);
+        while(batchWrites == 0)
+        {
+            pthread_cond_wait(&batchCond, &cacheMutex);
+        }
+        start = batchStart;
+        pthread_mutex_unlock(&cacheMutex);
+
+        if((now = Now()) < start + groupMs * 1000000ULL)
+        {
+            uint64_t wait = start + groupMs * 1000000ULL - now;
+            struct timespec delay = {wait / 1000000000ULL, wait % 1000000000ULL};
+
+            nanosleep(&delay, NULL);
+        }
+
+        /* Close the batch; its entries stay referenced until synced */
+        pthread_mutex_lock(&cacheMutex);
+        ticket = openTicket++;
+        writes = batchWrites;
+        batchWrites = 0;
+        batchSize = 0;
+        for(FdCacheEntry_t *entry = dirtyHead; entry != NULL; entry = entry->dirtyNext)
+        {
+            if(batchSize == batchCapacity)
+            {
+                FdCacheEntry_t **grown = NULL;
+
+                if((grown = realloc(batch, sizeof(FdCacheEntry_t *) * (batchCapacity + 64))) == NULL)
+                {
+                    printErrno("Malloc failed%s", "");
+                    abort();
+                }
+                batch = grown;
+                batchCapacity += 64;
+            }
+
+            Reference(entry);
+            entry->dirty = false;
+            batch[batchSize++] = entry;
+        }
+        dirtyHead = NULL;
+        pthread_mutex_unlock(&cacheMutex);
+
+        for(int i = 0; i < batchSize; i++)
+        {
+            Sync(batch[i]);
+        }
+
+        /* Release the held responses */
+        committedCallback(ticket);
+
+        if(MetricsEnabled())
+        {
+            HistogramRecord(&batchWritesHistogram, writes);
+            HistogramRecord(&batchFilesHistogram, batchSize);
+            HistogramRecord(&commitHistogram, Now() - start);
+        }
+
+        pthread_mutex_lock(&cacheMutex);
+        for(int i = 0; i < batchSize; i++)
+        {
+            Unreference(batch[i]);
+        }
+        pthread_mutex_unlock(&cacheMutex);
+    }
+
+    return NULL;
+}
+
+status_t PreadStorageStart(int descriptors, StorageDurability_t mode, int intervalMs, long mapMinimum, StorageCommitted_t committed)
+{
+    status_t status = ERROR;
+
+    cacheSize = descriptors;
+    durability = mode;
+    groupMs = intervalMs;
+    mmapMin = mapMinimum;
+    committedCallback = committed;
+
+    MetricsRegisterCounter("sfl_fd_cache_hits_total", "Opens served by a cached descriptor", NULL, &cacheHits);
+    MetricsRegisterCounter("sfl_fd_cache_misses_total", "Opens that called open()", NULL, &cacheMisses);
+    MetricsRegisterCounter("sfl_fd_cache_evictions_total", "Idle descriptors closed to fit the cache", NULL, &cacheEvictions);
+    MetricsRegisterCounter("sfl_mapped_reads_total", "Reads served from a memory mapping", NULL, &mappedReads);
+    MetricsRegisterHistogram("sfl_fdatasync_seconds", "fdatasync() latency", NULL, &syncHistogram, 1);
+    if(durability == DURABILITY_GROUP)
+    {
+        MetricsRegisterHistogram("sfl_group_commit_writes", "Writes acknowledged per group commit", NULL, &batchWritesHistogram, 0);
+        MetricsRegisterHistogram("sfl_group_commit_files", "Files synced per group commit", NULL, &batchFilesHistogram, 0);
+        MetricsRegisterHistogram("sfl_group_commit_seconds", "First write of a group commit to its acknowledgement", NULL, &commitHistogram, 1);
+    }
+
+    if((fdCache = MapCreate(PREAD_CACHE_BUCKETS, free)) == NULL)
+    {
+        printError("Can't create descriptor cache%s", "");
+    }
+    else if((durability == DURABILITY_GROUP) && (groupMs < 0))
+    {
+        printError("Group commit delay can't be negative: %d ms", groupMs);
+    }
+    else if((durability == DURABILITY_GROUP) && (pthread_create(&groupThread, NULL, GroupCommitThread, NULL) != 0))
+    {
+        printErrno("Can't start group commit thread%s", "");
+    }
+    else
+    {
+        status = OK;
+    }
+
+    return status;
+}
+
+static void *PreadOpen(ParsedOperation_t *parsed)
+{
+    FdCacheEntry_t *entry = NULL;
+    size_t keyLength = strlen(parsed->filePath);
+    bool writable = (strcmp(parsed->mode, "r") != 0);
+    int fd = -1;
+
+    pthread_mutex_lock(&cacheMutex);
+    if((entry = MapLookup(fdCache, parsed->filePath, keyLength)) != NULL)
+    {
+        Reference(entry);
+        cacheHits++;
+    }
+    pthread_mutex_unlock(&cacheMutex);
+
+    if(entry == NULL)
+    {
+        /* "r" reads a file it may not write; only "w+" and "a" may create one */
+        if((fd = open(parsed->filePath, (writable == false) ? O_RDONLY : (parsed->mode[0] != 'r') ? (O_RDWR | O_CREAT) : O_RDWR, 0644)) >= 0)
+        {
+            if((entry = calloc(1, sizeof(FdCacheEntry_t))) != NULL)
+            {
+                strcpy(entry->path, parsed->filePath);
+                entry->fd = fd;
+                entry->writable = writable;
+                entry->references = 1;
+
+                pthread_mutex_lock(&cacheMutex);
+                MapInsert(fdCache, entry->path, keyLength, entry);
+                cachedDescriptors++;
+                cacheMisses++;
+                Evict();
+                pthread_mutex_unlock(&cacheMutex);
+            }
+            else
+            {
+                close(fd);
+                errno = ENOMEM;
+            }
+        }
+    }
+
+    /* A descriptor cached by a read becomes read/write in place.  The lock is
+     * exclusive and a read-only entry is never dirty, so nothing else uses it */
+    if((entry != NULL) && (writable == true) && (entry->writable == false))
+    {
+        if(((fd = open(parsed->filePath, O_RDWR)) >= 0) && (dup2(fd, entry->fd) >= 0))
+        {
+            entry->writable = true;
+        }
+        else
+        {
+            pthread_mutex_lock(&cacheMutex);
+            Unreference(entry);
+            pthread_mutex_unlock(&cacheMutex);
+            entry = NULL;
+        }
+
+        if(fd >= 0)
+        {
+            close(fd);
+        }
+    }
+
+    /* "w+" truncates */
+    if((entry != NULL) && (parsed->mode[0] == 'w') && (ftruncate(entry->fd, 0) != 0))
+    {
+        pthread_mutex_lock(&cacheMutex);
+        Unreference(entry);
+        pthread_mutex_unlock(&cacheMutex);
+        entry = NULL;
+    }
+
+    /* Readers share one mapping of a large file */
+    if((entry != NULL) && (parsed->lockType == READ_LOCK) && (entry->mapReferences++ == 0) && (mmapMin >= 0))
+    {
+        struct stat fileStat;
+
+        if((fstat(entry->fd, &fileStat) == 0) && (fileStat.st_size > 0) && (fileStat.st_size >= mmapMin))
+        {
+            if((entry->map = mmap(NULL, fileStat.st_size, PROT_READ, MAP_SHARED, entry->fd, 0)) != MAP_FAILED)
+            {
+                entry->mapLength = fileStat.st_size;
+            }
+            else
+            {
+                /* pread() still works */
+                printErrno("Can't map %s", entry->path);
+                entry->map = NULL;
+            }
+        }
+    }
+
+    return entry;
+}
+
+static int PreadClose(LockTableNode_t *lockNode)
+{
+    FdCacheEntry_t *entry = lockNode->fileHandle;
+    bool sync = false;
+
+    if((lockNode->lockStatus == READ_LOCK) && (--entry->mapReferences == 0) && (entry->map != NULL))
+    {
+        munmap(entry->map, entry->mapLength);
+        entry->map = NULL;
+        entry->mapLength = 0;
+    }
+
+    pthread_mutex_lock(&cacheMutex);
+    if((durability == DURABILITY_CLOSE) && (entry->dirty == true))
+    {
+        entry->dirty = false;
+        sync = true;
+    }
+    pthread_mutex_unlock(&cacheMutex);
+
+    if(sync == true)
+    {
+        Sync(entry);
+    }
+
+    pthread_mutex_lock(&cacheMutex);
+    Unreference(entry);
+    Evict();
+    pthread_mutex_unlock(&cacheMutex);
+
+    return OK;
+}
+
+static int PreadRead(LockTableNode_t *lockNode, ParsedOperation_t *parsed, char *buffer)
+{
+    FdCacheEntry_t *entry = lockNode->fileHandle;
+    int bytesRead = 0;
+    ssize_t result = 0;
+
+    if((lockNode->lockStatus == READ_LOCK) && (entry->map != NULL))
+    {
+        if((size_t)lockNode->byteOffset < entry->mapLength)
+        {
+            bytesRead = entry->mapLength - lockNode->byteOffset;
+            if(bytesRead > parsed->numBytes)
+            {
+                bytesRead = parsed->numBytes;
+            }
+
+            memcpy(buffer, entry->map + lockNode->byteOffset, bytesRead);
+            lockNode->byteOffset += bytesRead;
+        }
+        mappedReads++;
+    }
+    else
+    {
+        while((bytesRead < parsed->numBytes) &&
+              ((result = pread(entry->fd, buffer + bytesRead, parsed->numBytes - bytesRead, lockNode->byteOffset)) > 0))
+        {
+            bytesRead += result;
+            lockNode->byteOffset += result;
+        }
+    }
+
+    return (result < 0) ? ERROR : bytesRead;
+}
+
+/* Only a mapped file's data stays put after the call */
+static const char *PreadReadReference(LockTableNode_t *lockNode, ParsedOperation_t *parsed, int *length)
+{
+    FdCacheEntry_t *entry = lockNode->fileHandle;
+    const char *data = NULL;
+
+    if((lockNode->lockStatus == READ_LOCK) && (entry->map != NULL))
+    {
+        *length = 0;
+        data = entry->map;
+
+        if((size_t)lockNode->byteOffset < entry->mapLength)
+        {
+            *length = entry->mapLength - lockNode->byteOffset;
+            if(*length > parsed->numBytes)
+            {
+                *length = parsed->numBytes;
+            }
+
+            data = entry->map + lockNode->byteOffset;
+            lockNode->byteOffset += *length;
+        }
+        mappedReads++;
+    }
+
+    return data;
+}
+
+static int PreadWrite(LockTableNode_t *lockNode, ParsedOperation_t *parsed)
+{
+    FdCacheEntry_t *entry = lockNode->fileHandle;
+    size_t length = strlen(parsed->messageString);
+    size_t written = 0;
+    ssize_t result = 0;
+
+    /* Only this lock can write the file, so its end holds until the pwrite().
+     * Every other call is positioned, so moving the descriptor's offset is harmless */
+    if((lockNode->append == true) && ((result = lseek(entry->fd, 0, SEEK_END)) >= 0))
+    {
+        lockNode->byteOffset = result;
+    }
+
+    while((result >= 0) && (written < length) &&
+          ((result = pwrite(entry->fd, parsed->messageString + written, length - written, lockNode->byteOffset)) > 0))
+    {
+        written += result;
+        lockNode->byteOffset += result;
+    }
+
+    if((written > 0) && (durability != DURABILITY_NONE))
+    {
+        pthread_mutex_lock(&cacheMutex);
+        MarkDirty(entry);
+        pthread_mutex_unlock(&cacheMutex);
+    }
+
+    return (written == length) ? OK : ERROR;
+}
+
+static int PreadLseek(LockTableNode_t *lockNode, ParsedOperation_t *parsed)
+{
+    lockNode->byteOffset = parsed->numBytes;
+
+    return OK;
+}
+
+static long PreadTell(LockTableNode_t *lockNode)
+{
+    return lockNode->byteOffset;
+}
+
+/* Only the engine thread writes, so the last write's round is still here */
+static uint64_t PreadCommitTicket(void)
+{
+    uint64_t ticket = 0;
+
+    pthread_mutex_lock(&cacheMutex);
+    ticket = writeTicket;
+    writeTicket = 0;
+    pthread_mutex_unlock(&cacheMutex);
+
+    return ticket;
+}
+
+StorageBackend_t PreadStorage =
+{
+    "pread",
+    PreadOpen,
+    PreadClose,
+    PreadRead,
+    PreadWrite,
+    PreadLseek,
+    PreadTell,
+    PreadReadReference,
+    PreadCommitTicket
+};
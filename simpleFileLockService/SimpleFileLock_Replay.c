@@ -0,0 +1,586 @@
+/*
+ * Capture replay.
+ *
+ * Re-sends the requests in one or more capture files (written by a server
+ * run with --capture) to a test server, and compares each response with the
+ * one the captured server sent.
+ *
+ * Every captured client address gets its own socket, so the test server sees
+ * the same set of clients.  Captured sends that share (machineName,
+ * clientNumber, incarnation, requestNumber) are one request and its
+ * retransmits, and each replayed client behaves like SimpleFileLock_Client:
+ * it retransmits every CLIENT_RETRANSMIT_MS until its request is answered and
+ * only then moves on, so a response always belongs to the request its client
+ * last sent.
+ *
+ * By default each request goes out at its captured arrival time (or once its
+ * client's previous request is answered, if later); --speed N compresses the
+ * gaps N times, and --afap sends as fast as the server answers.
+ *
+ * The report counts matching, divergent and missing responses and prints the
+ * latency and number of sends of captured and replayed requests as tab
+ * separated rows:
+ *
+ *   run  requests  sends  mean_ns  p50_ns  p90_ns  p99_ns  p999_ns  max_ns
+ */
+
+#include <sys/socket.h>   /* for socket(), connect(), send() and recv() */
+#include <sys/epoll.h>    /* for epoll_create1() and epoll_wait() */
+#include <sys/resource.h> /* for setrlimit() */
+#include <arpa/inet.h>    /* for sockaddr_in and inet_addr() */
+#include <stdlib.h>       /* for strtol() and calloc() */
+#include <string.h>       /* for memset() */
+#include <unistd.h>       /* for close() */
+#include <getopt.h>       /* for getopt_long() */
+#include <time.h>         /* for clock_gettime() */
+
+#include "defns.h"
+#include "SimpleFileLock_Capture.h"
+#include "SimpleFileLock_Metrics.h"
+
+#define REPLAY_EPOLL_EVENTS   256
+#define REPLAY_DRAIN_MS       (10 * CLIENT_RETRANSMIT_MS) /* Wait for late responses */
+#define REPLAY_MAX_REPORTED   10                          /* Divergences printed */
+#define REPLAY_MAX_SENDS      50                          /* Then give up on a request */
+
+/* A capture record, with its strings allocated to size */
+typedef struct ReplayRecord_t
+{
+    CaptureHeader_t header;
+    char *machineName;
+    char *text;
+}ReplayRecord_t;
+
+/* One logical request: the first captured send and its retransmits */
+typedef struct ReplayGroup_t
+{
+    ReplayRecord_t *request;       /* First captured send */
+    ReplayRecord_t *captured;      /* First captured response, or NULL */
+    int capturedSends;             /* Including retransmits */
+    uint64_t capturedLatency;      /* First arrival to first response (ns) */
+    int sends;                     /* Replayed, including retransmits */
+    uint64_t firstSend;            /* Monotonic ns */
+    uint64_t replayLatency;        /* First send to first response (ns) */
+    bool answered;
+    int returnValue;               /* First replayed response */
+    char *returnString;
+}ReplayGroup_t;
+
+typedef struct ReplaySource_t
+{
+    uint32_t address;              /* Captured client address */
+    uint16_t port;
+    int sockfd;
+    int *groups;                   /* Indices into groups, in capture order */
+    int numGroups;
+    int maxGroups;
+    int next;                      /* Next of 'groups' to send */
+    int currentGroup;              /* Group responses are matched to, or -1 */
+    uint64_t lastSend;
+}ReplaySource_t;
+
+static ReplayRecord_t *records;
+static int numRecords;
+static int maxRecords;
+static ReplayGroup_t *groups;
+static int numGroups;
+static ReplaySource_t *sources;
+static int numSources;
+static int *sourceTable;           /* Open addressing, address:port to source + 1 */
+static size_t sourceTableMask;
+
+static double speed = 1.0;         /* 0 for as fast as possible */
+static bool verbose = false;
+
+static uint64_t Now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static status_t LoadCapture(const char *fileName)
+{
+    FILE *file_ptr = NULL;
+    CaptureRecord_t record;
+    int result = 0;
+    status_t status = ERROR;
+
+    if((file_ptr = fopen(fileName, "r")) == NULL)
+    {
+        printErrno("Can't open %s for reading", fileName);
+        return ERROR;
+    }
+
+    if(CaptureOpen(file_ptr) != 1)
+    {
+        printError("%s is not a capture file", fileName);
+    }
+    else
+    {
+        while((result = CaptureRead(file_ptr, &record)) == 1)
+        {
+            ReplayRecord_t *replayRecord = NULL;
+
+            if(numRecords == maxRecords)
+            {
+                maxRecords = (maxRecords == 0) ? 1024 : maxRecords * 2;
+                if((records = realloc(records, sizeof(ReplayRecord_t) * maxRecords)) == NULL)
+                {
+                    printErrno("Malloc failed%s", "");
+                    fclose(file_ptr);
+                    return ERROR;
+                }
+            }
+
+            replayRecord = &records[numRecords++];
+            replayRecord->header = record.header;
+            if(((replayRecord->machineName = strdup(record.machineName)) == NULL) ||
+               ((replayRecord->text = strdup(record.text)) == NULL))
+            {
+                printErrno("Malloc failed%s", "");
+                fclose(file_ptr);
+                return ERROR;
+            }
+        }
+
+        /* The server may have been killed mid-record */
+        if(result < 0)
+        {
+            printWarning("%s ends with a corrupt or partial record", fileName);
+        }
+        status = OK;
+    }
+
+    fclose(file_ptr);
+
+    return status;
+}
+
+static bool SameRequest(ReplayRecord_t *a, ReplayRecord_t *b)
+{
+    return (a->header.clientNumber == b->header.clientNumber) &&
+           (a->header.clientIncarnation == b->header.clientIncarnation) &&
+           (a->header.requestNumber == b->header.requestNumber) &&
+           (strcmp(a->machineName, b->machineName) == 0);
+}
+
+/* Returns the source for address:port, adding it if it's new */
+static int FindSource(uint32_t address, uint16_t port)
+{
+    size_t slot = (((uint64_t)address << 16 | port) * 0x9E3779B97F4A7C15ULL) >> 20;
+
+    for(slot &= sourceTableMask; sourceTable[slot] != 0; slot = (slot + 1) & sourceTableMask)
+    {
+        ReplaySource_t *source = &sources[sourceTable[slot] - 1];
+
+        if((source->address == address) && (source->port == port))
+        {
+            return sourceTable[slot] - 1;
+        }
+    }
+
+    sources[numSources].address = address;
+    sources[numSources].port = port;
+    sources[numSources].currentGroup = -1;
+    sourceTable[slot] = ++numSources;
+
+    return numSources - 1;
+}
+
+/* Split the records into sources and groups, and pair up captured responses */
+static status_t IndexCapture(void)
+{
+    for(sourceTableMask = 1; sourceTableMask < 2 * (size_t)numRecords; sourceTableMask <<= 1)
+    {
+    }
+    groups = calloc(numRecords, sizeof(ReplayGroup_t));
+    sources = calloc(numRecords, sizeof(ReplaySource_t));
+    sourceTable = calloc(sourceTableMask--, sizeof(int));
+    if((numRecords == 0) || (groups == NULL) || (sources == NULL) || (sourceTable == NULL))
+    {
+        printError("Nothing to replay%s", "");
+        return ERROR;
+    }
+
+    for(int i = 0; i < numRecords; i++)
+    {
+        ReplayRecord_t *record = &records[i];
+        ReplaySource_t *source = &sources[FindSource(record->header.address, record->header.port)];
+        ReplayGroup_t *last = (source->numGroups > 0) ? &groups[source->groups[source->numGroups - 1]] : NULL;
+
+        if(record->header.type == CAPTURE_REQUEST)
+        {
+            /* A retransmit repeats the client's previous request */
+            if((last != NULL) && SameRequest(last->request, record))
+            {
+                last->capturedSends++;
+                continue;
+            }
+
+            if(source->numGroups == source->maxGroups)
+            {
+                source->maxGroups = (source->maxGroups == 0) ? 64 : source->maxGroups * 2;
+                if((source->groups = realloc(source->groups, sizeof(int) * source->maxGroups)) == NULL)
+                {
+                    printErrno("Malloc failed%s", "");
+                    return ERROR;
+                }
+            }
+            groups[numGroups].request = record;
+            groups[numGroups].capturedSends = 1;
+            source->groups[source->numGroups++] = numGroups++;
+        }
+        /* Responses are captured right after their request, to the same address */
+        else if((last != NULL) && SameRequest(last->request, record) && (last->captured == NULL))
+        {
+            last->captured = record;
+            last->capturedLatency = (record->header.timestamp > last->request->header.timestamp) ? record->header.timestamp - last->request->header.timestamp : 0;
+        }
+    }
+
+    return OK;
+}
+
+static status_t OpenSources(char *serverIpAddress, int serverPortNumber, int epollfd)
+{
+    struct sockaddr_in serverAddr;
+    struct epoll_event event;
+    struct rlimit limit;
+
+    /* Every captured client needs a descriptor */
+    if((getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < limit.rlim_max))
+    {
+        limit.rlim_cur = limit.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    memset(&serverAddr, 0, sizeof(serverAddr));
+    serverAddr.sin_family = AF_INET;
+    serverAddr.sin_addr.s_addr = inet_addr(serverIpAddress);
+    serverAddr.sin_port = htons(serverPortNumber);
+
+    for(int i = 0; i < numSources; i++)
+    {
+        if((sources[i].sockfd = socket(PF_INET, SOCK_DGRAM | SOCK_NONBLOCK, IPPROTO_UDP)) < 0)
+        {
+            printErrno("Can't create socket for client %d", i);
+            return ERROR;
+        }
+        if(connect(sources[i].sockfd, (struct sockaddr *)&serverAddr, sizeof(serverAddr)) != 0)
+        {
+            printErrno("Can't connect socket for client %d", i);
+            return ERROR;
+        }
+
+        memset(&event, 0, sizeof(event));
+        event.events = EPOLLIN;
+        event.data.u32 = i;
+        if(epoll_ctl(epollfd, EPOLL_CTL_ADD, sources[i].sockfd, &event) != 0)
+        {
+            printErrno("Can't add client %d to epoll", i);
+            return ERROR;
+        }
+    }
+
+    return OK;
+}
+
+static void SendRequest(ReplaySource_t *source, ReplayGroup_t *group, uint64_t now)
+{
+    ReplayRecord_t *record = group->request;
+    ClientRequest_t request;
+
+    memset(&request, 0, sizeof(ClientRequest_t));
+    strncpy(request.machineName, record->machineName, sizeof(request.machineName) - 1);
+    strncpy(request.operation, record->text, sizeof(request.operation) - 1);
+    request.clientNumber = record->header.clientNumber;
+    request.clientIncarnation = record->header.clientIncarnation;
+    request.requestNumber = record->header.requestNumber;
+
+    if(send(source->sockfd, &request, sizeof(ClientRequest_t), 0) != sizeof(ClientRequest_t))
+    {
+        printErrno("%s:%d.%d_%d - Didn't send expected number of bytes", request.machineName, request.clientNumber, request.clientIncarnation, request.requestNumber);
+    }
+
+    if(group->sends++ == 0)
+    {
+        group->firstSend = now;
+    }
+    source->lastSend = now;
+}
+
+static void ReceiveResponses(int index)
+{
+    ReplaySource_t *source = &sources[index];
+    ServerResponse_t response;
+    ssize_t bytesReceived = 0;
+
+    while((bytesReceived = recv(source->sockfd, &response, sizeof(ServerResponse_t), 0)) >= 0)
+    {
+        ReplayGroup_t *group = NULL;
+
+        if((bytesReceived != sizeof(ServerResponse_t)) || (source->currentGroup < 0))
+        {
+            continue;
+        }
+
+        /* Duplicates (stored responses to retransmits) are not compared */
+        group = &groups[source->currentGroup];
+        if(group->answered == false)
+        {
+            group->answered = true;
+            group->replayLatency = Now() - group->firstSend;
+            group->returnValue = response.returnValue;
+            response.returnString[sizeof(response.returnString) - 1] = '\0';
+            if((group->returnString = strdup(response.returnString)) == NULL)
+            {
+                printErrno("Malloc failed%s", "");
+            }
+        }
+    }
+}
+
+/* Send whatever is due; returns the number of groups not yet finished */
+static int SendDue(uint64_t start, uint64_t captureStart, uint64_t now, uint64_t *wake)
+{
+    uint64_t timeout = CLIENT_RETRANSMIT_MS * 1000000ULL;
+    int remaining = 0;
+
+    for(int i = 0; i < numSources; i++)
+    {
+        ReplaySource_t *source = &sources[i];
+        ReplayGroup_t *group = (source->currentGroup >= 0) ? &groups[source->currentGroup] : NULL;
+
+        /* Like the client: retransmit until answered, and only then move on */
+        if((group != NULL) && (group->answered == false) && (group->sends < REPLAY_MAX_SENDS))
+        {
+            if(now - source->lastSend >= timeout)
+            {
+                SendRequest(source, group, now);
+            }
+            if(source->lastSend + timeout < *wake)
+            {
+                *wake = source->lastSend + timeout;
+            }
+            remaining += source->numGroups - source->next + 1;
+            continue;
+        }
+
+        if(source->next < source->numGroups)
+        {
+            ReplayGroup_t *next = &groups[source->groups[source->next]];
+            uint64_t due = (speed > 0) ? start + (uint64_t)((next->request->header.timestamp - captureStart) / speed) : now;
+
+            if(due <= now)
+            {
+                source->currentGroup = source->groups[source->next++];
+                SendRequest(source, next, now);
+                due = now + timeout;
+            }
+            if(due < *wake)
+            {
+                *wake = due;
+            }
+        }
+
+        remaining += source->numGroups - source->next;
+    }
+
+    return remaining;
+}
+
+static void Replay(int epollfd)
+{
+    struct epoll_event events[REPLAY_EPOLL_EVENTS];
+    uint64_t start = Now();
+    uint64_t captureStart = records[0].header.timestamp;
+    uint64_t captureEnd = records[numRecords - 1].header.timestamp;
+    uint64_t drainUntil = 0;
+    uint64_t now = 0;
+    uint64_t wake = 0;
+    int numEvents = 0;
+    int timeout = 0;
+
+    for(;;)
+    {
+        now = Now();
+        wake = UINT64_MAX;
+
+        if(SendDue(start, captureStart, now, &wake) == 0)
+        {
+            /* Stored responses to retransmits can still be on their way */
+            if(drainUntil == 0)
+            {
+                drainUntil = now + REPLAY_DRAIN_MS * 1000000ULL;
+            }
+            if(now >= drainUntil)
+            {
+                break;
+            }
+            wake = drainUntil;
+        }
+
+        timeout = (wake == UINT64_MAX) ? CLIENT_RETRANSMIT_MS : (wake > now) ? (int)((wake - now + 999999) / 1000000) : 0;
+        if((numEvents = epoll_wait(epollfd, events, REPLAY_EPOLL_EVENTS, timeout)) < 0)
+        {
+            if(errno != EINTR)
+            {
+                printErrno("epoll_wait failed%s", "");
+                break;
+            }
+            continue;
+        }
+
+        for(int i = 0; i < numEvents; i++)
+        {
+            ReceiveResponses(events[i].data.u32);
+        }
+    }
+
+    printInfo("Replayed %d requests from %d clients in %.3f s (captured over %.3f s)", numGroups, numSources,
+              (Now() - start) / 1e9, (captureEnd - captureStart) / 1e9);
+}
+
+static void PrintRow(const char *name, Histogram_t *histogram, uint64_t sends)
+{
+    printf("%s\t%llu\t%llu\t%.1f\t%llu\t%llu\t%llu\t%llu\t%llu\n",
+           name,
+           (unsigned long long)histogram->count,
+           (unsigned long long)sends,
+           (histogram->count != 0) ? (double)histogram->sum / histogram->count : 0.0,
+           (unsigned long long)HistogramQuantile(histogram, 0.5),
+           (unsigned long long)HistogramQuantile(histogram, 0.9),
+           (unsigned long long)HistogramQuantile(histogram, 0.99),
+           (unsigned long long)HistogramQuantile(histogram, 0.999),
+           (unsigned long long)histogram->max);
+}
+
+static status_t Report(void)
+{
+    static Histogram_t capturedHistogram;
+    static Histogram_t replayHistogram;
+    int matched = 0;
+    int diverged = 0;
+    int missing = 0;
+    int extra = 0;
+    int unanswered = 0;
+    uint64_t capturedSends = 0;
+    uint64_t replaySends = 0;
+
+    for(int i = 0; i < numGroups; i++)
+    {
+        ReplayGroup_t *group = &groups[i];
+
+        capturedSends += group->capturedSends;
+        replaySends += group->sends;
+        if(group->captured != NULL)
+        {
+            HistogramRecord(&capturedHistogram, group->capturedLatency);
+        }
+        if(group->answered == true)
+        {
+            HistogramRecord(&replayHistogram, group->replayLatency);
+        }
+
+        if((group->captured != NULL) && (group->answered == true))
+        {
+            if((group->captured->header.returnValue == group->returnValue) &&
+               (group->returnString != NULL) && (strcmp(group->captured->text, group->returnString) == 0))
+            {
+                matched++;
+            }
+            else
+            {
+                if((diverged++ < REPLAY_MAX_REPORTED) || (verbose == true))
+                {
+                    printf("%s:%d.%d_%d - Diverged\n  captured %d: %s", group->captured->machineName, group->captured->header.clientNumber,
+                           group->captured->header.clientIncarnation, group->captured->header.requestNumber,
+                           group->captured->header.returnValue, group->captured->text);
+                    printf("  replayed %d: %s", group->returnValue, (group->returnString != NULL) ? group->returnString : "");
+                }
+            }
+        }
+        else if(group->captured != NULL)
+        {
+            missing++;
+        }
+        else if(group->answered == true)
+        {
+            extra++;
+        }
+        else
+        {
+            unanswered++;
+        }
+    }
+
+    printf("requests\tmatched\tdiverged\tmissing\textra\tunanswered\n");
+    printf("%d\t%d\t%d\t%d\t%d\t%d\n", numGroups, matched, diverged, missing, extra, unanswered);
+    printf("run\trequests\tsends\tmean_ns\tp50_ns\tp90_ns\tp99_ns\tp999_ns\tmax_ns\n");
+    PrintRow("captured", &capturedHistogram, capturedSends);
+    PrintRow("replayed", &replayHistogram, replaySends);
+
+    return (diverged == 0) ? OK : ERROR;
+}
+
+int main(int argc, char *argv[])
+{
+    static struct option longOptions[] =
+    {
+        {"speed",   required_argument, NULL, 's'},
+        {"afap",    no_argument,       NULL, 'a'},
+        {"verbose", no_argument,       NULL, 'v'},
+        {NULL,      0,                 NULL, 0}
+    };
+    status_t status = ERROR;
+    int epollfd = -1;
+    int c = 0;
+
+    while((c = getopt_long(argc, argv, "s:av", longOptions, NULL)) != -1)
+    {
+        switch(c)
+        {
+            case 's': speed = strtod(optarg, NULL); break;
+            case 'a': speed = 0; break;
+            case 'v': verbose = true; break;
+            default:
+                speed = -1;
+                break;
+        }
+    }
+
+    if((argc - optind < 3) || (speed < 0))
+    {
+        printError("Usage: %s [-s|--speed <N>] [-a|--afap] [-v|--verbose] <Server IP address (dotted decimal)> <service port> <capture file>...", argv[0]);
+        return ERROR;
+    }
+
+    logLevel = LOG_INFO;
+
+    for(int i = optind + 2; i < argc; i++)
+    {
+        if(LoadCapture(argv[i]) != OK)
+        {
+            return ERROR;
+        }
+    }
+
+    if(IndexCapture() != OK)
+    {
+        printError("Can't index capture%s", "");
+    }
+    else if((epollfd = epoll_create1(0)) < 0)
+    {
+        printErrno("Can't create epoll instance%s", "");
+    }
+    else if(OpenSources(argv[optind], strtol(argv[optind + 1], NULL, 10), epollfd) == OK)
+    {
+        Replay(epollfd);
+        status = Report();
+    }
+
+    return status;
+}
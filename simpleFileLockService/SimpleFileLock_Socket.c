@@ -0,0 +1,134 @@
+#include "SimpleFileLock_Socket.h"
+#include "SimpleFileLock_Log.h"
+
+#include <string.h>     /* for memset() */
+#include <stddef.h>     /* for offsetof() */
+#include <unistd.h>     /* for unlink() and close() */
+#include <time.h>       /* for clock_gettime() */
+#include <sys/socket.h> /* for recvmsg() and setsockopt() */
+#include <sys/uio.h>    /* for iovec */
+
+int SocketEnableTimestamps(int sockfd)
+{
+    int enable = 1;
+    int status = 0;
+
+    if(setsockopt(sockfd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) < 0)
+    {
+        printErrno("Can't enable receive timestamps%s", "");
+        status = -1;
+    }
+
+    return status;
+}
+
+int SocketLocalAddress(const char *path, struct sockaddr_un *addr)
+{
+    size_t length = strlen(path);
+
+    if((length == 0) || (length >= sizeof(addr->sun_path)))
+    {
+        return -1;
+    }
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, length);
+
+    /* Abstract: no file, and the name is exactly the bytes given */
+    if(path[0] == '@')
+    {
+        addr->sun_path[0] = '\0';
+        return offsetof(struct sockaddr_un, sun_path) + length;
+    }
+
+    return sizeof(*addr);
+}
+
+int SocketOpenLocal(const char *path)
+{
+    struct sockaddr_un addr;
+    int addrLength = 0;
+    int sockfd = -1;
+
+    if((addrLength = SocketLocalAddress(path, &addr)) < 0)
+    {
+        printError("Local socket path too long: %s", path);
+    }
+    else if((sockfd = socket(AF_UNIX, SOCK_DGRAM, 0)) < 0)
+    {
+        printErrno("Can't create local socket%s", "");
+    }
+    else
+    {
+        /* Left behind by a server that didn't exit cleanly */
+        if(path[0] != '@')
+        {
+            unlink(path);
+        }
+
+        if(bind(sockfd, (struct sockaddr *)&addr, addrLength) < 0)
+        {
+            printErrno("Can't bind to %s", path);
+            close(sockfd);
+            sockfd = -1;
+        }
+    }
+
+    return sockfd;
+}
+
+ssize_t SocketReceive(int sockfd, void *buffer, size_t size, struct sockaddr_in *fromAddr, uint64_t *queueDelay)
+{
+    char control[CMSG_SPACE(sizeof(struct timespec))];
+    struct iovec iov;
+    struct msghdr msg;
+    ssize_t recvMsgSize = 0;
+
+    iov.iov_base = buffer;
+    iov.iov_len = size;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_name = fromAddr;
+    msg.msg_namelen = sizeof(struct sockaddr_in);
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *queueDelay = 0;
+
+    if((recvMsgSize = recvmsg(sockfd, &msg, 0)) >= 0)
+    {
+        *queueDelay = SocketQueueDelay(&msg);
+    }
+
+    return recvMsgSize;
+}
+
+uint64_t SocketQueueDelay(struct msghdr *msg)
+{
+    struct cmsghdr *cmsg = NULL;
+    struct timespec now;
+    uint64_t queueDelay = 0;
+
+    for(cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg))
+    {
+        if((cmsg->cmsg_level == SOL_SOCKET) && (cmsg->cmsg_type == SCM_TIMESTAMPNS))
+        {
+            struct timespec arrival;
+
+            /* The kernel stamps with the realtime clock */
+            memcpy(&arrival, CMSG_DATA(cmsg), sizeof(arrival));
+            clock_gettime(CLOCK_REALTIME, &now);
+
+            if((now.tv_sec > arrival.tv_sec) ||
+               ((now.tv_sec == arrival.tv_sec) && (now.tv_nsec > arrival.tv_nsec)))
+            {
+                queueDelay = (uint64_t)(now.tv_sec - arrival.tv_sec) * 1000000000ULL + now.tv_nsec - arrival.tv_nsec;
+            }
+        }
+    }
+
+    return queueDelay;
+}
@@ -0,0 +1,40 @@
+#ifndef SIMPLEFILELOCK_SOCKET_H
+#define SIMPLEFILELOCK_SOCKET_H
+
+#include <stddef.h>     /* for size_t */
+#include <stdint.h>     /* for uint64_t */
+#include <sys/types.h>  /* for ssize_t */
+#include <arpa/inet.h>  /* for sockaddr_in */
+#include <sys/socket.h> /* for msghdr */
+#include <sys/un.h>     /* for sockaddr_un */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Server socket helpers.
+ *
+ * SocketEnableTimestamps() asks the kernel to stamp every datagram on arrival
+ * (SO_TIMESTAMPNS), and SocketReceive() returns how long the datagram then sat
+ * in the receive queue before we read it.  Without a timestamp the delay is 0.
+ * SocketQueueDelay() does the same for a message received some other way,
+ * given its control data.
+ */
+
+int SocketEnableTimestamps(int sockfd);
+
+/* Unix datagram socket bound to 'path', a leading @ for an abstract name,
+ * -1 on error */
+int SocketOpenLocal(const char *path);
+
+/* sockaddr_un for 'path' as above, its length or -1 if it doesn't fit */
+int SocketLocalAddress(const char *path, struct sockaddr_un *addr);
+ssize_t SocketReceive(int sockfd, void *buffer, size_t size, struct sockaddr_in *fromAddr, uint64_t *queueDelay);
+uint64_t SocketQueueDelay(struct msghdr *msg);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPLEFILELOCK_SOCKET_H */
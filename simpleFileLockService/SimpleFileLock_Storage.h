@@ -0,0 +1,90 @@
+#ifndef SIMPLEFILELOCK_STORAGE_H
+#define SIMPLEFILELOCK_STORAGE_H
+
+#include "defns.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Storage backends.
+ *
+ * The engine owns the locks and the protocol; a backend only moves bytes for
+ * a file that is already locked.  open() returns an opaque handle that the
+ * engine keeps in lockNode->fileHandle (NULL means not open) and hands back
+ * to every other call.  Backends without a native file position use
+ * lockNode->byteOffset, which the engine zeroes when the lock is created.
+ *
+ * Every call returns -1 with errno set on failure.
+ *
+ * A backend that makes writes durable in group commits sets commitTicket.
+ * Right after a successful write() it returns the commit round that will
+ * cover it, and the backend reports finished rounds through the
+ * StorageCommitted_t it was started with.  Until then the engine holds back
+ * the write's response.  Backends without group commit leave it NULL.
+ */
+
+/* Every write with a ticket up to and including 'ticket' is durable */
+typedef void (*StorageCommitted_t)(uint64_t ticket);
+
+typedef struct StorageBackend_t
+{
+    const char *name;
+
+    /* Open parsed->filePath with fopen() semantics for parsed->mode; for "a"
+     * lockNode->append is set and write() always goes to the end */
+    void *(*open)(ParsedOperation_t *parsed);
+
+    /* Close lockNode->fileHandle, also called on locks released by a crash */
+    int (*close)(LockTableNode_t *lockNode);
+
+    /* Copy up to parsed->numBytes into buffer (not NUL terminated), return the count */
+    int (*read)(LockTableNode_t *lockNode, ParsedOperation_t *parsed, char *buffer);
+
+    /* Write parsed->messageString at the current position */
+    int (*write)(LockTableNode_t *lockNode, ParsedOperation_t *parsed);
+
+    /* Move the current position to parsed->numBytes from the start */
+    int (*lseek)(LockTableNode_t *lockNode, ParsedOperation_t *parsed);
+
+    /* The current position, which "readat" and "writeat" put back after moving it */
+    long (*tell)(LockTableNode_t *lockNode);
+
+    /* Optional read() without the copy: the next *length (up to parsed->numBytes)
+     * bytes in place, unchanged until the lock is released.  NULL if the data
+     * can't be referenced, and the position is then left alone */
+    const char *(*readReference)(LockTableNode_t *lockNode, ParsedOperation_t *parsed, int *length);
+
+    /* Commit round of the last write(), 0 if it is already as durable as it gets */
+    uint64_t (*commitTicket)(void);
+}StorageBackend_t;
+
+/* Local files through stdio, synced after every change */
+extern StorageBackend_t FileStorage;
+
+/* Process memory only, contents are lost when the server exits */
+extern StorageBackend_t MemoryStorage;
+
+/* Local files through pread()/pwrite() and a cache of open descriptors,
+ * configured by PreadStorageStart() before first use */
+extern StorageBackend_t PreadStorage;
+
+#define PREAD_DEFAULT_CACHE    256    /* Descriptors kept open */
+#define PREAD_DEFAULT_GROUP_MS 5      /* Longest a write waits for its group commit to start */
+#define PREAD_DEFAULT_MMAP_MIN 65536  /* Smallest file mapped for reading, -1 for none */
+
+typedef enum StorageDurability_t
+{
+    DURABILITY_NONE  = 0,          /* Page cache only */
+    DURABILITY_CLOSE = 1,          /* fdatasync() on close of a written file */
+    DURABILITY_GROUP = 2           /* Acknowledge writes after a shared fdatasync() round */
+}StorageDurability_t;
+
+status_t PreadStorageStart(int cacheSize, StorageDurability_t durability, int groupMs, long mmapMin, StorageCommitted_t committed);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPLEFILELOCK_STORAGE_H */
@@ -0,0 +1,318 @@
+#include "SimpleFileLock_Trace.h"
+#include "SimpleFileLock_Log.h"
+
+#include <stdio.h>      /* for snprintf() and fopen() */
+#include <stdlib.h>     /* for calloc() */
+#include <string.h>     /* for strcspn() */
+#include <stdbool.h>    /* for bool */
+#include <signal.h>     /* for sigaction() */
+#include <unistd.h>     /* for getpid() */
+#include <pthread.h>    /* for pthread_create() */
+#include <time.h>       /* for nanosleep() */
+
+#define TRACE_POLL_SLEEP  100000000    /* Dump thread signal poll (ns) */
+
+typedef struct TraceSpan_t
+{
+    const char *name;              /* Stage name, a string literal */
+    uint64_t start;                /* Monotonic ns */
+    uint64_t end;                  /* Monotonic ns */
+}TraceSpan_t;
+
+typedef struct TraceRecord_t
+{
+    uint64_t seq;                  /* Slot index + 1 once published, 0 while written */
+    char id[TRACE_ID_LEN];         /* machineName:clientNumber.incarnation_requestNumber */
+    char op[TRACE_OP_LEN];         /* Command word of the operation */
+    uint64_t start;                /* Request start, monotonic ns */
+    uint64_t end;                  /* Request end, monotonic ns */
+    int numSpans;                  /* Valid entries in spans */
+    TraceSpan_t spans[TRACE_MAX_SPANS];
+}TraceRecord_t;
+
+typedef struct TraceBuffer_t
+{
+    struct TraceBuffer_t *next;    /* Next registered buffer */
+    int threadId;                  /* Trace "tid" */
+    uint64_t head;                 /* Records started by this thread */
+    uint64_t sampleCount;          /* Requests seen, for sampling */
+    TraceRecord_t records[TRACE_BUFFER_RECORDS];
+}TraceBuffer_t;
+
+int traceSampleRate;
+
+static TraceBuffer_t *traceBufferList;
+static int numTraceBuffers;
+static __thread TraceBuffer_t *threadBuffer;
+static __thread TraceRecord_t *currentRecord;
+static pthread_mutex_t dumpMutex = PTHREAD_MUTEX_INITIALIZER;
+static volatile sig_atomic_t dumpRequested;
+static int dumpCount;
+static pthread_t dumpThread;
+
+static TraceBuffer_t *GetThreadBuffer(void)
+{
+    TraceBuffer_t *buffer = threadBuffer;
+
+    if(buffer == NULL)
+    {
+        if((buffer = calloc(1, sizeof(TraceBuffer_t))) != NULL)
+        {
+            buffer->threadId = __atomic_add_fetch(&numTraceBuffers, 1, __ATOMIC_RELAXED);
+            buffer->next = __atomic_load_n(&traceBufferList, __ATOMIC_RELAXED);
+            while(!__atomic_compare_exchange_n(&traceBufferList, &buffer->next, buffer, 0, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            {
+            }
+            threadBuffer = buffer;
+        }
+        else
+        {
+            printErrno("Malloc failed%s", "");
+        }
+    }
+
+    return buffer;
+}
+
+void TraceBegin(const char *machineName, int clientNumber, int clientIncarnation, int requestNumber, const char *operation, uint64_t startTime)
+{
+    TraceBuffer_t *buffer = NULL;
+    TraceRecord_t *record = NULL;
+    int rate = __atomic_load_n(&traceSampleRate, __ATOMIC_RELAXED);
+    size_t opLength = 0;
+
+    currentRecord = NULL;
+
+    if((rate == 0) || (startTime == 0) || ((buffer = GetThreadBuffer()) == NULL))
+    {
+        return;
+    }
+    if((buffer->sampleCount++ % rate) != 0)
+    {
+        return;
+    }
+
+    record = &buffer->records[buffer->head % TRACE_BUFFER_RECORDS];
+
+    /* Invalidate the slot before overwriting it, see ReadRecord() */
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+
+    snprintf(record->id, sizeof(record->id), "%s:%d.%d_%d", machineName, clientNumber, clientIncarnation, requestNumber);
+    opLength = strcspn(operation, " \r\n");
+    if(opLength >= sizeof(record->op))
+    {
+        opLength = sizeof(record->op) - 1;
+    }
+    memcpy(record->op, operation, opLength);
+    record->op[opLength] = '\0';
+    record->start = startTime;
+    record->end = startTime;
+    record->numSpans = 0;
+
+    currentRecord = record;
+}
+
+void TraceSpan(const char *name, uint64_t start, uint64_t end)
+{
+    TraceRecord_t *record = currentRecord;
+
+    if((record != NULL) && (record->numSpans < TRACE_MAX_SPANS))
+    {
+        record->spans[record->numSpans].name = name;
+        record->spans[record->numSpans].start = start;
+        record->spans[record->numSpans].end = end;
+        record->numSpans++;
+    }
+}
+
+void TraceEnd(uint64_t endTime)
+{
+    TraceBuffer_t *buffer = threadBuffer;
+    TraceRecord_t *record = currentRecord;
+
+    if(record != NULL)
+    {
+        record->end = endTime;
+
+        /* Publish */
+        __atomic_store_n(&record->seq, buffer->head + 1, __ATOMIC_RELEASE);
+        __atomic_store_n(&buffer->head, buffer->head + 1, __ATOMIC_RELEASE);
+        currentRecord = NULL;
+    }
+}
+
+/* Copy slot 'index' out of a live buffer; fails if it was overwritten meanwhile */
+static int ReadRecord(TraceBuffer_t *buffer, uint64_t index, TraceRecord_t *copy)
+{
+    TraceRecord_t *record = &buffer->records[index % TRACE_BUFFER_RECORDS];
+
+    if(__atomic_load_n(&record->seq, __ATOMIC_ACQUIRE) != index + 1)
+    {
+        return 0;
+    }
+
+    memcpy(copy, record, sizeof(TraceRecord_t));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    return __atomic_load_n(&record->seq, __ATOMIC_RELAXED) == index + 1;
+}
+
+/* Trace viewers choke on raw control characters and quotes */
+static void WriteJsonString(FILE *file, const char *string)
+{
+    fputc('"', file);
+    for(const char *c = string; *c != '\0'; c++)
+    {
+        if((*c == '"') || (*c == '\\'))
+        {
+            fprintf(file, "\\%c", *c);
+        }
+        else if((unsigned char)*c < 0x20)
+        {
+            fprintf(file, "\\u%04x", (unsigned char)*c);
+        }
+        else
+        {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+static void WriteEvent(FILE *file, bool *isFirst, const char *name, int threadId, uint64_t start, uint64_t end, TraceRecord_t *record)
+{
+    fprintf(file, "%s\n{\"name\":", *isFirst ? "" : ",");
+    WriteJsonString(file, name);
+    fprintf(file, ",\"cat\":\"sfl\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%d,\"tid\":%d,\"args\":{\"request\":",
+            start / 1000.0, (end - start) / 1000.0, (int)getpid(), threadId);
+    WriteJsonString(file, record->id);
+    fprintf(file, "}}");
+    *isFirst = false;
+}
+
+int TraceDump(char *path, size_t pathSize)
+{
+    FILE *file = NULL;
+    TraceRecord_t *record = NULL;
+    int numEvents = -1;
+    bool isFirst = true;
+
+    if((record = malloc(sizeof(TraceRecord_t))) == NULL)
+    {
+        printErrno("Malloc failed%s", "");
+        return -1;
+    }
+
+    pthread_mutex_lock(&dumpMutex);
+
+    snprintf(path, pathSize, "sfl-trace-%d-%d.json", (int)getpid(), dumpCount++);
+
+    if((file = fopen(path, "w")) != NULL)
+    {
+        numEvents = 0;
+        fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[");
+
+        for(TraceBuffer_t *buffer = __atomic_load_n(&traceBufferList, __ATOMIC_ACQUIRE); buffer != NULL; buffer = buffer->next)
+        {
+            uint64_t head = __atomic_load_n(&buffer->head, __ATOMIC_ACQUIRE);
+            uint64_t index = (head > TRACE_BUFFER_RECORDS) ? head - TRACE_BUFFER_RECORDS : 0;
+
+            for(; index < head; index++)
+            {
+                if(ReadRecord(buffer, index, record) == 0)
+                {
+                    continue;
+                }
+
+                /* Whole request, then one nested slice per stage */
+                WriteEvent(file, &isFirst, (record->op[0] != '\0') ? record->op : "request", buffer->threadId, record->start, record->end, record);
+                numEvents++;
+                for(int i = 0; (i < record->numSpans) && (i < TRACE_MAX_SPANS); i++)
+                {
+                    WriteEvent(file, &isFirst, record->spans[i].name, buffer->threadId, record->spans[i].start, record->spans[i].end, record);
+                    numEvents++;
+                }
+            }
+        }
+
+        fprintf(file, "\n]}\n");
+        if(fclose(file) != 0)
+        {
+            printErrno("Error writing to %s", path);
+            numEvents = -1;
+        }
+    }
+    else
+    {
+        printErrno("Can't open %s for writing", path);
+    }
+
+    pthread_mutex_unlock(&dumpMutex);
+    free(record);
+
+    return numEvents;
+}
+
+static void DumpSignalHandler(int signal)
+{
+    (void)signal;
+    dumpRequested = 1;
+}
+
+/* Signal handlers can't do file I/O, so the dump runs here */
+static void *DumpThread(void *arg)
+{
+    struct timespec idle = {0, TRACE_POLL_SLEEP};
+    char path[64];
+    int numEvents = 0;
+
+    (void)arg;
+
+    for(;;) /* Run forever */
+    {
+        nanosleep(&idle, NULL);
+
+        if(dumpRequested != 0)
+        {
+            dumpRequested = 0;
+            if((numEvents = TraceDump(path, sizeof(path))) >= 0)
+            {
+                printInfo("Wrote %d trace events to %s", numEvents, path);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+int TraceStart(int sampleRate)
+{
+    struct sigaction action;
+    int status = -1;
+
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = DumpSignalHandler;
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+
+    if(sampleRate <= 0)
+    {
+        printError("Invalid trace sample rate %d", sampleRate);
+    }
+    else if(sigaction(SIGUSR1, &action, NULL) != 0)
+    {
+        printErrno("Can't install SIGUSR1 handler%s", "");
+    }
+    else if(pthread_create(&dumpThread, NULL, DumpThread, NULL) != 0)
+    {
+        printErrno("Can't start trace dump thread%s", "");
+    }
+    else
+    {
+        __atomic_store_n(&traceSampleRate, sampleRate, __ATOMIC_RELEASE);
+        status = 0;
+    }
+
+    return status;
+}
@@ -0,0 +1,41 @@
+#ifndef SIMPLEFILELOCK_TRACE_H
+#define SIMPLEFILELOCK_TRACE_H
+
+#include <stddef.h>     /* for size_t */
+#include <stdint.h>     /* for uint64_t */
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Sampled request tracing.
+ *
+ * One request in every traceSampleRate is traced: TraceBegin() claims a slot in
+ * the calling thread's ring of TraceRecord_t, each finished stage adds a span
+ * to it and TraceEnd() publishes it.  Requests are identified by the same
+ * machineName:clientNumber.incarnation_requestNumber id the debug log prints.
+ *
+ * TraceDump() writes every published record as Chrome trace-event JSON (load it
+ * in chrome://tracing or ui.perfetto.dev).  It runs on SIGUSR1, or on demand
+ * through the metrics port (GET /trace).
+ */
+
+#define TRACE_ID_LEN          128
+#define TRACE_OP_LEN          16
+#define TRACE_MAX_SPANS       8
+#define TRACE_BUFFER_RECORDS  4096  /* Per thread */
+
+extern int traceSampleRate; /* 0 when tracing is off */
+
+int TraceStart(int sampleRate);
+void TraceBegin(const char *machineName, int clientNumber, int clientIncarnation, int requestNumber, const char *operation, uint64_t startTime);
+void TraceSpan(const char *name, uint64_t start, uint64_t end);
+void TraceEnd(uint64_t endTime);
+int TraceDump(char *path, size_t pathSize);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SIMPLEFILELOCK_TRACE_H */
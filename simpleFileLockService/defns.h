@@ -1,21 +1,65 @@
+#ifndef DEFNS_H
+#define DEFNS_H
+
 #include <stdio.h>      /* for printf() and fprintf() */
 #include <errno.h>      /* for errno */
+#include <stdint.h>     /* for uint64_t */
+#include <time.h>       /* for time_t */
 #include <arpa/inet.h>  /* for sockaddr_in and inet_addr() */
 
-#define printError(errorMsg, ...) fprintf(stderr, "Error: %s:%d %s() - " errorMsg "\n", __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define printWarning(errorMsg, ...) fprintf(stderr, "Warning: %s:%d %s() - " errorMsg "\n", __FILE__, __LINE__, __func__, __VA_ARGS__)
-#define printInfo(errorMsg, ...) fprintf(stderr, "Info: %s:%d %s() - " errorMsg "\n", __FILE__, __LINE__, __func__, __VA_ARGS__)
-
-#define printErrno(errorMsg, ...) fprintf(stderr, "Error: %s:%d %s() - " errorMsg ":%s\n", __FILE__, __LINE__, __func__, __VA_ARGS__, strerror(errno))
+#include "SimpleFileLock_Log.h" /* for printError() and friends */
 
 #define INCARNATION_LOCKFILE "incarnation_LOCK_"
 #define INCARNATION_FILE "incarnation_"
 
 #define MAX_CMD_LEN 200
 
+#define CLIENT_RETRANSMIT_MS 100 /* Client resends after this long without a response */
+#define CLIENT_FAILOVER_RETRANSMITS 10 /* Resends before a client with several servers tries the next */
+#define SERVER_REDIRECT      2   /* returnValue sending the client to the "<ip>:<port>" in returnString */
+
+/*
+ * Delegations: a client opening a file "write" or "append" with "delegate"
+ * may apply its writes and seeks locally and send them in bulk, after the
+ * ClientRequest_t of its "close" or "flush", as DelegatedWrite_t records each
+ * followed by 'length' bytes.  A client that wants a delegated file makes
+ * the server send the holder a ServerResponse_t with returnValue
+ * DELEGATION_RECALL, and the holder flushes and stops caching.
+ */
+#define DELEGATION_PAYLOAD_MAX 8192  /* Bytes after the ClientRequest_t */
+#define DELEGATION_RECALL      1     /* returnValue of a recall */
+#define DELEGATED_SUFFIX       "with delegation" /* Ends the "Opened" message when granted */
+
+/*
+ * Clients on the server's host may use its Unix datagram socket instead of
+ * UDP, with the same request and response layouts.  A local client binds to
+ * an abstract name exactly LOCAL_ADDR_LEN bytes long, so the server keeps and
+ * answers its address in a struct sockaddr_in like any other.
+ */
+#define LOCAL_ADDR_LEN sizeof(struct sockaddr_in)
+#define LOCAL_PREFIX   "unix:"       /* Server address of a local client: unix:<path>, @ for abstract */
+
+/*
+ * Sessions: a client sends SESSION_OPERATION in a full ClientRequest_t and
+ * the server answers "Session <id>", a 64-bit id bound to the client's
+ * machineName, clientNumber and incarnation.  Its later requests may be
+ * SessionRequest_t, which carry only the id; a new incarnation, or
+ * SESSION_UNKNOWN from a server that doesn't have the id, opens a new one.
+ */
+#define SESSION_MAGIC     0x4c4653ffu /* Starts a SessionRequest_t, never the first bytes of a machineName */
+#define SESSION_OPERATION "session"
+#define SESSION_UNKNOWN   3           /* returnValue for an id the server doesn't have */
+
+#define LOCK_TABLE_BUCKETS   1024
+#define CLIENT_TABLE_BUCKETS 1024
+#define LOCK_KEY_LEN   (100 + 200)         /* machineName + fileName */
+#define CLIENT_KEY_LEN (100 + sizeof(int)) /* machineName + clientNumber */
+
+#ifndef __cplusplus
 typedef int bool;
 #define true 1
 #define false 0
+#endif
 
 typedef struct ClientRequest_t
 {
@@ -26,6 +70,14 @@ typedef struct ClientRequest_t
 	char operation[200];   /* File operation (actual request) client sends to server */
 }ClientRequest_t;
 
+typedef struct SessionRequest_t
+{
+    uint32_t magic;                /* SESSION_MAGIC */
+    int requestNumber;             /* Request number of client */
+    uint64_t sessionId;            /* From the "Session" response */
+    char operation[200];           /* File operation (actual request) client sends to server */
+}SessionRequest_t;
+
 typedef struct ServerResponse_t
 {
     int returnValue;         /* Integer return value of the operation */
@@ -43,27 +95,44 @@ typedef struct ClientStruct_t
     char *scriptFileName;          /* Full path to script */
 	int clientNumber;              /* Client number */
 	int requestNumber;             /* Current request number */
-	int numCommands;               /* Number of commands in the script */
 	int clientIncarnation;         /* Current incarnation number of client */
-	char **commandArray;           /* Array of commands to be sent */
+	bool delegate;                 /* Ask for delegations */
 }ClientStruct_t;
 
+typedef struct DelegatedWrite_t
+{
+    int32_t offset;                /* Position written at, -1 for the end of an "append" file */
+    int32_t length;                /* Bytes that follow */
+}DelegatedWrite_t;
+
 typedef struct ServerStruct_t
 {
     int sockfd;                    /* Socket descriptor */
     struct sockaddr_in serverAddr; /* Server address */
     struct sockaddr_in clientAddr; /* Client address */
     int serverPortNumber;          /* Server port number */
+    uint64_t queueDelay;           /* ns the current request waited in the receive queue */
+    struct ClientTableNode_t *clientNode; /* Found from the request's session id, NULL to look it up */
+    const char *payload;           /* Delegated writes after the request, NULL if none */
+    int payloadLength;             /* Bytes at payload */
 }ServerStruct_t;
 
 typedef struct ClientTableNode_t
 {
-	struct ClientTableNode_t *next;  /* Pointer to next entry in the list */
     char machineName[100];           /* Client machine name */
 	int clientNumber;                /* Client number */
 	int requestNumber;               /* Current request number */
 	int clientIncarnation;           /* Current incarnation number of client */
+	uint64_t sessionId;              /* 0 until the client opens a session */
+	int locksHeld;                   /* Entries in the lock table, a client with any is never evicted */
+	time_t lastActive;               /* Monotonic seconds of its last request, with eviction on */
+	struct ClientTableNode_t *lruPrev; /* Clients by last request, most recent first */
+	struct ClientTableNode_t *lruNext;
+	uint64_t commitTicket;           /* Group commit that must finish before storedResponse is sent */
 	ServerResponse_t storedResponse; /* Result of the last operation */
+	const char *responseData;        /* Read data left in storage, sent at responseSplit in returnString */
+	int responseDataLength;          /* Bytes at responseData */
+	int responseSplit;               /* Offset in returnString where responseData goes */
 }ClientTableNode_t;
 
 
@@ -74,6 +143,19 @@ typedef enum LockType_t
 	WRITE_LOCK      = 2,
 }LockType_t;
 
+typedef struct ParsedOperation_t
+{
+    char *commandString;           /* open, close, read, write, lseek, flush, readat, writeat, upgrade or downgrade */
+    char *fileNameString;          /* File name as sent by the client */
+    char *messageString;           /* write: text between the quotes */
+    char filePath[200];            /* machineName:fileName */
+    char mode[3];                  /* open, upgrade and downgrade: fopen() mode, "a" for append */
+    int numBytes;                  /* read and readat: byte count, lseek and flush: offset */
+    int offset;                    /* readat and writeat: position, -1 for every other command */
+    bool delegate;                 /* open: "delegate" asked for; flush: "keep" the delegation */
+    LockType_t lockType;           /* Lock the operation needs */
+}ParsedOperation_t;
+
 typedef enum RequestAction_t
 {
     DROP_REQUEST_SEND_NOTHING     = 0, /* r < R or first third of r > R requests */
@@ -84,12 +166,15 @@ typedef enum RequestAction_t
 
 typedef struct LockTableNode_t
 {
-	struct LockTableNode_t *next;
 	char fileName[200];
 	char machineName[100];
 	int clientNumber;
 	LockType_t lockStatus;
-	FILE *fileHandle;
+	void *fileHandle;              /* Storage backend handle, NULL when not open */
+	int byteOffset;                /* Position for backends that don't keep one */
+	bool append;                   /* Opened "append": every write goes to the end */
+	bool delegated;                /* The holder caches its writes */
+	struct sockaddr_in holderAddr; /* Where a recall goes */
 }LockTableNode_t;
 
 
@@ -98,3 +183,5 @@ typedef enum status_t
 	OK =     0,
 	ERROR = -1
 }status_t;
+
+#endif /* DEFNS_H */
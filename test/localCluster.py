@@ -0,0 +1,386 @@
+#!/usr/bin/env python3
+"""
+Single host benchmark harness for the Simple File Locking Service.
+
+Starts everything on loopback in a temporary directory: for the FT server a
+LogCabin cluster of --servers processes (bootstrapped and reconfigured the same
+way test.py does over SSH) plus FT_SimpleFileLock_Server, for the plain server
+just SimpleFileLock_Server.  --clients virtual clients then speak the UDP
+protocol directly, each working on its own file with a weighted mix of
+read/write/lseek operations (reopening it whenever the mix switches between
+read and write locks), retransmitting after 100 ms like SimpleFileLock_Client.
+
+A failure can be injected --kill-at seconds into the run: "leader" kills the
+LogCabin leader, "server" kills the file lock server and restarts it at once.
+Throughput, latency percentiles and time to recover (first response after the
+kill) are reported per server so both can be compared on the same workload.
+
+"quorum" kills a majority of the LogCabin servers under an FT server holding
+the active lease, so its renews fail.  It must stop serving before a standby
+could take over: the run fails if any answer but a redirect arrives more than
+the takeover window after the kill.
+"""
+
+import argparse
+import json
+import os
+import random
+import shutil
+import signal
+import socket
+import struct
+import subprocess
+import sys
+import tempfile
+import threading
+import time
+
+###################
+# Global Settings #
+###################
+scriptDir = os.path.dirname(os.path.abspath(__file__))
+binDir = os.path.join(scriptDir, "..", "simpleFileLockService", "bin")
+logCabinDir = os.path.join(scriptDir, "..", "logcabin", "build")
+ft_serverBinaryName = "FT_SimpleFileLock_Server"
+serverBinaryName = "SimpleFileLock_Server"
+logCabinBinaryName = "LogCabin"
+logCabinBasePort = 5254
+serverPort = 9001
+
+# ClientRequest_t and ServerResponse_t from defns.h
+requestFormat = "=100siii200s"
+responseFormat = "=i1024s"
+responseSize = struct.calcsize(responseFormat)
+retransmitTimeout = 0.1  # CLIENT_RETRANSMIT_MS
+serverRedirect = 2  # SERVER_REDIRECT
+takeoverWindow = 0.5 * 3  # ACTIVE_LEASE_MS * ACTIVE_LEASE_MISSES
+
+def percentile(sortedValues, fraction):
+    if not sortedValues:
+        return 0.0
+    index = min(len(sortedValues) - 1, int(fraction * len(sortedValues)))
+    return sortedValues[index]
+
+class virtualClient(threading.Thread):
+    """
+    One client session: loop over the operation mix on a private file until
+    stopped, recording the latency of every operation (retransmissions
+    included) and when it completed.
+    """
+    def __init__(self, clientNumber, port, mix, stopEvent):
+        threading.Thread.__init__(self)
+        self.daemon = True
+        self.clientNumber = clientNumber
+        self.machineName = "bench_" + str(clientNumber)
+        self.fileName = "file_" + str(clientNumber) + ".txt"
+        self.port = port
+        self.mix = mix
+        self.stopEvent = stopEvent
+        self.requestNumber = 0
+        self.latencies = []
+        self.completions = []
+        self.errors = 0
+        self.redirects = []
+        self.mode = None
+        self.offset = 0
+        self.size = 0
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.settimeout(retransmitTimeout)
+
+    def request(self, operation):
+        payload = struct.pack(requestFormat, self.machineName.encode(), self.clientNumber,
+                              self.requestNumber, 0, operation.encode())
+        start = time.time()
+        while not self.stopEvent.is_set():
+            self.sock.sendto(payload, ("127.0.0.1", self.port))
+            try:
+                data = self.sock.recv(responseSize)
+            except socket.timeout:
+                continue
+            except ConnectionRefusedError:
+                # Server is down; wait out the retransmit timeout like a lost datagram
+                time.sleep(retransmitTimeout)
+                continue
+            returnValue, _ = struct.unpack(responseFormat, data[:responseSize])
+            end = time.time()
+            if returnValue == serverRedirect:
+                # Not an answer; the only server has nowhere better to send us
+                self.redirects.append(end)
+                time.sleep(retransmitTimeout)
+                continue
+            self.requestNumber += 1
+            self.latencies.append(end - start)
+            self.completions.append(end)
+            if returnValue != 0:
+                self.errors += 1
+            return returnValue
+        return None
+
+    def ensureOpen(self, mode):
+        """
+        The server grants read and write locks separately, so switching
+        between reads and writes means closing and reopening the file.
+        """
+        if self.mode == mode or (mode is None and self.mode is not None):
+            return
+        if self.mode is not None:
+            self.request("close " + self.fileName)
+        self.mode = mode or "write"
+        self.request("open " + self.fileName + " " + self.mode)
+        self.offset = 0
+        if self.mode == "write":
+            self.size = 0  # Opened with "w+"
+
+    def run(self):
+        operations = [op for op, weight in self.mix for _ in range(weight)]
+        payload = "benchmark payload"
+        readSize = 16
+
+        # Make sure there is something to read
+        self.ensureOpen("write")
+        self.request("write " + self.fileName + " \"" + payload + "\"")
+        self.offset = self.size = len(payload)
+
+        while not self.stopEvent.is_set():
+            op = random.choice(operations)
+            if op == "read":
+                self.ensureOpen("read")
+                if self.offset + readSize > self.size:
+                    # Rewind rather than read past EOF
+                    self.request("lseek " + self.fileName + " 1")
+                    self.offset = 1
+                self.request("read " + self.fileName + " " + str(readSize))
+                self.offset += readSize
+            elif op == "write":
+                self.ensureOpen("write")
+                self.request("write " + self.fileName + " \"" + payload + "\"")
+                self.offset += len(payload)
+                self.size = max(self.size, self.offset)
+            elif op == "lseek":
+                self.ensureOpen(None)
+                self.request("lseek " + self.fileName + " 1")
+                self.offset = 1
+        self.sock.close()
+
+class localCluster(object):
+    """
+    Owns every process of one run and its temporary working directory.
+    """
+    def __init__(self, numServers, ft, workDir):
+        self.numServers = numServers
+        self.ft = ft
+        self.workDir = workDir
+        self.logCabin = {}
+        self.server = None
+        self.clusterNoSpace = ",".join("127.0.0.1:" + str(logCabinBasePort + i) for i in range(1, numServers + 1))
+
+    def log(self, name):
+        return open(os.path.join(self.workDir, name + ".log"), "a")
+
+    def startLogCabin(self, serverId):
+        config = os.path.join(self.workDir, "logCabin-server_" + str(serverId) + ".conf")
+        self.logCabin[serverId] = subprocess.Popen(
+            [os.path.join(logCabinDir, logCabinBinaryName), "--config", config],
+            cwd=self.workDir, stdout=self.log("logcabin_" + str(serverId)), stderr=subprocess.STDOUT)
+
+    def startServer(self):
+        if self.ft:
+            command = [os.path.join(binDir, ft_serverBinaryName), "-c", self.clusterNoSpace, "-p", str(serverPort),
+                       "--advertise", "127.0.0.1:" + str(serverPort)]
+        else:
+            command = [os.path.join(binDir, serverBinaryName), str(serverPort)]
+        self.server = subprocess.Popen(command, cwd=self.workDir,
+                                       stdout=self.log("simplefilelockservice"), stderr=subprocess.STDOUT)
+
+    def start(self):
+        if self.ft:
+            for i in range(1, self.numServers + 1):
+                with open(os.path.join(self.workDir, "logCabin-server_" + str(i) + ".conf"), "w") as f:
+                    f.write("serverId = " + str(i) + "\n")
+                    f.write("listenAddresses = 127.0.0.1:" + str(logCabinBasePort + i) + "\n")
+
+            # Bootstrap the first server so it becomes the initial leader
+            subprocess.check_call([os.path.join(logCabinDir, logCabinBinaryName), "--config",
+                                   os.path.join(self.workDir, "logCabin-server_1.conf"), "--bootstrap"],
+                                  cwd=self.workDir, stdout=self.log("bootstrap"), stderr=subprocess.STDOUT)
+            for i in range(1, self.numServers + 1):
+                self.startLogCabin(i)
+
+            # Grow the cluster to every server
+            subprocess.check_call([os.path.join(logCabinDir, "Examples", "Reconfigure"),
+                                   "--cluster=" + self.clusterNoSpace, "set"] + self.clusterNoSpace.split(","),
+                                  cwd=self.workDir, stdout=self.log("reconfigure"), stderr=subprocess.STDOUT,
+                                  timeout=30)
+        self.startServer()
+
+    def leader(self):
+        """
+        Ask each LogCabin server for its Raft state; fall back to the
+        bootstrap server.
+        """
+        for serverId, process in self.logCabin.items():
+            if process.poll() is not None:
+                continue
+            try:
+                output = subprocess.check_output(
+                    [os.path.join(logCabinDir, "Client", "ServerControl"),
+                     "--server=127.0.0.1:" + str(logCabinBasePort + serverId), "stats", "get"],
+                    stderr=subprocess.STDOUT, timeout=5).decode(errors="replace")
+            except (subprocess.SubprocessError, OSError):
+                continue
+            if "state: LEADER" in output:
+                return serverId
+        return 1
+
+    def kill(self, target):
+        if target == "leader":
+            if not self.ft:
+                return None
+            serverId = self.leader()
+            self.logCabin[serverId].kill()
+            return "LogCabin server " + str(serverId)
+        elif target == "quorum":
+            if not self.ft:
+                return None
+            majority = sorted(self.logCabin)[:self.numServers // 2 + 1]
+            for serverId in majority:
+                self.logCabin[serverId].kill()
+            return "LogCabin servers " + ",".join(str(serverId) for serverId in majority)
+        elif target == "server":
+            self.server.kill()
+            self.server.wait()
+            self.startServer()
+            return "file lock server (restarted)"
+        return None
+
+    def stop(self):
+        for process in [self.server] + list(self.logCabin.values()):
+            if process is not None and process.poll() is None:
+                process.send_signal(signal.SIGTERM)
+                try:
+                    process.wait(timeout=5)
+                except subprocess.TimeoutExpired:
+                    process.kill()
+
+def runWorkload(ft, args, mix):
+    """
+    Run one workload against one server type and return its summary.
+    """
+    workDir = tempfile.mkdtemp(prefix="sfl_" + ("ft_" if ft else "plain_"))
+    cluster = localCluster(args.servers, ft, workDir)
+    stopEvent = threading.Event()
+    clients = []
+    killTime = None
+    killed = None
+
+    try:
+        cluster.start()
+        time.sleep(args.settle)
+
+        for i in range(args.clients):
+            clients.append(virtualClient(i + 1, serverPort, mix, stopEvent))
+        startTime = time.time()
+        for client in clients:
+            client.start()
+
+        if args.kill != "none":
+            time.sleep(args.kill_at)
+            killTime = time.time()
+            killed = cluster.kill(args.kill)
+            time.sleep(max(0, args.duration - args.kill_at))
+        else:
+            time.sleep(args.duration)
+
+        stopEvent.set()
+        for client in clients:
+            client.join(5)
+        endTime = time.time()
+    finally:
+        cluster.stop()
+        if args.keep:
+            print("Kept " + workDir)
+        else:
+            shutil.rmtree(workDir, ignore_errors=True)
+
+    latencies = sorted(l for client in clients for l in client.latencies)
+    completions = sorted(c for client in clients for c in client.completions)
+    summary = {
+        "server": ft_serverBinaryName if ft else serverBinaryName,
+        "clients": args.clients,
+        "ops": len(latencies),
+        "errors": sum(client.errors for client in clients),
+        "throughput_ops_s": len(latencies) / (endTime - startTime),
+        "p50_ms": percentile(latencies, 0.5) * 1000,
+        "p90_ms": percentile(latencies, 0.9) * 1000,
+        "p99_ms": percentile(latencies, 0.99) * 1000,
+        "p999_ms": percentile(latencies, 0.999) * 1000,
+        "max_ms": (latencies[-1] if latencies else 0) * 1000,
+        "killed": killed,
+        "recover_ms": None,
+        "served_after_kill_ms": None,
+        "redirect_ms": None,
+    }
+    if killTime is not None and killed is not None:
+        after = [c for c in completions if c > killTime]
+        if after:
+            summary["recover_ms"] = (after[0] - killTime) * 1000
+            summary["served_after_kill_ms"] = (after[-1] - killTime) * 1000
+        redirects = sorted(r for client in clients for r in client.redirects if r > killTime)
+        if redirects:
+            summary["redirect_ms"] = (redirects[0] - killTime) * 1000
+    return summary
+
+def parseMix(mixString):
+    mix = []
+    for item in mixString.split(","):
+        op, weight = item.split("=")
+        if op not in ("read", "write", "lseek"):
+            raise argparse.ArgumentTypeError("unknown operation " + op)
+        mix.append((op, int(weight)))
+    return mix
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().split("\n")[0])
+    parser.add_argument("--servers", type=int, default=5, help="LogCabin servers for the FT server [default: 5]")
+    parser.add_argument("--clients", type=int, default=4, help="virtual clients [default: 4]")
+    parser.add_argument("--mix", type=parseMix, default=parseMix("read=50,write=40,lseek=10"),
+                        help="operation weights [default: read=50,write=40,lseek=10]")
+    parser.add_argument("--duration", type=float, default=10, help="seconds of load [default: 10]")
+    parser.add_argument("--kill", choices=["none", "leader", "server", "quorum"], default="none",
+                        help="failure to inject [default: none]")
+    parser.add_argument("--kill-at", type=float, default=5, help="seconds into the run to inject it [default: 5]")
+    parser.add_argument("--only", choices=["plain", "ft"], help="run a single server type")
+    parser.add_argument("--settle", type=float, default=1, help="seconds to wait after startup [default: 1]")
+    parser.add_argument("--json", help="also write the summaries to this file")
+    parser.add_argument("--keep", action="store_true", help="keep the temporary directories and logs")
+    args = parser.parse_args()
+
+    results = []
+    for ft in (False, True):
+        if args.only == ("ft" if not ft else "plain"):
+            continue
+        results.append(runWorkload(ft, args, args.mix))
+
+    columns = ["server", "ops", "errors", "throughput_ops_s", "p50_ms", "p90_ms", "p99_ms", "p999_ms", "max_ms", "recover_ms"]
+    if args.kill == "quorum":
+        columns += ["served_after_kill_ms", "redirect_ms"]
+    print("\t".join(columns))
+    for result in results:
+        print("\t".join(("%.2f" % result[c]) if isinstance(result[c], float) else str(result[c]) for c in columns))
+
+    if args.json:
+        with open(args.json, "w") as f:
+            json.dump(results, f, indent=2)
+
+    # Answers past the takeover window could race a standby's
+    if args.kill == "quorum":
+        for result in results:
+            if result["killed"] is not None and (result["served_after_kill_ms"] or 0) > takeoverWindow * 1000:
+                print(result["server"] + " still served " + ("%.0f" % result["served_after_kill_ms"]) +
+                      " ms after losing quorum", file=sys.stderr)
+                return 1
+
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())